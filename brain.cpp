@@ -1,16 +1,29 @@
 #include "brain.h"
 
-Brain::Brain(const uint16_t num_channels, const Parameters& parameters) :
-  hippocampus(num_channels, parameters) {
+// The most spikes that present_spikes() sends as a batch, unless a frame needs
+// more. A chunk's spikes and outputs stay in cache.
+static constexpr unsigned int PRESENT_CHUNK_SPIKES = 1024;
+
+Brain::Brain(
+    const uint16_t num_channels,
+    const Parameters& parameters,
+    const CortexStorage storage
+) :
+  cortex(num_channels, storage),
+  hippocampus(num_channels, parameters),
+  input_trace(nullptr),
+  output_trace(nullptr) {
 }
 
 void Brain::spike(
-    const float timestamp,
+    const Tick timestamp,
     const uint16_t input_channel,
     const bool use_hippocampus,
     const Parameters& parameters,
     std::vector<uint16_t>* outputs
 ) {
+  const unsigned int first_output = outputs->size();
+
   // Send the spike to the cortex and collect the output spike channels.
   cortex.spike(timestamp, input_channel, outputs);
 
@@ -25,6 +38,146 @@ void Brain::spike(
       hippocampus.receive_output(timestamp, channel);
     }
   }
+
+  if (input_trace != nullptr) {
+    input_trace->write(timestamp, input_channel);
+  }
+  if (output_trace != nullptr) {
+    output_trace->write(
+        timestamp,
+        outputs->data() + first_output,
+        outputs->size() - first_output);
+  }
+}
+
+void Brain::spike_batch(
+    const ScheduledSpike* spikes,
+    const unsigned int num_spikes,
+    const bool use_hippocampus,
+    const Parameters& parameters,
+    SpikeOutputs* outputs
+) {
+  const unsigned int first_output = outputs->spike_count();
+  if (!use_hippocampus) {
+    cortex.spike_batch(spikes, num_spikes, outputs);
+    trace_batch(spikes, num_spikes, *outputs, first_output);
+    return;
+  }
+
+  // Send the batch to the neurons that already exist.
+  const unsigned int num_neurons = cortex.neuron_count();
+  cortex_outputs.clear();
+  cortex.spike_batch(spikes, num_spikes, &cortex_outputs);
+
+  for (unsigned int i = 0; i < num_spikes; i++) {
+    const Tick timestamp = spikes[i].timestamp;
+    const uint16_t input_channel = spikes[i].channel;
+    spike_outputs.assign(
+        cortex_outputs.channels.begin() + cortex_outputs.offsets[i],
+        cortex_outputs.channels.begin() + cortex_outputs.offsets[i + 1]);
+
+    // Send the spike to the neurons created earlier in the batch. They come
+    // after the existing neurons, so their outputs do too.
+    cortex.spike_range(
+        timestamp,
+        input_channel,
+        num_neurons,
+        cortex.neuron_count(),
+        &spike_outputs);
+
+    // Train the hippocampus as spike() does.
+    hippocampus.receive_input(
+        timestamp, input_channel, parameters, &cortex, &spike_outputs);
+    for (const uint16_t channel : spike_outputs) {
+      hippocampus.receive_output(timestamp, channel);
+    }
+
+    outputs->channels.insert(
+        outputs->channels.end(), spike_outputs.begin(), spike_outputs.end());
+    outputs->offsets.push_back(outputs->channels.size());
+  }
+  trace_batch(spikes, num_spikes, *outputs, first_output);
+}
+
+void Brain::present_spikes(
+    SpikeSource* spike_source,
+    const bool use_hippocampus,
+    const Parameters& parameters,
+    SpikeOutputs* outputs,
+    unsigned int* input_counts
+) {
+  const Tick frame_ticks = cortex.get_frame_ticks();
+  for (;;) {
+    // Take the next chunk, extending it to the end of its last frame.
+    present_chunk.clear();
+    for (const ScheduledSpike* spike = spike_source->peek_next();
+        spike != nullptr;
+        spike = spike_source->peek_next()) {
+      if (present_chunk.size() >= PRESENT_CHUNK_SPIKES
+          && (frame_ticks == 0
+              || spike->timestamp / frame_ticks
+                  != present_chunk.back().timestamp / frame_ticks)) {
+        break;
+      }
+      present_chunk.push_back(*spike);
+      spike_source->advance();
+    }
+    if (present_chunk.empty()) {
+      return;
+    }
+
+    if (input_counts != nullptr) {
+      for (const ScheduledSpike& spike : present_chunk) {
+        input_counts[spike.channel]++;
+      }
+    }
+    if (outputs == nullptr) {
+      discarded_outputs.clear();
+    }
+    spike_batch(
+        present_chunk.data(),
+        present_chunk.size(),
+        use_hippocampus,
+        parameters,
+        outputs != nullptr ? outputs : &discarded_outputs);
+  }
+}
+
+void Brain::present_embedding(
+    const Tick start_timestamp,
+    const Tick duration,
+    const uint8_t* embedding,
+    const bool randomize,
+    const bool use_hippocampus,
+    const Parameters& parameters,
+    SpikeScheduler* spike_scheduler,
+    SpikeOutputs* outputs,
+    unsigned int* input_counts
+) {
+  spike_scheduler->schedule_embedding(
+      start_timestamp, duration, embedding, randomize);
+  present_spikes(
+      spike_scheduler, use_hippocampus, parameters, outputs, input_counts);
+}
+
+void Brain::trace_batch(
+    const ScheduledSpike* spikes,
+    const unsigned int num_spikes,
+    const SpikeOutputs& outputs,
+    const unsigned int first_output
+) {
+  for (unsigned int i = 0; i < num_spikes; i++) {
+    if (input_trace != nullptr) {
+      input_trace->write(spikes[i].timestamp, spikes[i].channel);
+    }
+    if (output_trace != nullptr) {
+      const unsigned int j = first_output + i;
+      output_trace->write(
+          spikes[i].timestamp,
+          outputs.channels.data() + outputs.offsets[j],
+          outputs.offsets[j + 1] - outputs.offsets[j]);
+    }
+  }
 }
 
 void Brain::reserve(unsigned int num_neurons) {
@@ -35,3 +188,21 @@ void Brain::reset() {
   hippocampus.reset();
   cortex.reset();
 }
+
+bool Brain::save(const char* path, const bool include_hippocampus) const {
+  BrainCheckpointWriter writer;
+  if (!writer.open(path, cortex.channel_count())) {
+    return false;
+  }
+  const bool ok = cortex.save(&writer)
+      && (!include_hippocampus || hippocampus.save(&writer));
+  return writer.close() && ok;
+}
+
+bool Brain::load(
+    const BrainCheckpoint& checkpoint,
+    const bool load_hippocampus
+) {
+  return cortex.load(checkpoint)
+      && (!load_hippocampus || hippocampus.load(checkpoint));
+}
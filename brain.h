@@ -4,6 +4,9 @@
 #include "cortex.h"
 #include "hippocampus.h"
 #include "parameters.h"
+#include "spike_scheduler.h"
+#include "spike_source.h"
+#include "spike_trace_writer.h"
 
 #include <vector>
 
@@ -11,7 +14,11 @@
 class Brain {
   public:
     // Constructor.
-    Brain(const uint16_t num_channels, const Parameters& parameters);
+    // The storage determines how the cortex lays out its neurons.
+    Brain(
+        uint16_t num_channels,
+        const Parameters& parameters,
+        CortexStorage storage = CortexStorage::NEURON_OBJECTS);
 
     // Reserves storage for the specified number of neurons.
     void reserve(unsigned int num_neurons);
@@ -21,15 +28,94 @@ class Brain {
     // cortex is engaged.
     // Returns a list of the output channels that fire as a result.
     void spike(
-        float timestamp,
+        Tick timestamp,
         uint16_t input_channel,
         bool use_hippocamus,
         const Parameters& parameters,
         std::vector<uint16_t>* outputs);
 
+    // Sends a time-ordered batch of spikes, and appends the output channels of
+    // each spike to the outputs.
+    // The result is identical to calling spike() for each spike. The cortex
+    // neurons that exist at the start of the batch process it as one batch.
+    // Only neurons created by the hippocampus during the batch, and the
+    // hippocampus itself, are processed a spike at a time.
+    void spike_batch(
+        const ScheduledSpike* spikes,
+        unsigned int num_spikes,
+        bool use_hippocampus,
+        const Parameters& parameters,
+        SpikeOutputs* outputs);
+
+    // Sends every spike in the source, in time order, until it's empty.
+    // The spikes are taken a small chunk at a time and each chunk is sent as a
+    // batch, so the source's spikes are never all held in memory at once.
+    // In event-driven mode the result is identical to calling spike_batch()
+    // with all the spikes. A chunk never splits a frame.
+    // The outputs of each spike are appended to the outputs, which can be null
+    // if they aren't needed. If input_counts isn't null, it's incremented for
+    // the channel of each spike.
+    void present_spikes(
+        SpikeSource* spike_source,
+        bool use_hippocampus,
+        const Parameters& parameters,
+        SpikeOutputs* outputs,
+        unsigned int* input_counts = nullptr);
+
+    // Schedules an embedding as spikes over the duration, and sends them as
+    // present_spikes() does, along with any spikes already scheduled.
+    // The spike trains are merged as they're sent, so the spikes are
+    // generated on the fly, with the same timings and random phases as
+    // scheduling the embedding and sending the spikes as one batch.
+    void present_embedding(
+        Tick start_timestamp,
+        Tick duration,
+        const uint8_t* embedding,
+        bool randomize,
+        bool use_hippocampus,
+        const Parameters& parameters,
+        SpikeScheduler* spike_scheduler,
+        SpikeOutputs* outputs,
+        unsigned int* input_counts = nullptr);
+
     // Resets the cortex and hippocampus.
     void reset();
 
+    // Writes the cortex, and the hippocampus if include_hippocampus is true,
+    // to a checkpoint file.
+    // Returns false if it can't be written.
+    bool save(const char* path, bool include_hippocampus) const;
+
+    // Loads the cortex, and the hippocampus if load_hippocampus is true, from
+    // a checkpoint into a brain whose cortex is empty. The cortex may use the
+    // checkpoint's weights in place, so the checkpoint must stay open for as
+    // long as the brain. See Cortex::load().
+    // Returns false if the checkpoint doesn't fit the brain.
+    bool load(const BrainCheckpoint& checkpoint, bool load_hippocampus);
+
+    // Sets the width of the frames that the cortex bins batches of spikes
+    // into, or zero to process each spike as an event. See
+    // Cortex::set_frame_ticks(). Neurons created by the hippocampus during a
+    // batch still process its spikes as events.
+    // Returns false if the width isn't supported.
+    bool set_frame_ticks(Tick frame_ticks, const Parameters& parameters) {
+      return cortex.set_frame_ticks(frame_ticks, parameters);
+    }
+
+    // Sets the number of threads used to process spikes in the cortex.
+    void set_thread_count(unsigned int num_threads) {
+      cortex.set_thread_count(num_threads);
+    }
+
+    // Records the spikes sent to the brain and the spikes it outputs to the
+    // trace writers, either of which can be null. The writers aren't owned.
+    void set_trace_writers(
+        SpikeTraceWriter* input_trace_,
+        SpikeTraceWriter* output_trace_) {
+      input_trace = input_trace_;
+      output_trace = output_trace_;
+    }
+
     // Returns the number of neurons in the cortex.
     unsigned int neuron_count() const { return cortex.neuron_count(); }
 
@@ -39,6 +125,32 @@ class Brain {
 
     // The hippocampus.
     Hippocampus hippocampus;
+
+    // The cortex outputs of a batch of spikes.
+    SpikeOutputs cortex_outputs;
+
+    // The outputs of a single spike in a batch.
+    std::vector<uint16_t> spike_outputs;
+
+    // The chunk of spikes being sent by present_spikes().
+    std::vector<ScheduledSpike> present_chunk;
+
+    // The outputs of a chunk, when the caller doesn't need them.
+    SpikeOutputs discarded_outputs;
+
+    // Nullable. Records the input spikes.
+    SpikeTraceWriter* input_trace;
+
+    // Nullable. Records the output spikes.
+    SpikeTraceWriter* output_trace;
+
+    // Records a batch of spikes and their outputs, from the specified spike
+    // onwards, to whichever trace writers are set.
+    void trace_batch(
+        const ScheduledSpike* spikes,
+        unsigned int num_spikes,
+        const SpikeOutputs& outputs,
+        unsigned int first_output);
 };
 
 #endif // _brain_h
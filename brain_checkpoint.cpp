@@ -0,0 +1,94 @@
+#include "brain_checkpoint.h"
+
+#include <cstdio>
+
+BrainCheckpoint::BrainCheckpoint() :
+  header(nullptr)
+{
+}
+
+BrainCheckpoint::~BrainCheckpoint() {
+  close();
+}
+
+bool BrainCheckpoint::open(const char* path) {
+  close();
+  if (!file.open(
+      path,
+      "brain checkpoint",
+      BRAIN_CHECKPOINT_MAGIC,
+      BRAIN_CHECKPOINT_VERSION,
+      sizeof(BrainCheckpointHeader))) {
+    return false;
+  }
+  header = (const BrainCheckpointHeader*) file.data();
+
+  if (!check_sections()) {
+    fprintf(stderr, "%s: malformed brain checkpoint\n", path);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void BrainCheckpoint::close() {
+  file.close();
+  header = nullptr;
+}
+
+// Returns true if a section of the specified size fits in the file at the
+// offset, which must be aligned.
+static bool fits(
+    const uint64_t offset,
+    const uint64_t section_size,
+    const uint64_t alignment,
+    const size_t file_size
+) {
+  return offset >= sizeof(BrainCheckpointHeader)
+      && offset % alignment == 0
+      && offset <= file_size
+      && section_size <= file_size - offset;
+}
+
+bool BrainCheckpoint::check_sections() const {
+  const uint64_t num_neurons = header->num_neurons;
+  const uint64_t num_channels = header->num_channels;
+  if (num_channels == 0
+      || num_channels > UINT16_MAX
+      || (header->weight_layout != BRAIN_CHECKPOINT_NEURON_ROWS
+          && header->weight_layout != BRAIN_CHECKPOINT_CHANNEL_COLUMNS)) {
+    return false;
+  }
+
+  if (!fits(
+          header->output_channels_offset,
+          num_neurons * sizeof(uint16_t),
+          8,
+          file.size())
+      || !fits(
+          header->refractory_durations_offset,
+          num_neurons * sizeof(Tick),
+          8,
+          file.size())
+      || !fits(
+          header->weights_offset,
+          num_neurons * num_channels,
+          BRAIN_CHECKPOINT_ALIGNMENT,
+          file.size())) {
+    return false;
+  }
+
+  // The output channels must be valid channels.
+  const uint16_t* channels = output_channels();
+  for (uint64_t i = 0; i < num_neurons; i++) {
+    if (channels[i] >= num_channels) {
+      return false;
+    }
+  }
+  return !has_hippocampus()
+      || fits(
+          header->hippocampus_offset,
+          hippocampus_size(num_channels),
+          8,
+          file.size());
+}
@@ -0,0 +1,83 @@
+#ifndef _brain_checkpoint_h
+#define _brain_checkpoint_h
+
+#include "brain_checkpoint_format.h"
+#include "mapped_file.h"
+#include "tick.h"
+
+// A memory-mapped brain checkpoint file, written by Brain::save().
+// Opening a checkpoint checks that its sections fit in the file, without
+// touching the weights. A cortex loaded from it can use the weights in place,
+// and they're paged in as they're used, so the checkpoint must stay open for
+// as long as the brain it's loaded into.
+class BrainCheckpoint {
+  public:
+    // Constructor.
+    BrainCheckpoint();
+
+    // Disable the copy constructor.
+    BrainCheckpoint(const BrainCheckpoint& checkpoint) = delete;
+
+    // Destructor. Unmaps the file.
+    ~BrainCheckpoint();
+
+    // Maps the file.
+    // Returns false if the file can't be mapped or isn't a valid checkpoint.
+    bool open(const char* path);
+
+    // Returns the number of input and output channels.
+    uint16_t num_channels() const { return header->num_channels; }
+
+    // Returns the number of neurons in the cortex.
+    unsigned int num_neurons() const { return header->num_neurons; }
+
+    // Returns BRAIN_CHECKPOINT_NEURON_ROWS or
+    // BRAIN_CHECKPOINT_CHANNEL_COLUMNS.
+    uint32_t weight_layout() const { return header->weight_layout; }
+
+    // Returns the output channel of each neuron.
+    const uint16_t* output_channels() const {
+      return (const uint16_t*) (file.data() + header->output_channels_offset);
+    }
+
+    // Returns the refractory duration of each neuron.
+    const Tick* refractory_durations() const {
+      return (const Tick*) (file.data() + header->refractory_durations_offset);
+    }
+
+    // Returns the weight matrix, in the weight layout.
+    const int8_t* weights() const {
+      return (const int8_t*) (file.data() + header->weights_offset);
+    }
+
+    // Returns true if the hippocampus was saved.
+    bool has_hippocampus() const { return header->hippocampus_offset != 0; }
+
+    // Returns the hippocampus section, if it was saved.
+    // See brain_checkpoint_format.h for its arrays.
+    const uint8_t* hippocampus() const {
+      return file.data() + header->hippocampus_offset;
+    }
+
+    // Returns the size of the hippocampus section of a brain with the
+    // specified number of channels.
+    static uint64_t hippocampus_size(uint16_t num_channels) {
+      return (uint64_t) num_channels
+          * (2 * sizeof(Tick) + 2 * sizeof(float) + sizeof(int16_t) + 1);
+    }
+
+  private:
+    // The mapped file.
+    MappedFile file;
+
+    // The header, which is at the start of the mapped file.
+    const BrainCheckpointHeader* header;
+
+    // Unmaps the file.
+    void close();
+
+    // Returns true if every section fits in the file and is aligned.
+    bool check_sections() const;
+};
+
+#endif // _brain_checkpoint_h
@@ -0,0 +1,74 @@
+#ifndef _brain_checkpoint_format_h
+#define _brain_checkpoint_format_h
+
+#include <cstdint>
+
+// The layout of a brain checkpoint file, which holds a trained cortex, and
+// optionally the hippocampus, so that it can be memory-mapped and used in
+// place. All fields are little-endian.
+//
+// The file starts with a BrainCheckpointHeader, followed by each neuron's
+// output channel, as a uint16_t, then each neuron's refractory duration, as an
+// int64_t, then the weight matrix of num_neurons * num_channels int8_t
+// weights. The weights are laid out as the cortex that was saved stores them:
+// a row of num_channels weights per neuron, or a column of num_neurons weights
+// per channel. The matrix starts on a BRAIN_CHECKPOINT_ALIGNMENT boundary, and
+// every other section on an 8-byte boundary.
+//
+// If the hippocampus was saved, its section has, per channel: the last decay
+// time of the cumulative inputs and of the negative weight controllers, as
+// int64_t, then their values, as float, then the activation level of the
+// under-construction neuron, as int16_t, then its negative weight, as int8_t.
+// Each is an array of num_channels elements, in that order.
+//
+// The neurons' activation levels and refractory periods aren't saved, so a
+// loaded cortex starts out reset.
+
+// The magic number at the start of the file.
+static constexpr char BRAIN_CHECKPOINT_MAGIC[8] = {
+  'B', 'R', 'A', 'I', 'N', 'C', 'K', 'P'
+};
+
+// The current version of the format.
+static constexpr uint32_t BRAIN_CHECKPOINT_VERSION = 1;
+
+// The alignment of the weight matrix, in bytes.
+static constexpr uint64_t BRAIN_CHECKPOINT_ALIGNMENT = 64;
+
+// The layouts of the weight matrix.
+static constexpr uint32_t BRAIN_CHECKPOINT_NEURON_ROWS = 0;
+static constexpr uint32_t BRAIN_CHECKPOINT_CHANNEL_COLUMNS = 1;
+
+// The file header.
+struct BrainCheckpointHeader {
+  // BRAIN_CHECKPOINT_MAGIC.
+  char magic[8];
+
+  // The format version.
+  uint32_t version;
+
+  // The number of input and output channels.
+  uint32_t num_channels;
+
+  // The number of neurons in the cortex.
+  uint32_t num_neurons;
+
+  // BRAIN_CHECKPOINT_NEURON_ROWS or BRAIN_CHECKPOINT_CHANNEL_COLUMNS.
+  uint32_t weight_layout;
+
+  // The file offsets of the output channels, the refractory durations and
+  // the weight matrix.
+  uint64_t output_channels_offset;
+  uint64_t refractory_durations_offset;
+  uint64_t weights_offset;
+
+  // The file offset of the hippocampus section, or zero if it wasn't saved.
+  uint64_t hippocampus_offset;
+
+  // Unused. Zero.
+  uint64_t reserved;
+};
+
+static_assert(sizeof(BrainCheckpointHeader) == 64, "unexpected header padding");
+
+#endif // _brain_checkpoint_format_h
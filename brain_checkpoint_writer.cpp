@@ -0,0 +1,75 @@
+#include "brain_checkpoint_writer.h"
+
+#include <cstring>
+
+BrainCheckpointWriter::BrainCheckpointWriter() :
+  fp(nullptr),
+  checkpoint_header(),
+  next_offset(0)
+{
+}
+
+BrainCheckpointWriter::~BrainCheckpointWriter() {
+  if (fp != nullptr) {
+    close();
+  }
+}
+
+bool BrainCheckpointWriter::open(
+    const char* path,
+    const uint16_t num_channels
+) {
+  if ((fp = fopen(path, "w")) == nullptr) {
+    fprintf(stderr, "fopen %s: %m\n", path);
+    return false;
+  }
+
+  // Write a provisional header, which close() completes.
+  checkpoint_header = BrainCheckpointHeader();
+  memcpy(
+      checkpoint_header.magic,
+      BRAIN_CHECKPOINT_MAGIC,
+      sizeof(checkpoint_header.magic));
+  checkpoint_header.version = BRAIN_CHECKPOINT_VERSION;
+  checkpoint_header.num_channels = num_channels;
+  next_offset = 0;
+  return write(&checkpoint_header, sizeof(checkpoint_header));
+}
+
+bool BrainCheckpointWriter::begin_section(
+    const uint64_t alignment,
+    uint64_t* offset
+) {
+  static const char padding[BRAIN_CHECKPOINT_ALIGNMENT] = {0};
+  const uint64_t aligned_offset =
+      (next_offset + alignment - 1) & ~(alignment - 1);
+  if (!write(padding, aligned_offset - next_offset)) {
+    return false;
+  }
+  *offset = aligned_offset;
+  return true;
+}
+
+bool BrainCheckpointWriter::write(const void* data, const size_t size) {
+  if (size > 0 && fwrite(data, 1, size, fp) != size) {
+    fprintf(stderr, "fwrite brain checkpoint: %m\n");
+    return false;
+  }
+  next_offset += size;
+  return true;
+}
+
+bool BrainCheckpointWriter::close() {
+  bool ok = true;
+  if (fseek(fp, 0, SEEK_SET) != 0
+      || fwrite(&checkpoint_header, sizeof(checkpoint_header), 1, fp) != 1) {
+    fprintf(stderr, "fwrite brain checkpoint header: %m\n");
+    ok = false;
+  }
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "fclose brain checkpoint: %m\n");
+    ok = false;
+  }
+  fp = nullptr;
+  return ok;
+}
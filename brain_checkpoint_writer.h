@@ -0,0 +1,55 @@
+#ifndef _brain_checkpoint_writer_h
+#define _brain_checkpoint_writer_h
+
+#include "brain_checkpoint_format.h"
+
+#include <cstddef>
+#include <cstdio>
+
+// Writes a brain checkpoint file, a section at a time.
+// See brain_checkpoint_format.h for the format.
+class BrainCheckpointWriter {
+  public:
+    // Constructor.
+    BrainCheckpointWriter();
+
+    // Disable the copy constructor.
+    BrainCheckpointWriter(const BrainCheckpointWriter& writer) = delete;
+
+    // Destructor. Closes the file if it's open.
+    ~BrainCheckpointWriter();
+
+    // Creates the file, for a brain with the specified number of channels.
+    // Returns false if it can't be created.
+    bool open(const char* path, uint16_t num_channels);
+
+    // Returns the header, which close() writes. The sections' writers fill
+    // in their offsets and counts.
+    BrainCheckpointHeader* header() { return &checkpoint_header; }
+
+    // Pads the file to the alignment, a power of two no greater than
+    // BRAIN_CHECKPOINT_ALIGNMENT, and returns the offset at which the next
+    // section starts.
+    // Returns false if the padding can't be written.
+    bool begin_section(uint64_t alignment, uint64_t* offset);
+
+    // Appends data to the current section.
+    // Returns false if it can't be written.
+    bool write(const void* data, size_t size);
+
+    // Writes the header and closes the file.
+    // Returns false if it can't be written.
+    bool close();
+
+  private:
+    // The file, or null if it isn't open.
+    FILE* fp;
+
+    // The header, completed as the sections are written.
+    BrainCheckpointHeader checkpoint_header;
+
+    // The file offset at which the next data will be written.
+    uint64_t next_offset;
+};
+
+#endif // _brain_checkpoint_writer_h
@@ -0,0 +1,412 @@
+#include "channel_index.h"
+
+#include <algorithm>
+
+// The fraction of a range of neurons, as 1 / DENSE_FRAME_RATIO, above which
+// the neurons with inputs in a frame are found by scanning the range.
+static constexpr unsigned int DENSE_FRAME_RATIO = 16;
+
+ChannelIndex::ChannelIndex(const uint16_t num_channels) :
+  positive_rows(num_channels),
+  negative_rows(num_channels)
+{
+}
+
+void ChannelIndex::add_neuron(
+    const uint16_t output_channel,
+    const int8_t* weights,
+    const Tick refractory_duration
+) {
+  const uint32_t idx = states.size();
+  const uint64_t bit = (uint64_t) 1 << (idx % 64);
+  for (unsigned int i = 0; i < positive_rows.size(); i++) {
+    Row& row = positive_rows[i];
+    NegativeRow& negative_row = negative_rows[i];
+    if (idx % NEURON_BLOCK_SIZE == 0) {
+      row.block_offsets.push_back(row.neurons.size());
+    }
+    if (idx % 64 == 0) {
+      negative_row.bits.push_back(0);
+      negative_row.offsets.push_back(negative_row.weights.size());
+    }
+    if (weights[i] > 0) {
+      row.neurons.push_back(idx % NEURON_BLOCK_SIZE);
+      row.weights.push_back(weights[i]);
+    } else if (weights[i] < 0) {
+      negative_row.bits.back() |= bit;
+      negative_row.weights.push_back(weights[i]);
+    }
+  }
+  states.add(output_channel, refractory_duration);
+  activated_bits.resize((states.size() + 63) / 64, 0);
+}
+
+void ChannelIndex::find_block_entries(
+    const Row& row,
+    const unsigned int block,
+    const unsigned int begin,
+    unsigned int* first,
+    unsigned int* last
+) {
+  *first = row.block_offsets[block];
+  *last = block + 1 < row.block_offsets.size()
+      ? row.block_offsets[block + 1] : row.neurons.size();
+  const unsigned int block_begin = block * NEURON_BLOCK_SIZE;
+  if (begin > block_begin) {
+    *first = std::lower_bound(
+        row.neurons.begin() + *first,
+        row.neurons.begin() + *last,
+        begin - block_begin) - row.neurons.begin();
+  }
+}
+
+// Returns a mask of the bits of word i of a bitmap of neurons that are in
+// [begin, end).
+static inline uint64_t range_mask(
+    const unsigned int i,
+    const unsigned int begin,
+    const unsigned int end
+) {
+  uint64_t mask = ~(uint64_t) 0;
+  if (begin > i * 64) {
+    mask &= ~(uint64_t) 0 << (begin - i * 64);
+  }
+  if (end < i * 64 + 64) {
+    mask &= ((uint64_t) 1 << (end - i * 64)) - 1;
+  }
+  return mask;
+}
+
+int8_t ChannelIndex::get_negative_weight(
+    const uint32_t neuron,
+    const uint16_t channel
+) const {
+  const NegativeRow& row = negative_rows[channel];
+  const uint64_t bit = (uint64_t) 1 << (neuron % 64);
+  const uint64_t bits = row.bits[neuron / 64];
+  if ((bits & bit) == 0) {
+    return 0;
+  }
+  return row.weights[
+      row.offsets[neuron / 64] + __builtin_popcountll(bits & (bit - 1))];
+}
+
+// Returns the sum of a neuron's negative weights on the channels, from the
+// channels' negative rows. A weight's position is the number of neurons with
+// negative weights before it.
+// Inlined into a variant per instruction set, as a popcount instruction is
+// several times faster than the generic one.
+template <typename NegativeRow>
+__attribute__((always_inline))
+static inline int32_t sum_weights(
+    const NegativeRow* rows,
+    const uint16_t* channels,
+    const unsigned int num_channels,
+    const uint32_t neuron
+) {
+  const uint64_t bit = (uint64_t) 1 << (neuron % 64);
+  int32_t sum = 0;
+  for (unsigned int i = 0; i < num_channels; i++) {
+    const NegativeRow& row = rows[channels[i]];
+    const uint64_t bits = row.bits[neuron / 64];
+    if ((bits & bit) != 0) {
+      sum += row.weights[
+          row.offsets[neuron / 64] + __builtin_popcountll(bits & (bit - 1))];
+    }
+  }
+  return sum;
+}
+
+// Variants of sum_weights() for each instruction set.
+template <typename NegativeRow>
+static int32_t sum_weights_generic(
+    const NegativeRow* rows,
+    const uint16_t* channels,
+    const unsigned int num_channels,
+    const uint32_t neuron
+) {
+  return sum_weights(rows, channels, num_channels, neuron);
+}
+
+template <typename NegativeRow>
+__attribute__((target("popcnt")))
+static int32_t sum_weights_popcnt(
+    const NegativeRow* rows,
+    const uint16_t* channels,
+    const unsigned int num_channels,
+    const uint32_t neuron
+) {
+  return sum_weights(rows, channels, num_channels, neuron);
+}
+
+// Applies a spike's negative weights to the activated neurons in
+// [begin, end), from the negative row of its channel, and clears the bits
+// of those it deactivates.
+__attribute__((always_inline))
+static inline void apply_weights(
+    const uint64_t* negative_bits,
+    const uint32_t* offsets,
+    const int8_t* weights,
+    const unsigned int begin,
+    const unsigned int end,
+    int16_t* activation_levels,
+    uint64_t* activated_bits
+) {
+  for (unsigned int i = begin / 64; i * 64 < end; i++) {
+    const uint64_t bits = negative_bits[i];
+    const uint64_t affected =
+        activated_bits[i] & bits & range_mask(i, begin, end);
+    uint64_t deactivated = 0;
+    for (uint64_t matches = affected; matches != 0; matches &= matches - 1) {
+      const uint64_t bit = matches & -matches;
+      const uint32_t neuron = i * 64 + __builtin_ctzll(matches);
+      const int activation_level = activation_levels[neuron]
+          + weights[offsets[i] + __builtin_popcountll(bits & (bit - 1))];
+      activation_levels[neuron] = activation_level > 0 ? activation_level : 0;
+      deactivated |= activation_level > 0 ? 0 : bit;
+    }
+    activated_bits[i] &= ~deactivated;
+  }
+}
+
+// Variants of apply_weights() for each instruction set.
+static void apply_weights_generic(
+    const uint64_t* negative_bits,
+    const uint32_t* offsets,
+    const int8_t* weights,
+    const unsigned int begin,
+    const unsigned int end,
+    int16_t* activation_levels,
+    uint64_t* activated_bits
+) {
+  apply_weights(
+      negative_bits, offsets, weights, begin, end, activation_levels,
+      activated_bits);
+}
+
+__attribute__((target("popcnt")))
+static void apply_weights_popcnt(
+    const uint64_t* negative_bits,
+    const uint32_t* offsets,
+    const int8_t* weights,
+    const unsigned int begin,
+    const unsigned int end,
+    int16_t* activation_levels,
+    uint64_t* activated_bits
+) {
+  apply_weights(
+      negative_bits, offsets, weights, begin, end, activation_levels,
+      activated_bits);
+}
+
+// Returns true if the CPU supports the popcount instruction.
+static bool check_popcnt_support() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("popcnt");
+}
+
+// Whether the CPU supports the popcount instruction.
+static const bool is_popcnt_supported = check_popcnt_support();
+
+int32_t ChannelIndex::sum_negative_weights(
+    const uint32_t neuron,
+    const std::vector<uint16_t>& channels
+) const {
+  if (is_popcnt_supported) {
+    return sum_weights_popcnt(
+        negative_rows.data(), channels.data(), channels.size(), neuron);
+  }
+  return sum_weights_generic(
+      negative_rows.data(), channels.data(), channels.size(), neuron);
+}
+
+void ChannelIndex::apply_negative_weights(
+    const uint16_t input_channel,
+    const unsigned int begin,
+    const unsigned int end
+) {
+  const NegativeRow& row = negative_rows[input_channel];
+  if (is_popcnt_supported) {
+    apply_weights_popcnt(
+        row.bits.data(), row.offsets.data(), row.weights.data(), begin, end,
+        states.activation_levels.data(), activated_bits.data());
+  } else {
+    apply_weights_generic(
+        row.bits.data(), row.offsets.data(), row.weights.data(), begin, end,
+        states.activation_levels.data(), activated_bits.data());
+  }
+}
+
+void ChannelIndex::spike_range(
+    const Tick timestamp,
+    const uint16_t input_channel,
+    const unsigned int begin,
+    const unsigned int end,
+    std::vector<uint16_t>* outputs
+) {
+  // Apply the negative weights. Activation levels are clipped at zero, so
+  // they have no effect on neurons that aren't activated. And an activated
+  // neuron can't be in its refractory period, because firing resets it.
+  apply_negative_weights(input_channel, begin, end);
+
+  // Apply the positive weights, which can cause neurons to fire.
+  const Row& row = positive_rows[input_channel];
+  int16_t* activation_levels = states.activation_levels.data();
+  Tick* end_times = states.refractory_period_end_times.data();
+  for (unsigned int block = begin / NEURON_BLOCK_SIZE;
+      block < row.block_offsets.size() && block * NEURON_BLOCK_SIZE < end;
+      block++) {
+    const uint32_t block_begin = block * NEURON_BLOCK_SIZE;
+    unsigned int first;
+    unsigned int last;
+    find_block_entries(row, block, begin, &first, &last);
+    unsigned int pending_word = 0;
+    uint64_t pending_bits = 0;
+    for (unsigned int i = first; i < last; i++) {
+      const uint32_t neuron = block_begin + row.neurons[i];
+      if (neuron >= end) {
+        break;
+      }
+      // The rule of NeuronStates::spike(), which can't clip a positive
+      // weight at zero. Only a firing branches, as refractory neurons are
+      // left unchanged by selecting their old level.
+      const int old_level = activation_levels[neuron];
+      const int level = old_level + row.weights[i];
+      const bool is_refractory = timestamp < end_times[neuron];
+      if (level >= 128 && !is_refractory) {
+        activation_levels[neuron] = 0;
+        end_times[neuron] = timestamp + states.refractory_durations[neuron];
+        outputs->push_back(states.output_channels[neuron]);
+        activated_bits[pending_word] |= pending_bits;
+        pending_bits = 0;
+        update_activated(neuron);
+        continue;
+      }
+      const int new_level = is_refractory ? old_level : level;
+      activation_levels[neuron] = new_level;
+      if (neuron / 64 != pending_word) {
+        activated_bits[pending_word] |= pending_bits;
+        pending_word = neuron / 64;
+        pending_bits = 0;
+      }
+      pending_bits |= (uint64_t) (new_level > 0) << (neuron % 64);
+    }
+    activated_bits[pending_word] |= pending_bits;
+    pending_bits = 0;
+  }
+}
+
+void ChannelIndex::accumulate_row(
+    const Row& row,
+    const unsigned int begin,
+    const unsigned int end
+) {
+  for (unsigned int block = begin / NEURON_BLOCK_SIZE;
+      block < row.block_offsets.size() && block * NEURON_BLOCK_SIZE < end;
+      block++) {
+    const uint32_t block_begin = block * NEURON_BLOCK_SIZE;
+    unsigned int first;
+    unsigned int last;
+    find_block_entries(row, block, begin, &first, &last);
+    for (unsigned int i = first; i < last; i++) {
+      const uint32_t neuron = block_begin + row.neurons[i];
+      if (neuron >= end) {
+        break;
+      }
+      frame_inputs[neuron] += row.weights[i];
+      add_frame_neuron(neuron);
+    }
+  }
+}
+
+void ChannelIndex::spike_frame_range(
+    const Tick timestamp,
+    const uint64_t* channel_bits,
+    const unsigned int begin,
+    const unsigned int end,
+    std::vector<uint16_t>* outputs
+) {
+  frame_inputs.resize(states.size(), 0);
+  is_frame_neuron.resize(states.size(), 0);
+
+  // Sum the rows of the channels that spiked.
+  frame_channels.clear();
+  const unsigned int num_words = (positive_rows.size() + 63) / 64;
+  for (unsigned int word = 0; word < num_words; word++) {
+    for (uint64_t bits = channel_bits[word]; bits != 0; bits &= bits - 1) {
+      const unsigned int channel = word * 64 + __builtin_ctzll(bits);
+      frame_channels.push_back(channel);
+      accumulate_row(positive_rows[channel], begin, end);
+    }
+  }
+
+  // The negative weights are summed with the positive ones before clipping,
+  // so they matter to the neurons above and the activated ones. The others
+  // only have negative inputs, which leave a zero activation level at zero.
+  for (unsigned int word = begin / 64; word * 64 < end; word++) {
+    for (uint64_t bits = activated_bits[word]; bits != 0; bits &= bits - 1) {
+      const uint32_t neuron = word * 64 + __builtin_ctzll(bits);
+      if (neuron >= begin && neuron < end) {
+        add_frame_neuron(neuron);
+      }
+    }
+  }
+
+  // Apply the inputs in neuron order, so the outputs are in neuron order.
+  // When enough of the range has inputs, finding them in order is cheaper than
+  // sorting them.
+  if (frame_neurons.size() * DENSE_FRAME_RATIO > end - begin) {
+    frame_neurons.clear();
+    for (unsigned int neuron = begin; neuron < end; neuron++) {
+      if (is_frame_neuron[neuron]) {
+        frame_neurons.push_back(neuron);
+      }
+    }
+  } else {
+    std::sort(frame_neurons.begin(), frame_neurons.end());
+  }
+  for (const uint32_t neuron : frame_neurons) {
+    const int32_t input =
+        frame_inputs[neuron] + sum_negative_weights(neuron, frame_channels);
+    frame_inputs[neuron] = 0;
+    is_frame_neuron[neuron] = 0;
+    if (states.apply_input(neuron, timestamp, input)) {
+      outputs->push_back(states.output_channels[neuron]);
+    }
+    update_activated(neuron);
+  }
+  frame_neurons.clear();
+}
+
+void ChannelIndex::copy_column(
+    const uint16_t input_channel,
+    int8_t* column
+) const {
+  const unsigned int n = states.size();
+  for (unsigned int i = 0; i < n; i++) {
+    column[i] = get_negative_weight(i, input_channel);
+  }
+  const Row& row = positive_rows[input_channel];
+  for (unsigned int block = 0; block < row.block_offsets.size(); block++) {
+    unsigned int first;
+    unsigned int last;
+    find_block_entries(row, block, 0, &first, &last);
+    for (unsigned int i = first; i < last; i++) {
+      column[block * NEURON_BLOCK_SIZE + row.neurons[i]] = row.weights[i];
+    }
+  }
+}
+
+void ChannelIndex::reserve(const unsigned int num_neurons) {
+  states.reserve(num_neurons);
+  for (NegativeRow& row : negative_rows) {
+    row.bits.reserve((num_neurons + 63) / 64);
+    row.offsets.reserve((num_neurons + 63) / 64);
+  }
+  activated_bits.reserve((num_neurons + 63) / 64);
+}
+
+void ChannelIndex::reset() {
+  states.reset();
+  std::fill(activated_bits.begin(), activated_bits.end(), 0);
+}
@@ -0,0 +1,182 @@
+#ifndef _channel_index_h
+#define _channel_index_h
+
+#include "neuron_states.h"
+
+#include <cstdint>
+#include <vector>
+
+// Stores the weights of the neurons in a cortex as an inverted index from
+// each input channel to the neurons with a positive weight on it, so a spike
+// only visits the neurons it can affect. An entry takes three bytes: the
+// neuron's position in its block of NEURON_BLOCK_SIZE neurons, and the weight.
+// The hippocampus gives a neuron a negative weight on most of the channels it
+// doesn't have a positive weight on, so indexing the negative weights the same
+// way would visit most neurons on every spike. But a negative weight only has
+// an effect on a neuron whose activation level is positive, so instead each
+// channel keeps a bitmap of the neurons with a negative weight on it, and
+// their weights in neuron order, and a spike looks them up for the activated
+// neurons alone.
+//
+// The index takes about 0.19 bytes per neuron and channel for the bitmaps,
+// plus a byte per negative weight and three per positive weight. It's smaller
+// than a matrix of the weights when fewer than about two in five of them are
+// non-zero, which isn't the case for the neurons the hippocampus creates.
+class ChannelIndex {
+  public:
+    // Constructor.
+    ChannelIndex(uint16_t num_channels);
+
+    // Adds a neuron with the specified weights, one per input channel.
+    void add_neuron(
+        uint16_t output_channel,
+        const int8_t* weights,
+        Tick refractory_duration);
+
+    // Sends a spike to the specified input channel.
+    // Appends the output channels of the neurons that fire, in neuron order.
+    void spike(
+        Tick timestamp,
+        uint16_t input_channel,
+        std::vector<uint16_t>* outputs) {
+      spike_range(timestamp, input_channel, 0, neuron_count(), outputs);
+    }
+
+    // Sends a spike to the specified input channel of neurons [begin, end).
+    // Appends the output channels of the neurons that fire, in neuron order.
+    void spike_range(
+        Tick timestamp,
+        uint16_t input_channel,
+        unsigned int begin,
+        unsigned int end,
+        std::vector<uint16_t>* outputs);
+
+    // Sends a frame of spikes to neurons [begin, end). Each neuron takes the
+    // sum of its weights on the channels set in the bitset at once, and only
+    // the neurons with a weight on one of them are visited.
+    // Appends the output channels of the neurons that fire, in neuron order.
+    // Unlike spike_range(), ranges can't be spiked concurrently.
+    void spike_frame_range(
+        Tick timestamp,
+        const uint64_t* channel_bits,
+        unsigned int begin,
+        unsigned int end,
+        std::vector<uint16_t>* outputs);
+
+    // Writes the weights of every neuron on an input channel, including the
+    // zero weights, to column[0] to column[neuron_count() - 1].
+    void copy_column(uint16_t input_channel, int8_t* column) const;
+
+    // Returns the state of the neurons.
+    const NeuronStates& neuron_states() const { return states; }
+
+    // Resets the activation level of all the neurons.
+    void reset();
+
+    // Reserves storage for the specified number of neurons.
+    void reserve(unsigned int num_neurons);
+
+    // Returns the number of neurons.
+    unsigned int neuron_count() const { return states.size(); }
+
+    // The number of neurons in a block, whose entries in a row share the
+    // high bits of their neuron numbers.
+    static constexpr unsigned int NEURON_BLOCK_SIZE = 65536;
+
+  private:
+    // The neurons with a positive weight on an input channel, in ascending
+    // order, and their weights. The neurons are numbered from the start of
+    // their block, and the entries of block b start at block_offsets[b].
+    struct Row {
+      std::vector<uint16_t> neurons;
+      std::vector<int8_t> weights;
+      std::vector<uint32_t> block_offsets;
+    };
+
+    // The neurons with a negative weight on an input channel, as a bitmap,
+    // and their weights, in neuron order. The weights of the neurons in word
+    // i of the bitmap start at offsets[i], so a neuron's weight is found by
+    // counting the bits before its own.
+    struct NegativeRow {
+      std::vector<uint64_t> bits;
+      std::vector<uint32_t> offsets;
+      std::vector<int8_t> weights;
+    };
+
+    // The positive weights of each input channel.
+    std::vector<Row> positive_rows;
+
+    // The negative weights of each input channel.
+    std::vector<NegativeRow> negative_rows;
+
+    // The state of each neuron.
+    NeuronStates states;
+
+    // A bitmap of the neurons with a positive activation level, which are
+    // visited in neuron order so that their weights are read sequentially.
+    std::vector<uint64_t> activated_bits;
+
+    // The summed input of each neuron during a frame, which is zero outside
+    // spike_frame_range().
+    std::vector<int32_t> frame_inputs;
+
+    // The neurons with a weight on a channel in the frame, and whether each
+    // neuron is among them.
+    std::vector<uint32_t> frame_neurons;
+    std::vector<uint8_t> is_frame_neuron;
+
+    // The channels set in a frame's bitset.
+    std::vector<uint16_t> frame_channels;
+
+    // Sets or clears a neuron's bit in the bitmap of activated neurons,
+    // according to its activation level.
+    void update_activated(const uint32_t neuron) {
+      const uint64_t bit = (uint64_t) 1 << (neuron % 64);
+      if (states.activation_levels[neuron] > 0) {
+        activated_bits[neuron / 64] |= bit;
+      } else {
+        activated_bits[neuron / 64] &= ~bit;
+      }
+    }
+
+    // Returns a neuron's weight on a channel if it's negative, or zero.
+    int8_t get_negative_weight(uint32_t neuron, uint16_t channel) const;
+
+    // Returns the sum of a neuron's negative weights on the channels.
+    int32_t sum_negative_weights(
+        uint32_t neuron,
+        const std::vector<uint16_t>& channels) const;
+
+    // Applies the negative weights of a spike on a channel to the activated
+    // neurons in [begin, end).
+    void apply_negative_weights(
+        uint16_t input_channel,
+        unsigned int begin,
+        unsigned int end);
+
+    // Sets the entries of a block of a row, from the first for a neuron at
+    // or after begin to the end of the block.
+    static void find_block_entries(
+        const Row& row,
+        unsigned int block,
+        unsigned int begin,
+        unsigned int* first,
+        unsigned int* last);
+
+    // Adds a row's weights for neurons [begin, end) to their frame inputs.
+    void accumulate_row(
+        const Row& row,
+        unsigned int begin,
+        unsigned int end);
+
+    // Adds a neuron to the neurons with inputs in a frame, if it isn't
+    // already among them.
+    void add_frame_neuron(uint32_t neuron) {
+      if (!is_frame_neuron[neuron]) {
+        is_frame_neuron[neuron] = 1;
+        frame_neurons.push_back(neuron);
+      }
+    }
+};
+
+#endif // _channel_index_h
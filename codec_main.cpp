@@ -1,44 +1,138 @@
 #include "spike_scheduler.h"
-#include "token.h"
 #include "token_output.h"
+#include "token_store.h"
 
-// Decodes the scheduled spikes.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+
+// The number of times per sample that an early exit is considered.
+static constexpr unsigned int CHECKS_PER_SAMPLE = 16;
+
+// The tally of the decoded tokens, and of what early exits saved.
+struct DecodeStats {
+  unsigned int num_tokens;
+  unsigned int num_wrong_tokens;
+  unsigned int num_early_tokens;
+  uint64_t num_spikes;
+  uint64_t num_skipped_spikes;
+  Tick skipped_ticks;
+};
+
+// Returns the name of an encoding.
+static const char* encoding_name(const SpikeEncoding encoding) {
+  return encoding == SpikeEncoding::LATENCY ? "latency" : "rate";
+}
+
+// Decodes the scheduled spikes of the sample starting at the timestamp.
+// If early_exit is set, the token is decoded as soon as its lead is safe,
+// and the rest of the sample's spikes are skipped.
 // Returns false if the spikes can't be decoded.
 static bool decode_spikes(
+    const Tick start_timestamp,
+    const Tick duration,
+    const bool early_exit,
+    const bool print_tokens,
+    const Token& expected_token,
     SpikeScheduler* spike_scheduler,
-    TokenOutput* token_output
+    TokenOutput* token_output,
+    DecodeStats* stats
 ) {
   token_output->reset();
+  token_output->set_latency_window(
+      start_timestamp, spike_scheduler->latency_window(duration));
+  const Tick end_timestamp = start_timestamp + duration;
+  const Tick check_interval = std::max<Tick>(1, duration / CHECKS_PER_SAMPLE);
+  Tick check_timestamp = start_timestamp + check_interval;
+  const Token* best_token = nullptr;
   for (;;) {
     const ScheduledSpike* scheduled_spike = spike_scheduler->peek_next();
     if (scheduled_spike == nullptr) {
       break;
     }
-    token_output->spike({scheduled_spike->channel});
+
+    // Check the lead once every spike before the check has been counted.
+    if (early_exit && scheduled_spike->timestamp >= check_timestamp) {
+      best_token = token_output->confident_token();
+      if (best_token != nullptr) {
+        stats->num_early_tokens++;
+        stats->num_skipped_spikes +=
+            spike_scheduler->skip_until(end_timestamp);
+        stats->skipped_ticks += end_timestamp - check_timestamp;
+        break;
+      }
+      while (check_timestamp <= scheduled_spike->timestamp) {
+        check_timestamp += check_interval;
+      }
+    }
+
+    token_output->spike(
+        {scheduled_spike->channel}, scheduled_spike->timestamp);
+    stats->num_spikes++;
     spike_scheduler->advance();
   }
 
   // Exit if no token passes the validity threshold.
-  const Token* best_token = token_output->best_token();
+  if (best_token == nullptr) {
+    best_token = token_output->best_token();
+  }
   if (best_token == nullptr) {
     printf("\n");
     return false;
   }
+  stats->num_tokens++;
+  stats->num_wrong_tokens += best_token != &expected_token;
+
   // Print the token.
+  if (!print_tokens) {
+    return true;
+  }
   if (best_token->is_suffix) {
-    printf("%s", best_token->text.c_str());
+    printf("%s", best_token->text);
   } else {
-    printf(" %s", best_token->text.c_str());
+    printf(" %s", best_token->text);
   }
   fflush(stdout);
   return true;
 }
 
+// Prints the tally of the decoded tokens.
+static void print_stats(
+    const Parameters& parameters,
+    const SpikeEncoding encoding,
+    const bool early_exit,
+    const DecodeStats& stats
+) {
+  printf("Decoded %u %s-encoded tokens, %u wrong, %.0f spikes per token\n",
+      stats.num_tokens,
+      encoding_name(encoding),
+      stats.num_wrong_tokens,
+      stats.num_tokens > 0 ? (double) stats.num_spikes / stats.num_tokens : 0);
+  if (!early_exit || stats.num_tokens == 0) {
+    return;
+  }
+  const uint64_t total_spikes = stats.num_spikes + stats.num_skipped_spikes;
+  printf("Exited early on %u tokens, saving %.1f ms (%.0f%%) and %.0f spikes "
+      "(%.0f%%) per token\n",
+      stats.num_early_tokens,
+      stats.skipped_ticks / 1000.0 / stats.num_tokens,
+      100.0 * stats.skipped_ticks
+          / ((double) parameters.TICKS_PER_SAMPLE * stats.num_tokens),
+      (double) stats.num_skipped_spikes / stats.num_tokens,
+      total_spikes > 0 ? 100.0 * stats.num_skipped_spikes / total_spikes : 0);
+}
+
 // Reads the tokens from the specified file and transcodes them.
 // Returns false if there's a problem.
 static bool transcode_tokens(
     const Parameters& parameters,
     const char* path,
+    const uint64_t seed,
+    const SpikeEncoding encoding,
+    const bool early_exit,
+    const bool print_tokens,
     const std::vector<Token>& tokens
 ) {
   FILE* fp;
@@ -47,24 +141,37 @@ static bool transcode_tokens(
     return false;
   }
 
-  SpikeScheduler spike_scheduler(tokens[0].num_channels, parameters);
-  TokenOutput token_output;
+  SpikeScheduler spike_scheduler(
+      tokens[0].num_channels, parameters, seed, /* stream= */ 0, encoding);
+  TokenOutput token_output(TokenDecoding::DEFERRED, encoding);
   token_output.set_tokens(tokens);
-  const float duration = parameters.SECONDS_PER_SAMPLE;
-  float timestamp = 0;
+  const Tick duration = parameters.TICKS_PER_SAMPLE;
+  Tick timestamp = 0;
+  DecodeStats stats = {};
   for (;;) {
     uint16_t token_id;
     if (fread(&token_id, sizeof(uint16_t), 1, fp) != 1) {
       break;
     }
-    spike_scheduler.schedule_embedding(
-        timestamp, duration, tokens[token_id].embedding, /* randomize= */ true);
-    timestamp += duration;
-    if (!decode_spikes(&spike_scheduler, &token_output)) {
+    spike_scheduler.schedule_token(
+        timestamp, duration, tokens[token_id], /* randomize= */ true);
+    if (!decode_spikes(
+        timestamp,
+        duration,
+        early_exit,
+        print_tokens,
+        tokens[token_id],
+        &spike_scheduler,
+        &token_output,
+        &stats)) {
       break;
     }
+    timestamp += duration;
+  }
+  if (print_tokens) {
+    printf("\n");
   }
-  printf("\n");
+  print_stats(parameters, encoding, early_exit, stats);
 
   fclose(fp);
   return true;
@@ -72,21 +179,76 @@ static bool transcode_tokens(
 
 int main(int argc, char** argv) {
   const Parameters parameters = Parameters::DEFAULT_PARAMETERS;
+  int opt;
+  bool early_exit = false;
+  bool compare_encodings = false;
+  SpikeEncoding encoding = SpikeEncoding::RATE;
+  while ((opt = getopt(argc, argv, "CE:e")) != -1) {
+    switch (opt) {
+      case 'C':
+        compare_encodings = true;
+        break;
+      case 'E':
+        if (strcmp(optarg, "rate") == 0) {
+          encoding = SpikeEncoding::RATE;
+        } else if (strcmp(optarg, "latency") == 0) {
+          encoding = SpikeEncoding::LATENCY;
+        } else {
+          fprintf(stderr, "Unknown encoding %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'e':
+        early_exit = true;
+        break;
+      default:
+        printf("Usage: %s [-C] [-E rate|latency] [-e] [seed]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  // The seed can be given to replay a run.
+  const uint64_t seed = optind < argc
+      ? strtoull(argv[optind], nullptr, 10) : CounterRng::time_seed();
+  printf("Random seed %llu\n", (unsigned long long) seed);
 
-  std::vector<Token> tokens;
-  if (!Token::parse(
-      "data/tokens-20k.raw",
-      "data/embeddings-500.raw",
-      500,
-      &tokens)) {
+  TokenStore token_store;
+  if (!token_store.open("data/tokens-20k.store")) {
     return 1;
   }
-  printf("Parsed %lu tokens\n", tokens.size());
+  const std::vector<Token>& tokens = token_store.tokens();
+  printf("Loaded %zu tokens\n", tokens.size());
   if (tokens.empty()) {
     return 1;
   }
 
-  if (!transcode_tokens(parameters, "data/economist.tok", tokens)) {
+  // Compare the accuracy and spike counts of the encodings, rather than
+  // printing the tokens.
+  if (compare_encodings) {
+    for (const SpikeEncoding compared_encoding :
+         {SpikeEncoding::RATE, SpikeEncoding::LATENCY}) {
+      if (!transcode_tokens(
+          parameters,
+          "data/economist.tok",
+          seed,
+          compared_encoding,
+          early_exit,
+          /* print_tokens= */ false,
+          tokens)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  if (!transcode_tokens(
+      parameters,
+      "data/economist.tok",
+      seed,
+      encoding,
+      early_exit,
+      /* print_tokens= */ true,
+      tokens)) {
     return 1;
   }
   return 0;
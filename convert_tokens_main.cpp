@@ -0,0 +1,30 @@
+#include "token_store.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Converts a token strings file and a token embeddings file to a token store.
+int main(int argc, char** argv) {
+  if (argc != 5) {
+    printf(
+        "Usage: %s strings embeddings num_channels store\n",
+        argv[0]);
+    return 1;
+  }
+  const int num_channels = atoi(argv[3]);
+  if (num_channels <= 0 || num_channels > UINT16_MAX) {
+    fprintf(stderr, "Invalid number of channels: %s\n", argv[3]);
+    return 1;
+  }
+  if (!TokenStore::convert(argv[1], argv[2], num_channels, argv[4])) {
+    return 1;
+  }
+
+  // Check that the store can be opened.
+  TokenStore store;
+  if (!store.open(argv[4])) {
+    return 1;
+  }
+  printf("Converted %zu tokens\n", store.tokens().size());
+  return 0;
+}
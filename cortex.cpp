@@ -1,13 +1,286 @@
 #include "cortex.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// Shards are a multiple of this many neurons, so that threads don't write to
+// the same cache lines.
+static constexpr unsigned int SHARD_ALIGNMENT = 64;
+
+// The number of neurons whose state is kept in cache while a batch of spikes
+// is applied to them.
+static constexpr unsigned int BATCH_BLOCK_SIZE = 1024;
+
+Cortex::Cortex(const uint16_t num_channels_, const CortexStorage storage_) :
+  num_channels(num_channels_),
+  storage(storage_),
+  neuron_arena(num_channels_),
+  pending_weights(nullptr),
+  staged_weights(
+      storage_ == CortexStorage::NEURON_OBJECTS ? 0 : num_channels_),
+  neuron_matrix(num_channels_),
+  channel_index(storage_ == CortexStorage::SPARSE ? num_channels : 0),
+  shard_firings(1),
+  frame_ticks(0),
+  num_frame_words((num_channels_ + 63) / 64)
+{
+}
+
 void Cortex::spike(
-    const float timestamp,
+    const Tick timestamp,
+    const uint16_t input_channel,
+    std::vector<uint16_t>* outputs
+) {
+  if (storage == CortexStorage::SPARSE) {
+    channel_index.spike(timestamp, input_channel, outputs);
+  } else if (thread_pool != nullptr
+      && neuron_count() >= PARALLEL_NEURON_THRESHOLD) {
+    spike_in_parallel(timestamp, input_channel, outputs);
+  } else {
+    spike_range(timestamp, input_channel, 0, neuron_count(), outputs);
+  }
+}
+
+void Cortex::spike_range(
+    const Tick timestamp,
+    const uint16_t input_channel,
+    const unsigned int begin,
+    const unsigned int end,
+    std::vector<uint16_t>* outputs
+) {
+  if (storage == CortexStorage::CHANNEL_MAJOR) {
+    neuron_matrix.spike_range(timestamp, input_channel, begin, end, outputs);
+    return;
+  }
+  if (storage == CortexStorage::SPARSE) {
+    channel_index.spike_range(timestamp, input_channel, begin, end, outputs);
+    return;
+  }
+  for (unsigned int i = begin; i < end; i++) {
+    if (neurons[i].spike(timestamp, input_channel)) {
+      outputs->push_back(neurons[i].get_output_channel());
+    }
+  }
+}
+
+void Cortex::spike_in_parallel(
+    const Tick timestamp,
     const uint16_t input_channel,
     std::vector<uint16_t>* outputs
 ) {
-  for (Neuron& neuron : neurons) {
-    if (neuron.spike(timestamp, input_channel)) {
-      outputs->push_back(neuron.get_output_channel());
+  const unsigned int n = neuron_count();
+  const unsigned int num_shards = thread_pool->thread_count();
+  const unsigned int shard_size =
+      ((n + num_shards - 1) / num_shards + SHARD_ALIGNMENT - 1)
+      / SHARD_ALIGNMENT * SHARD_ALIGNMENT;
+  thread_pool->run([&](const unsigned int shard) {
+    const unsigned int begin = std::min(n, shard * shard_size);
+    const unsigned int end = std::min(n, begin + shard_size);
+    spike_range(
+        timestamp, input_channel, begin, end, &shard_outputs[shard]);
+  });
+
+  // Gather the outputs in shard order, i.e. neuron order.
+  for (std::vector<uint16_t>& shard_output : shard_outputs) {
+    outputs->insert(outputs->end(), shard_output.begin(), shard_output.end());
+    shard_output.clear();
+  }
+}
+
+void Cortex::spike_batch(
+    const ScheduledSpike* spikes,
+    const unsigned int num_spikes,
+    SpikeOutputs* outputs
+) {
+  if (frame_ticks > 0) {
+    bin_frames(spikes, num_spikes);
+  } else if (storage == CortexStorage::SPARSE) {
+    // Each spike only visits the neurons in its channel's rows, so there's
+    // nothing to gain by blocking.
+    for (unsigned int i = 0; i < num_spikes; i++) {
+      channel_index.spike(
+          spikes[i].timestamp, spikes[i].channel, &outputs->channels);
+      outputs->offsets.push_back(outputs->channels.size());
+    }
+    return;
+  }
+
+  // Record the firings of each shard of neurons. The SPARSE frames are sent
+  // to all the neurons at once, as they only visit the neurons they affect.
+  const unsigned int n = neuron_count();
+  if (storage == CortexStorage::SPARSE) {
+    spike_frames_range(0, n, &shard_firings[0]);
+  } else if (thread_pool != nullptr && n >= PARALLEL_NEURON_THRESHOLD) {
+    const unsigned int num_shards = thread_pool->thread_count();
+    const unsigned int shard_size =
+        ((n + num_shards - 1) / num_shards + SHARD_ALIGNMENT - 1)
+        / SHARD_ALIGNMENT * SHARD_ALIGNMENT;
+    thread_pool->run([&](const unsigned int shard) {
+      const unsigned int begin = std::min(n, shard * shard_size);
+      const unsigned int end = std::min(n, begin + shard_size);
+      if (frame_ticks > 0) {
+        spike_frames_range(begin, end, &shard_firings[shard]);
+      } else {
+        spike_batch_range(
+            spikes, num_spikes, begin, end, &shard_firings[shard]);
+      }
+    });
+  } else if (frame_ticks > 0) {
+    spike_frames_range(0, n, &shard_firings[0]);
+  } else {
+    spike_batch_range(spikes, num_spikes, 0, n, &shard_firings[0]);
+  }
+
+  // Count the outputs of each spike.
+  const unsigned int first_spike = outputs->spike_count();
+  const unsigned int first_channel = outputs->channels.size();
+  outputs->offsets.resize(first_spike + num_spikes + 1, 0);
+  unsigned int* offsets = &outputs->offsets[first_spike];
+  for (const BatchFirings& firings : shard_firings) {
+    for (const unsigned int spike_index : firings.spike_indices) {
+      offsets[spike_index + 1]++;
+    }
+  }
+  for (unsigned int i = 0; i < num_spikes; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  // Scatter the output channels into place. Within a spike, shards and the
+  // firings in them are in neuron order, so the outputs are too.
+  outputs->channels.resize(offsets[num_spikes]);
+  for (BatchFirings& firings : shard_firings) {
+    const unsigned int num_firings = firings.spike_indices.size();
+    for (unsigned int i = 0; i < num_firings; i++) {
+      outputs->channels[offsets[firings.spike_indices[i]]++] =
+          firings.channels[i];
+    }
+    firings.spike_indices.clear();
+    firings.channels.clear();
+  }
+
+  // The scatter advanced each offset to the next spike's, so shift them back.
+  for (unsigned int i = num_spikes; i > 0; i--) {
+    offsets[i] = offsets[i - 1];
+  }
+  offsets[0] = first_channel;
+}
+
+void Cortex::spike_batch_range(
+    const ScheduledSpike* spikes,
+    const unsigned int num_spikes,
+    const unsigned int begin,
+    const unsigned int end,
+    BatchFirings* firings
+) {
+  if (storage == CortexStorage::NEURON_OBJECTS) {
+    // Each neuron's weights are contiguous, so apply the whole batch to one
+    // neuron at a time.
+    for (unsigned int i = begin; i < end; i++) {
+      Neuron& neuron = neurons[i];
+      for (unsigned int j = 0; j < num_spikes; j++) {
+        if (neuron.spike(spikes[j].timestamp, spikes[j].channel)) {
+          firings->spike_indices.push_back(j);
+          firings->channels.push_back(neuron.get_output_channel());
+        }
+      }
+    }
+    return;
+  }
+
+  // Apply the whole batch to one block of neurons at a time.
+  for (unsigned int block = begin; block < end; block += BATCH_BLOCK_SIZE) {
+    const unsigned int block_end = std::min(end, block + BATCH_BLOCK_SIZE);
+    for (unsigned int j = 0; j < num_spikes; j++) {
+      neuron_matrix.spike_range(
+          spikes[j].timestamp,
+          spikes[j].channel,
+          block,
+          block_end,
+          &firings->channels);
+      firings->spike_indices.resize(firings->channels.size(), j);
+    }
+  }
+}
+
+void Cortex::bin_frames(
+    const ScheduledSpike* spikes,
+    const unsigned int num_spikes
+) {
+  frame_timestamps.clear();
+  frame_last_spikes.clear();
+  frame_bits.clear();
+  for (unsigned int i = 0; i < num_spikes; i++) {
+    const Tick timestamp = spikes[i].timestamp;
+    const Tick frame_timestamp = timestamp - timestamp % frame_ticks;
+    if (frame_timestamps.empty()
+        || frame_timestamps.back() != frame_timestamp) {
+      frame_timestamps.push_back(frame_timestamp);
+      frame_last_spikes.push_back(i);
+      frame_bits.resize(frame_bits.size() + num_frame_words, 0);
+    }
+    frame_last_spikes.back() = i;
+    const uint16_t channel = spikes[i].channel;
+    frame_bits[frame_bits.size() - num_frame_words + channel / 64] |=
+        (uint64_t) 1 << (channel % 64);
+  }
+}
+
+void Cortex::spike_frames_range(
+    const unsigned int begin,
+    const unsigned int end,
+    BatchFirings* firings
+) {
+  const unsigned int num_frames = frame_timestamps.size();
+  if (storage == CortexStorage::NEURON_OBJECTS) {
+    // Each neuron's weights are contiguous, so apply every frame to one
+    // neuron at a time.
+    for (unsigned int i = begin; i < end; i++) {
+      Neuron& neuron = neurons[i];
+      for (unsigned int j = 0; j < num_frames; j++) {
+        const uint64_t* channel_bits = &frame_bits[j * num_frame_words];
+        int32_t input = 0;
+        for (unsigned int word = 0; word < num_frame_words; word++) {
+          for (uint64_t bits = channel_bits[word]; bits != 0;
+              bits &= bits - 1) {
+            input += neuron.get_weight(word * 64 + __builtin_ctzll(bits));
+          }
+        }
+        if (input != 0 && neuron.apply_input(frame_timestamps[j], input)) {
+          firings->spike_indices.push_back(frame_last_spikes[j]);
+          firings->channels.push_back(neuron.get_output_channel());
+        }
+      }
+    }
+    return;
+  }
+
+  if (storage == CortexStorage::SPARSE) {
+    for (unsigned int j = 0; j < num_frames; j++) {
+      channel_index.spike_frame_range(
+          frame_timestamps[j],
+          &frame_bits[j * num_frame_words],
+          begin,
+          end,
+          &firings->channels);
+      firings->spike_indices.resize(
+          firings->channels.size(), frame_last_spikes[j]);
+    }
+    return;
+  }
+
+  // Apply every frame to one block of neurons at a time.
+  for (unsigned int block = begin; block < end; block += BATCH_BLOCK_SIZE) {
+    const unsigned int block_end = std::min(end, block + BATCH_BLOCK_SIZE);
+    for (unsigned int j = 0; j < num_frames; j++) {
+      neuron_matrix.spike_frame_range(
+          frame_timestamps[j],
+          &frame_bits[j * num_frame_words],
+          block,
+          block_end,
+          &firings->channels);
+      firings->spike_indices.resize(
+          firings->channels.size(), frame_last_spikes[j]);
     }
   }
 }
@@ -18,11 +291,234 @@ void Cortex::add_neuron(
     const int8_t* weights,
     const Parameters& parameters
 ) {
-  neurons.emplace_back(output_channel, num_channels, weights, parameters);
+  memcpy(new_neuron_weights(), weights, num_channels * sizeof(int8_t));
+  add_neuron(output_channel, parameters);
+}
+
+int8_t* Cortex::new_neuron_weights() {
+  if (pending_weights == nullptr) {
+    pending_weights = storage == CortexStorage::NEURON_OBJECTS
+        ? neuron_arena.allocate() : staged_weights.data();
+  }
+  return pending_weights;
+}
+
+void Cortex::add_neuron(
+    const uint16_t output_channel,
+    const Parameters& parameters
+) {
+  add_pending_neuron(output_channel, parameters.MIN_SPIKE_INTERVAL_TICKS);
+}
+
+void Cortex::add_pending_neuron(
+    const uint16_t output_channel,
+    const Tick refractory_duration
+) {
+  switch (storage) {
+    case CortexStorage::NEURON_OBJECTS:
+      neurons.emplace_back(
+          output_channel, pending_weights, refractory_duration);
+      break;
+    case CortexStorage::CHANNEL_MAJOR:
+      neuron_matrix.add_neuron(
+          output_channel, pending_weights, refractory_duration);
+      break;
+    case CortexStorage::SPARSE:
+      channel_index.add_neuron(
+          output_channel, pending_weights, refractory_duration);
+      break;
+  }
+  pending_weights = nullptr;
+}
+
+bool Cortex::save(BrainCheckpointWriter* writer) const {
+  const unsigned int n = neuron_count();
+  std::vector<uint16_t> output_channels(n);
+  std::vector<Tick> refractory_durations(n);
+  if (storage == CortexStorage::NEURON_OBJECTS) {
+    for (unsigned int i = 0; i < n; i++) {
+      output_channels[i] = neurons[i].get_output_channel();
+      refractory_durations[i] = neurons[i].get_refractory_duration();
+    }
+  } else {
+    const NeuronStates& states = storage == CortexStorage::CHANNEL_MAJOR
+        ? neuron_matrix.neuron_states() : channel_index.neuron_states();
+    output_channels = states.output_channels;
+    refractory_durations = states.refractory_durations;
+  }
+
+  BrainCheckpointHeader* header = writer->header();
+  header->num_neurons = n;
+  header->weight_layout = storage == CortexStorage::NEURON_OBJECTS
+      ? BRAIN_CHECKPOINT_NEURON_ROWS : BRAIN_CHECKPOINT_CHANNEL_COLUMNS;
+  if (!writer->begin_section(8, &header->output_channels_offset)
+      || !writer->write(output_channels.data(), n * sizeof(uint16_t))
+      || !writer->begin_section(8, &header->refractory_durations_offset)
+      || !writer->write(refractory_durations.data(), n * sizeof(Tick))
+      || !writer->begin_section(
+          BRAIN_CHECKPOINT_ALIGNMENT, &header->weights_offset)) {
+    return false;
+  }
+
+  switch (storage) {
+    case CortexStorage::NEURON_OBJECTS:
+      for (const Neuron& neuron : neurons) {
+        if (!writer->write(neuron.get_weights(), num_channels)) {
+          return false;
+        }
+      }
+      break;
+    case CortexStorage::CHANNEL_MAJOR:
+      for (uint16_t i = 0; i < num_channels; i++) {
+        if (!writer->write(neuron_matrix.column(i), n)) {
+          return false;
+        }
+      }
+      break;
+    case CortexStorage::SPARSE: {
+      std::vector<int8_t> column(n);
+      for (uint16_t i = 0; i < num_channels; i++) {
+        channel_index.copy_column(i, column.data());
+        if (!writer->write(column.data(), n)) {
+          return false;
+        }
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+bool Cortex::load(const BrainCheckpoint& checkpoint) {
+  if (checkpoint.num_channels() != num_channels) {
+    fprintf(stderr, "brain checkpoint has %u channels, not %u\n",
+        checkpoint.num_channels(), num_channels);
+    return false;
+  }
+  if (neuron_count() > 0) {
+    fprintf(stderr, "can't load a brain checkpoint into a non-empty cortex\n");
+    return false;
+  }
+
+  const unsigned int n = checkpoint.num_neurons();
+  const uint16_t* output_channels = checkpoint.output_channels();
+  const Tick* refractory_durations = checkpoint.refractory_durations();
+  const int8_t* weights = checkpoint.weights();
+  const bool rows =
+      checkpoint.weight_layout() == BRAIN_CHECKPOINT_NEURON_ROWS;
+  if (storage == CortexStorage::NEURON_OBJECTS && rows) {
+    // Each neuron's weights are a row of the mapped matrix.
+    neurons.reserve(n);
+    for (unsigned int i = 0; i < n; i++) {
+      neurons.emplace_back(
+          output_channels[i],
+          weights + (size_t) i * num_channels,
+          refractory_durations[i]);
+    }
+    return true;
+  }
+  if (storage == CortexStorage::CHANNEL_MAJOR && !rows) {
+    neuron_matrix.use_weights(
+        weights, n, output_channels, refractory_durations);
+    return true;
+  }
+
+  // Copy each neuron's weights, gathering them from the columns if need be.
+  reserve(n);
+  for (unsigned int i = 0; i < n; i++) {
+    int8_t* neuron_weights = new_neuron_weights();
+    if (rows) {
+      memcpy(neuron_weights, weights + (size_t) i * num_channels,
+          num_channels * sizeof(int8_t));
+    } else {
+      for (uint16_t j = 0; j < num_channels; j++) {
+        neuron_weights[j] = weights[(size_t) j * n + i];
+      }
+    }
+    add_pending_neuron(output_channels[i], refractory_durations[i]);
+  }
+  return true;
 }
 
 void Cortex::reset() {
-  for (Neuron& neuron : neurons) {
-    neuron.reset();
+  switch (storage) {
+    case CortexStorage::NEURON_OBJECTS:
+      for (Neuron& neuron : neurons) {
+        neuron.reset();
+      }
+      break;
+    case CortexStorage::CHANNEL_MAJOR:
+      neuron_matrix.reset();
+      break;
+    case CortexStorage::SPARSE:
+      channel_index.reset();
+      break;
+  }
+}
+
+void Cortex::reserve(const unsigned int num_neurons) {
+  switch (storage) {
+    case CortexStorage::NEURON_OBJECTS:
+      neurons.reserve(num_neurons);
+      neuron_arena.reserve(num_neurons);
+      break;
+    case CortexStorage::CHANNEL_MAJOR:
+      neuron_matrix.reserve(num_neurons);
+      break;
+    case CortexStorage::SPARSE:
+      channel_index.reserve(num_neurons);
+      break;
+  }
+}
+
+unsigned int Cortex::neuron_count() const {
+  switch (storage) {
+    case CortexStorage::CHANNEL_MAJOR:
+      return neuron_matrix.neuron_count();
+    case CortexStorage::SPARSE:
+      return channel_index.neuron_count();
+    default:
+      return neurons.size();
+  }
+}
+
+bool Cortex::set_frame_ticks(
+    const Tick frame_ticks_,
+    const Parameters& parameters
+) {
+  const Tick max_frame_ticks =
+      parameters.MIN_SPIKE_INTERVAL_TICKS / FRAMES_PER_SPIKE_INTERVAL;
+  if (frame_ticks_ < 0 || frame_ticks_ > max_frame_ticks) {
+    fprintf(stderr, "frame width %lld ticks isn't between 0 and %lld ticks\n",
+        (long long) frame_ticks_,
+        (long long) max_frame_ticks);
+    return false;
+  }
+  frame_ticks = frame_ticks_;
+  return true;
+}
+
+void Cortex::set_thread_count(const unsigned int num_threads) {
+  if (num_threads <= 1) {
+    thread_pool.reset();
+    shard_outputs.clear();
+    shard_firings.resize(1);
+    return;
+  }
+  thread_pool.reset(new ThreadPool(num_threads));
+  shard_outputs.resize(num_threads);
+  shard_firings.resize(num_threads);
+}
+
+bool Cortex::parse_storage(const char* name, CortexStorage* storage) {
+  if (strcmp(name, "objects") == 0) {
+    *storage = CortexStorage::NEURON_OBJECTS;
+  } else if (strcmp(name, "matrix") == 0) {
+    *storage = CortexStorage::CHANNEL_MAJOR;
+  } else if (strcmp(name, "sparse") == 0) {
+    *storage = CortexStorage::SPARSE;
+  } else {
+    return false;
   }
+  return true;
 }
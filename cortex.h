@@ -1,13 +1,38 @@
 #ifndef _cortex_h
 #define _cortex_h
 
+#include "brain_checkpoint.h"
+#include "brain_checkpoint_writer.h"
+#include "channel_index.h"
 #include "neuron.h"
+#include "neuron_arena.h"
+#include "neuron_matrix.h"
+#include "scheduled_spike.h"
+#include "spike_outputs.h"
 
+#include "thread_pool.h"
+
+#include <memory>
 #include <vector>
 
+// How the neurons in a cortex are stored.
+enum class CortexStorage {
+  // A Neuron object per neuron, each with its own weights.
+  NEURON_OBJECTS,
+
+  // A channel-major weight matrix with struct-of-arrays neuron state.
+  CHANNEL_MAJOR,
+
+  // An inverted index from input channels to non-zero weights.
+  SPARSE,
+};
+
 // The cortex interface.
 class Cortex {
   public:
+    // Constructor.
+    Cortex(uint16_t num_channels, CortexStorage storage);
+
     // Creates a neuron and adds it to the cortex.
     void add_neuron(
         uint16_t output_channel,
@@ -15,27 +40,204 @@ class Cortex {
         const int8_t* weights,
         const Parameters& parameters);
 
+    // Returns storage for the weights of the next neuron, one per input
+    // channel, which should be filled in and then added with add_neuron().
+    // With NEURON_OBJECTS storage this is the neuron's final location, so
+    // the weights are never copied.
+    int8_t* new_neuron_weights();
+
+    // Adds a neuron whose weights have been written to new_neuron_weights().
+    void add_neuron(uint16_t output_channel, const Parameters& parameters);
+
+    // Writes the neurons' output channels, refractory durations and weights
+    // to a checkpoint, in the layout that the storage keeps its weights in.
+    // Returns false if they can't be written.
+    bool save(BrainCheckpointWriter* writer) const;
+
+    // Adds the neurons saved in a checkpoint to an empty cortex.
+    // NEURON_OBJECTS storage uses a row layout in place, and CHANNEL_MAJOR
+    // storage a column layout, so the checkpoint must stay open for as long
+    // as the cortex. Other combinations copy the weights.
+    // Returns false if the checkpoint has a different number of channels or
+    // the cortex isn't empty.
+    bool load(const BrainCheckpoint& checkpoint);
+
     // Sends a spike to the specified input channel.
     // Returns a list of the output channels that fire as a result.
     void spike(
-        float timestamp,
+        Tick timestamp,
         uint16_t input_channel,
         std::vector<uint16_t>* outputs);
 
+    // Sends a time-ordered batch of spikes to the cortex, and appends the
+    // output channels of each spike to the outputs.
+    // The result is identical to calling spike() for each spike, but each
+    // neuron's state stays in cache while the whole batch is applied to it.
+    // In frame mode (see set_frame_ticks()) a frame's outputs are appended
+    // to the outputs of its last spike.
+    void spike_batch(
+        const ScheduledSpike* spikes,
+        unsigned int num_spikes,
+        SpikeOutputs* outputs);
+
+    // Sends a spike to neurons [begin, end) only.
+    // Appends the output channels of the neurons that fire, in neuron order.
+    void spike_range(
+        Tick timestamp,
+        uint16_t input_channel,
+        unsigned int begin,
+        unsigned int end,
+        std::vector<uint16_t>* outputs);
+
     // Resets the activation level of all the neurons.
     void reset();
 
     // Reserves storage for the specified number of neurons.
-    void reserve(unsigned int num_neurons) {
-      neurons.reserve(num_neurons);
-    }
+    void reserve(unsigned int num_neurons);
 
     // Returns the number of neurons.
-    unsigned int neuron_count() const { return neurons.size(); }
+    unsigned int neuron_count() const;
+
+    // Returns the number of input channels.
+    uint16_t channel_count() const { return num_channels; }
+
+    // Sets the width of the frames that spike_batch() bins spikes into, or
+    // zero, the default, to process each spike as an event. Frames start at
+    // multiples of the width, and a frame that straddles two batches is
+    // processed as two frames.
+    //
+    // In a frame, each neuron takes the sum of its weights on the channels
+    // that spiked at once, at the start of the frame, and applies the firing
+    // and refractory rule of spike() to the sum. A channel counts once per
+    // frame, so the width can't exceed MIN_SPIKE_INTERVAL, the shortest
+    // interval between a channel's scheduled spikes, which is also the
+    // refractory period. A neuron then fires at most once per frame, and
+    // starting from the same state as event-driven processing:
+    // - It never fires when event-driven processing wouldn't, and when both
+    //   fire it fires up to a frame width earlier, so its refractory period
+    //   also ends up to a frame width earlier.
+    // - When it doesn't fire, its activation level is lower by at most the
+    //   sum of the magnitudes of its negative weights on the frame's
+    //   channels. Event-driven processing clips the level at zero after each
+    //   spike, whereas a frame clips the sum, which can also cancel a firing
+    //   that an earlier spike in the frame would have caused. With no
+    //   negative weights on the frame's channels the level is exact.
+    // Refractory periods that end early compound over a long run, so the
+    // width is further limited to MIN_SPIKE_INTERVAL divided by
+    // FRAMES_PER_SPIKE_INTERVAL. Returns false, and leaves the width
+    // unchanged, if it's negative or exceeds that.
+    bool set_frame_ticks(Tick frame_ticks_, const Parameters& parameters);
+
+    // The fewest frames per MIN_SPIKE_INTERVAL. At this many, the per-channel
+    // output counts of a 4096-neuron cortex replaying a 60 s trace differ
+    // from event-driven processing by 0.7%, against 2.1% at half as many,
+    // and 31% at one.
+    static constexpr Tick FRAMES_PER_SPIKE_INTERVAL = 10;
+
+    // Returns the width of a frame, or zero if spikes are processed as events.
+    Tick get_frame_ticks() const { return frame_ticks; }
+
+    // Sets the number of threads that spikes are processed with.
+    // The neurons are split into contiguous shards, one per thread, and the
+    // outputs are gathered in the same order as a single thread would produce.
+    // Cortices with fewer than PARALLEL_NEURON_THRESHOLD neurons, and SPARSE
+    // cortices, are always processed by the calling thread.
+    void set_thread_count(unsigned int num_threads);
+
+    // The number of neurons below which a spike is processed by one thread,
+    // because waking the other threads would cost more than it saves.
+    static constexpr unsigned int PARALLEL_NEURON_THRESHOLD = 16384;
+
+    // Parses a storage name ("objects", "matrix" or "sparse").
+    // Returns false if the name isn't recognized.
+    static bool parse_storage(const char* name, CortexStorage* storage);
 
   private:
-    // The neurons in the cortex.
+    // The number of input channels.
+    const uint16_t num_channels;
+
+    // How the neurons are stored.
+    const CortexStorage storage;
+
+    // The neurons in the cortex, if stored as NEURON_OBJECTS.
     std::vector<Neuron> neurons;
+
+    // The weights of the neurons, if stored as NEURON_OBJECTS.
+    NeuronArena neuron_arena;
+
+    // The weights returned by new_neuron_weights(), or null if they haven't
+    // been requested since the last neuron was added.
+    int8_t* pending_weights;
+
+    // Where the weights of a new neuron are written before being copied, if
+    // not stored as NEURON_OBJECTS.
+    std::vector<int8_t> staged_weights;
+
+    // The neurons in the cortex, if stored as CHANNEL_MAJOR.
+    NeuronMatrix neuron_matrix;
+
+    // The neurons in the cortex, if stored as SPARSE.
+    ChannelIndex channel_index;
+
+    // The threads that process spikes, or null if there's only one.
+    std::unique_ptr<ThreadPool> thread_pool;
+
+    // The outputs of each thread's shard of neurons.
+    std::vector<std::vector<uint16_t>> shard_outputs;
+
+    // The neurons that fired during a batch, in the order they fired within
+    // a range of neurons.
+    struct BatchFirings {
+      // The index of the spike in the batch that caused each firing.
+      std::vector<unsigned int> spike_indices;
+
+      // The output channel of each firing.
+      std::vector<uint16_t> channels;
+    };
+
+    // The firings of each thread's shard of neurons during a batch.
+    std::vector<BatchFirings> shard_firings;
+
+    // The width of a frame, or zero to process each spike as an event.
+    Tick frame_ticks;
+
+    // The frames of the current batch: the start time of each frame, the
+    // index of its last spike in the batch, and a bitset of the channels that
+    // spiked in it, num_frame_words words per frame.
+    std::vector<Tick> frame_timestamps;
+    std::vector<unsigned int> frame_last_spikes;
+    std::vector<uint64_t> frame_bits;
+    const unsigned int num_frame_words;
+
+    // Adds a neuron whose weights have been written to new_neuron_weights(),
+    // with the specified refractory duration.
+    void add_pending_neuron(uint16_t output_channel, Tick refractory_duration);
+
+    // Sends a batch of spikes to neurons [begin, end), a block of neurons at
+    // a time, and records the firings.
+    // Only supported by NEURON_OBJECTS and CHANNEL_MAJOR storage.
+    void spike_batch_range(
+        const ScheduledSpike* spikes,
+        unsigned int num_spikes,
+        unsigned int begin,
+        unsigned int end,
+        BatchFirings* firings);
+
+    // Bins a batch of spikes into frames.
+    void bin_frames(const ScheduledSpike* spikes, unsigned int num_spikes);
+
+    // Sends the binned frames to neurons [begin, end), and records the
+    // firings against the last spike of each frame.
+    void spike_frames_range(
+        unsigned int begin,
+        unsigned int end,
+        BatchFirings* firings);
+
+    // Sends a spike to all the neurons, one shard per thread.
+    void spike_in_parallel(
+        Tick timestamp,
+        uint16_t input_channel,
+        std::vector<uint16_t>* outputs);
 };
 
 #endif // _cortex_h
@@ -0,0 +1,58 @@
+#include "counter_rng.h"
+
+#include <ctime>
+
+// The Philox4x32 multipliers and key increments.
+static constexpr uint32_t PHILOX_M0 = 0xd2511f53;
+static constexpr uint32_t PHILOX_M1 = 0xcd9e8d57;
+static constexpr uint32_t PHILOX_W0 = 0x9e3779b9;
+static constexpr uint32_t PHILOX_W1 = 0xbb67ae85;
+
+// The number of rounds. Ten is the minimum recommended for statistical
+// quality.
+static constexpr int PHILOX_ROUNDS = 10;
+
+CounterRng::CounterRng(const uint64_t seed, const uint32_t stream_) :
+  key{(uint32_t) seed, (uint32_t) (seed >> 32)},
+  stream(stream_)
+{
+}
+
+void CounterRng::generate(
+    const uint32_t channel,
+    const uint64_t sample,
+    uint32_t words[4]
+) const {
+  uint32_t c0 = (uint32_t) sample;
+  uint32_t c1 = (uint32_t) (sample >> 32);
+  uint32_t c2 = channel;
+  uint32_t c3 = stream;
+  uint32_t k0 = key[0];
+  uint32_t k1 = key[1];
+  for (int round = 0; round < PHILOX_ROUNDS; round++) {
+    const uint64_t product0 = (uint64_t) PHILOX_M0 * c0;
+    const uint64_t product1 = (uint64_t) PHILOX_M1 * c2;
+    c0 = (uint32_t) (product1 >> 32) ^ c1 ^ k0;
+    c1 = (uint32_t) product1;
+    c2 = (uint32_t) (product0 >> 32) ^ c3 ^ k1;
+    c3 = (uint32_t) product0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+  words[0] = c0;
+  words[1] = c1;
+  words[2] = c2;
+  words[3] = c3;
+}
+
+double CounterRng::uniform(const uint32_t channel, const uint64_t sample) const {
+  uint32_t words[4];
+  generate(channel, sample, words);
+  // Use 53 random bits, the precision of a double.
+  const uint64_t bits = ((uint64_t) words[0] << 32 | words[1]) >> 11;
+  return bits * (1.0 / (1ull << 53));
+}
+
+uint64_t CounterRng::time_seed() {
+  return time(nullptr);
+}
@@ -0,0 +1,37 @@
+#ifndef _counter_rng_h
+#define _counter_rng_h
+
+#include <cstdint>
+
+// A counter-based random number generator, Philox4x32-10.
+// Rather than advancing hidden state, each random number is a pure function
+// of a key and a counter: here the seed and stream, and the channel and
+// sample index it's for. So numbers for different channels can be generated
+// independently, in any order or in parallel, and any run can be replayed
+// from its seed.
+class CounterRng {
+  public:
+    // Constructor.
+    // Generators with different streams produce independent numbers from
+    // the same seed.
+    CounterRng(uint64_t seed, uint32_t stream);
+
+    // Sets words to the four random 32-bit words for a channel and sample.
+    void generate(uint32_t channel, uint64_t sample, uint32_t words[4]) const;
+
+    // Returns a random number in the range [0, 1) for a channel and sample.
+    double uniform(uint32_t channel, uint64_t sample) const;
+
+    // Returns a seed based on the current time, for runs that don't need
+    // to be reproducible.
+    static uint64_t time_seed();
+
+  private:
+    // The Philox key, taken from the seed.
+    const uint32_t key[2];
+
+    // The stream, which forms part of the counter.
+    const uint32_t stream;
+};
+
+#endif // _counter_rng_h
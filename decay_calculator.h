@@ -1,6 +1,8 @@
 #ifndef _decay_calculator_h
 #define _decay_calculator_h
 
+#include "tick.h"
+
 #include <cstdint>
 #include <unordered_map>
 
@@ -12,44 +14,61 @@ class DecayCalculator {
     // e(t * decay_rate)
     DecayCalculator(float decay_rate);
 
-    // Calculates the decay factor at the specified timestamp.
-    // Returns true if the factor is low enough to be worth using.
-    bool calculate_factor(float timestamp, float* factor);
+    // Calculates the decay factor at the specified timestamp, for a value
+    // that was last decayed at *previous_timestamp. If the factor is low
+    // enough to be worth using, returns true and updates *previous_timestamp.
+    // This lets one calculator serve many values that keep their own
+    // timestamps.
+    bool calculate_factor(
+        Tick timestamp,
+        Tick* previous_timestamp,
+        float* factor) const;
+
+    // Returns the duration in ticks at which decay becomes meaningful.
+    Tick get_minimum_duration() const { return minimum_duration; }
+
+    // Returns the decay rate.
+    float get_decay_rate() const { return decay_rate; }
 
-    // Resets the decay timer.
-    void reset();
+    // Returns the pre-calculated decay factors. Element i is the factor for
+    // a duration of get_minimum_duration() + (i << FACTOR_STEP_SHIFT) ticks,
+    // so the table is indexed directly by shifting the tick delta.
+    const float* get_precalculated_factors() const {
+      return precalculated_factors;
+    }
+
+    // The number of pre-calculated decay factors.
+    static constexpr int PRECALCULATED_FACTOR_COUNT = 1024;
+
+    // The log2 of the tick spacing of the pre-calculated decay factors,
+    // giving a step of 1.024 ms.
+    static constexpr int FACTOR_STEP_SHIFT = 10;
 
   private:
     // The decay rate such that the decay after t seconds equals
     // e(-t * decay_rate)
     const float decay_rate;
 
-    // The duration in seconds at which decay becomes meaningful.
-    const float minimum_duration;
-
-    // The number of pre-calculated decay factors.
-    static constexpr int PRECALCULATED_FACTOR_COUNT = 1024;
+    // The duration in ticks at which decay becomes meaningful.
+    const Tick minimum_duration;
 
     // Pre-calculated decay factors.
     const float* precalculated_factors;
 
-    // The last time a useful decay factor was returned.
-    float previous_timestamp;
-
     // A map of pre-calculated minimum durations for different decay rates.
-    static std::unordered_map<float, float> minimum_duration_map;
+    static std::unordered_map<float, Tick> minimum_duration_map;
 
     // A map of pre-calculated decay factors for different decay rates.
     static std::unordered_map<float, const float*> precalculated_factors_map;
 
-    // Calculates the duration, in seconds, at which decay becomes meaningful.
+    // Calculates the duration, in ticks, at which decay becomes meaningful.
     // Uses cached values wherever possible.
-    static float calculate_minimum_duration(float decay_rate);
+    static Tick calculate_minimum_duration(float decay_rate);
 
     // Calculates precalculated decay factors for a decay rate.
     // Uses cached values wherever possible.
     static const float* calculate_precalculated_factors(
-        float mimimum_duration,
+        Tick mimimum_duration,
         float decay_rate);
 };
 
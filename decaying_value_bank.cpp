@@ -0,0 +1,294 @@
+#include "decaying_value_bank.h"
+
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+
+DecayingValueBank::DecayingValueBank(
+    const uint16_t num_channels_,
+    const float half_life,
+    const float spike_fraction_
+) :
+  num_channels(num_channels_),
+  spike_fraction(spike_fraction_),
+  decay_calculator(-M_LN2 / half_life),
+  values(num_channels_, 0),
+  previous_timestamps(num_channels_, 0),
+  earliest_previous_timestamp(0)
+{
+}
+
+// Returns the neuron weight for a value: the value scaled by 128 and rounded,
+// capped at 127.
+static inline int value_to_weight(const float value) {
+  const int weight = roundf(value * 128.0f);
+  return std::min(weight, 127);
+}
+
+int8_t DecayingValueBank::get_weight(
+    const uint16_t channel,
+    const Tick timestamp
+) {
+  decay_value(channel, timestamp);
+  return value_to_weight(values[channel]);
+}
+
+void DecayingValueBank::restore(
+    const float* values_,
+    const Tick* previous_timestamps_
+) {
+  values.assign(values_, values_ + num_channels);
+  previous_timestamps.assign(
+      previous_timestamps_, previous_timestamps_ + num_channels);
+  earliest_previous_timestamp = 0;
+  if (num_channels > 0) {
+    earliest_previous_timestamp = *std::min_element(
+        previous_timestamps.begin(), previous_timestamps.end());
+  }
+}
+
+void DecayingValueBank::spike(const uint16_t channel, const Tick timestamp) {
+  decay_value(channel, timestamp);
+  values[channel] += (1.0f - values[channel]) * spike_fraction;
+}
+
+void DecayingValueBank::negative_spike(
+    const uint16_t channel,
+    const Tick timestamp
+) {
+  decay_value(channel, timestamp);
+  values[channel] *= 1.0f - spike_fraction;
+}
+
+void DecayingValueBank::reset() {
+  std::fill(values.begin(), values.end(), 0);
+  std::fill(previous_timestamps.begin(), previous_timestamps.end(), 0);
+  earliest_previous_timestamp = 0;
+}
+
+void DecayingValueBank::reset(const uint16_t channel) {
+  values[channel] = 0;
+  previous_timestamps[channel] = 0;
+  earliest_previous_timestamp = 0;
+}
+
+unsigned int DecayingValueBank::decay_due(
+    const Tick timestamp,
+    uint16_t* decayed_channels
+) {
+  // If the longest duration isn't meaningful then none are.
+  const Tick minimum_duration = decay_calculator.get_minimum_duration();
+  if (timestamp - earliest_previous_timestamp < minimum_duration) {
+    return 0;
+  }
+
+  unsigned int num_decayed = 0;
+  Tick earliest = timestamp;
+  for (uint16_t i = 0; i < num_channels; i++) {
+    float factor;
+    if (decay_calculator.calculate_factor(
+        timestamp, &previous_timestamps[i], &factor)) {
+      values[i] *= factor;
+      decayed_channels[num_decayed++] = i;
+    }
+    earliest = std::min(earliest, previous_timestamps[i]);
+  }
+  earliest_previous_timestamp = earliest;
+  return num_decayed;
+}
+
+void DecayingValueBank::decay_value(
+    const uint16_t channel,
+    const Tick timestamp
+) {
+  float factor;
+  if (decay_calculator.calculate_factor(
+      timestamp, &previous_timestamps[channel], &factor)) {
+    values[channel] *= factor;
+  }
+}
+
+// Decays and converts channels [begin, end) to weights, one at a time.
+static void calculate_weights_scalar(
+    const DecayCalculator& decay_calculator,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    const int8_t offset,
+    float* values,
+    Tick* previous_timestamps,
+    int8_t* weights
+) {
+  for (unsigned int i = begin; i < end; i++) {
+    float factor;
+    if (decay_calculator.calculate_factor(
+        timestamp, &previous_timestamps[i], &factor)) {
+      values[i] *= factor;
+    }
+    weights[i] = value_to_weight(values[i]) + offset;
+  }
+}
+
+// Narrows two vectors of four 64-bit lane masks to one of eight 32-bit ones.
+__attribute__((target("avx2")))
+static inline __m256i narrow_masks(const __m256i low, const __m256i high) {
+  const __m256i even_lanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  return _mm256_blend_epi32(
+      _mm256_permutevar8x32_epi32(low, even_lanes),
+      _mm256_permutevar8x32_epi32(high, even_lanes),
+      0xf0);
+}
+
+// Decays and converts channels [0, n) to weights, eight at a time.
+// Uses the same arithmetic as the scalar version, so the results are
+// identical. Durations beyond the pre-calculated factors are rare, and are
+// left to the scalar version.
+__attribute__((target("avx2")))
+static void calculate_weights_avx2(
+    const DecayCalculator& decay_calculator,
+    const unsigned int n,
+    const Tick timestamp,
+    const int8_t offset,
+    float* values,
+    Tick* previous_timestamps,
+    int8_t* weights
+) {
+  const float* factors = decay_calculator.get_precalculated_factors();
+  const __m256i t = _mm256_set1_epi64x(timestamp);
+  const __m256i minimum_duration =
+      _mm256_set1_epi64x(decay_calculator.get_minimum_duration());
+  const __m256i table_duration = _mm256_set1_epi64x(
+      (Tick) DecayCalculator::PRECALCULATED_FACTOR_COUNT
+          << DecayCalculator::FACTOR_STEP_SHIFT);
+  const __m256i all_ones = _mm256_set1_epi64x(-1);
+  const __m256 scale = _mm256_set1_ps(128.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256i max_weight = _mm256_set1_epi32(127);
+  const __m256i offsets = _mm256_set1_epi32(offset);
+
+  unsigned int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    // Each half holds four 64-bit timestamps.
+    const __m256i previous_low =
+        _mm256_loadu_si256((const __m256i*) (previous_timestamps + i));
+    const __m256i previous_high =
+        _mm256_loadu_si256((const __m256i*) (previous_timestamps + i + 4));
+    const __m256i excess_low = _mm256_sub_epi64(
+        _mm256_sub_epi64(t, previous_low), minimum_duration);
+    const __m256i excess_high = _mm256_sub_epi64(
+        _mm256_sub_epi64(t, previous_high), minimum_duration);
+    const __m256i should_decay_low = _mm256_xor_si256(
+        _mm256_cmpgt_epi64(_mm256_setzero_si256(), excess_low), all_ones);
+    const __m256i should_decay_high = _mm256_xor_si256(
+        _mm256_cmpgt_epi64(_mm256_setzero_si256(), excess_high), all_ones);
+    const __m256 should_decay = _mm256_castsi256_ps(
+        narrow_masks(should_decay_low, should_decay_high));
+    const __m256 in_table = _mm256_castsi256_ps(narrow_masks(
+        _mm256_cmpgt_epi64(table_duration, excess_low),
+        _mm256_cmpgt_epi64(table_duration, excess_high)));
+    if (_mm256_movemask_ps(_mm256_andnot_ps(in_table, should_decay)) != 0) {
+      // A channel needs a factor that isn't pre-calculated.
+      calculate_weights_scalar(
+          decay_calculator,
+          i,
+          i + 8,
+          timestamp,
+          offset,
+          values,
+          previous_timestamps,
+          weights);
+      continue;
+    }
+
+    // Decay the values that need it.
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m256 factor = _mm256_set_m128(
+        _mm256_mask_i64gather_ps(
+            one,
+            factors,
+            _mm256_srli_epi64(excess_high, DecayCalculator::FACTOR_STEP_SHIFT),
+            _mm256_extractf128_ps(should_decay, 1),
+            4),
+        _mm256_mask_i64gather_ps(
+            one,
+            factors,
+            _mm256_srli_epi64(excess_low, DecayCalculator::FACTOR_STEP_SHIFT),
+            _mm256_castps256_ps128(should_decay),
+            4));
+    const __m256 value = _mm256_blendv_ps(
+        _mm256_loadu_ps(values + i),
+        _mm256_mul_ps(_mm256_loadu_ps(values + i), factor),
+        should_decay);
+    _mm256_storeu_ps(values + i, value);
+    _mm256_storeu_si256(
+        (__m256i*) (previous_timestamps + i),
+        _mm256_blendv_epi8(previous_low, t, should_decay_low));
+    _mm256_storeu_si256(
+        (__m256i*) (previous_timestamps + i + 4),
+        _mm256_blendv_epi8(previous_high, t, should_decay_high));
+
+    // Round half away from zero, as roundf() does. Values aren't negative,
+    // so that's truncation plus one if the fraction is at least a half.
+    const __m256 scaled = _mm256_mul_ps(value, scale);
+    const __m256 truncated = _mm256_round_ps(
+        scaled, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m256i round_up = _mm256_castps_si256(_mm256_cmp_ps(
+        _mm256_sub_ps(scaled, truncated), half, _CMP_GE_OQ));
+    const __m256i weight = _mm256_add_epi32(
+        _mm256_min_epi32(
+            _mm256_sub_epi32(_mm256_cvttps_epi32(truncated), round_up),
+            max_weight),
+        offsets);
+
+    // Narrow the eight 32-bit weights to bytes.
+    const __m128i words = _mm_packs_epi32(
+        _mm256_castsi256_si128(weight), _mm256_extracti128_si256(weight, 1));
+    _mm_storel_epi64(
+        (__m128i*) (weights + i), _mm_packs_epi16(words, words));
+  }
+  calculate_weights_scalar(
+      decay_calculator,
+      i,
+      n,
+      timestamp,
+      offset,
+      values,
+      previous_timestamps,
+      weights);
+}
+
+// Returns true if the CPU supports AVX2.
+static bool check_avx2_support() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+// Whether the CPU supports AVX2.
+static const bool is_avx2_supported = check_avx2_support();
+
+void DecayingValueBank::calculate_weights(
+    const Tick timestamp,
+    const int8_t offset,
+    int8_t* weights
+) {
+  if (is_avx2_supported) {
+    calculate_weights_avx2(
+        decay_calculator,
+        num_channels,
+        timestamp,
+        offset,
+        values.data(),
+        previous_timestamps.data(),
+        weights);
+  } else {
+    calculate_weights_scalar(
+        decay_calculator,
+        0,
+        num_channels,
+        timestamp,
+        offset,
+        values.data(),
+        previous_timestamps.data(),
+        weights);
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef _decaying_value_bank_h
+#define _decaying_value_bank_h
+
+#include "decay_calculator.h"
+
+#include <cstdint>
+#include <vector>
+
+// A set of values, one per channel, that are increased and decreased with
+// spikes and decay exponentially with time, sharing a half life and spike
+// fraction. The values and the times they were last decayed are stored in
+// contiguous arrays, so that every channel can be decayed and converted to a
+// neuron weight in a single vectorized pass.
+// A value v decays to v * 2^(-t / half_life) after t seconds, a spike moves it
+// to v + (1 - v) * spike_fraction, closing that fraction of its distance to
+// one, and a negative spike moves it to v * (1 - spike_fraction).
+class DecayingValueBank {
+  public:
+    // Constructor.
+    // The half life is in seconds, and the spike fraction is the fraction of
+    // the distance to one that a spike closes.
+    DecayingValueBank(
+        uint16_t num_channels,
+        float half_life,
+        float spike_fraction);
+
+    // Returns the channel's value at the specified time.
+    float get_value(uint16_t channel, Tick timestamp) {
+      decay_value(channel, timestamp);
+      return values[channel];
+    }
+
+    // Returns the channel's value as of the last time it was decayed or
+    // spiked.
+    float get_value(uint16_t channel) const { return values[channel]; }
+
+    // Returns a neuron weight corresponding to the channel's value.
+    // Guaranteed to be in the range [0, 127]
+    int8_t get_weight(uint16_t channel, Tick timestamp);
+
+    // Decays every channel to the specified time, and sets weights[i] to
+    // channel i's neuron weight plus the offset.
+    // The offset must keep the weights within the range of an int8_t.
+    void calculate_weights(Tick timestamp, int8_t offset, int8_t* weights);
+
+    // Decays every channel whose decay has become meaningful at the
+    // specified time, exactly as get_value() would, and writes the numbers of
+    // those channels to decayed_channels in ascending order.
+    // Returns the number of channels decayed. This is cheap when none are.
+    unsigned int decay_due(Tick timestamp, uint16_t* decayed_channels);
+
+    // Applies a spike to a channel, increasing its value.
+    void spike(uint16_t channel, Tick timestamp);
+
+    // Applies a 'negative' spike to a channel, decreasing its value.
+    // This should reverse the effect of a call to spike().
+    void negative_spike(uint16_t channel, Tick timestamp);
+
+    // Returns each channel's value as of the last time it was decayed or
+    // spiked, and the time it was last decayed.
+    const float* get_values() const { return values.data(); }
+    const Tick* get_previous_timestamps() const {
+      return previous_timestamps.data();
+    }
+
+    // Sets each channel's value and the time it was last decayed, as returned
+    // by get_values() and get_previous_timestamps().
+    void restore(const float* values_, const Tick* previous_timestamps_);
+
+    // Resets the decay timers and sets the values to zero.
+    void reset();
+
+    // Resets a channel's decay timer and sets its value to zero.
+    void reset(uint16_t channel);
+
+  private:
+    // The number of channels.
+    const uint16_t num_channels;
+
+    // How much to increase a value when a spike is received.
+    const float spike_fraction;
+
+    // Calculates decay factors for all the channels.
+    const DecayCalculator decay_calculator;
+
+    // The current value of each channel.
+    std::vector<float> values;
+
+    // The last time each channel's value was decayed.
+    std::vector<Tick> previous_timestamps;
+
+    // No later than the earliest of the previous timestamps. Decays only
+    // move timestamps forward, so this stays a valid bound until a reset.
+    Tick earliest_previous_timestamp;
+
+    // Decays a channel's value to the specified time.
+    void decay_value(uint16_t channel, Tick timestamp);
+};
+
+#endif // _decaying_value_bank_h
@@ -0,0 +1,344 @@
+#include "embedding_kernels.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+// Each kernel scores a block of ROW_BLOCK rows at a time, multiplying each
+// row's embedding values by the same block of weights with integer
+// multiply-adds into 32-bit sums, so the scores are exact.
+// The embedding values are widened to 16 bits to be multiplied by the 16-bit
+// weights, except by the VNNI kernel when every weight fits in 8 bits, which
+// multiplies the 8-bit values directly, four channels per 32-bit lane.
+// Channels that don't fill a vector are scored a value at a time by the AVX2
+// kernel, and with masked loads by the AVX-512 kernels.
+
+// The number of rows scored together.
+static constexpr unsigned int ROW_BLOCK = 4;
+
+// The most channels the VNNI kernel narrows the weights of on the stack.
+static constexpr unsigned int MAX_NARROW_CHANNELS = 4096;
+
+// A function that scores a range of rows.
+typedef void (*EmbeddingKernel)(
+    const uint8_t* embeddings,
+    uint16_t num_channels,
+    unsigned int begin,
+    unsigned int end,
+    const int16_t* weights,
+    int32_t* scores);
+
+// Returns the dot product of the channels [first, num_channels) of a row and
+// the weights.
+static inline int32_t score_tail(
+    const uint8_t* row,
+    const unsigned int first,
+    const uint16_t num_channels,
+    const int16_t* weights
+) {
+  int32_t score = 0;
+  for (unsigned int c = first; c < num_channels; c++) {
+    score += row[c] * weights[c];
+  }
+  return score;
+}
+
+// Scores rows [begin, end) a value at a time.
+static void score_scalar(
+    const uint8_t* embeddings,
+    const uint16_t num_channels,
+    const unsigned int begin,
+    const unsigned int end,
+    const int16_t* weights,
+    int32_t* scores
+) {
+  for (unsigned int t = begin; t < end; t++) {
+    scores[t] = score_tail(embeddings + (size_t) t * num_channels,
+        0, num_channels, weights);
+  }
+}
+
+// Returns the sum of the lanes.
+__attribute__((target("avx2")))
+static inline int32_t sum_lanes(const __m256i v) {
+  __m128i s = _mm_add_epi32(
+      _mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+  return _mm_cvtsi128_si32(s);
+}
+
+// Multiplies sixteen embedding values by sixteen weights, and adds the
+// products in pairs to the eight lanes of the sum.
+__attribute__((target("avx2")))
+static inline __m256i madd_avx2(
+    const uint8_t* values,
+    const __m256i w,
+    const __m256i sum
+) {
+  const __m256i v = _mm256_cvtepu8_epi16(
+      _mm_loadu_si128((const __m128i*) values));
+  return _mm256_add_epi32(sum, _mm256_madd_epi16(v, w));
+}
+
+// Scores rows [begin, end), sixteen channels at a time.
+__attribute__((target("avx2")))
+static void score_avx2(
+    const uint8_t* embeddings,
+    const uint16_t num_channels,
+    const unsigned int begin,
+    const unsigned int end,
+    const int16_t* weights,
+    int32_t* scores
+) {
+  const unsigned int vector_channels = num_channels & ~15u;
+  unsigned int t = begin;
+  for (; t + ROW_BLOCK <= end; t += ROW_BLOCK) {
+    const uint8_t* row = embeddings + (size_t) t * num_channels;
+    __m256i sums[ROW_BLOCK];
+    for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+      sums[r] = _mm256_setzero_si256();
+    }
+    for (unsigned int c = 0; c < vector_channels; c += 16) {
+      const __m256i w = _mm256_loadu_si256((const __m256i*) (weights + c));
+      for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+        sums[r] = madd_avx2(row + r * num_channels + c, w, sums[r]);
+      }
+    }
+    for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+      scores[t + r] = sum_lanes(sums[r]) + score_tail(
+          row + r * num_channels, vector_channels, num_channels, weights);
+    }
+  }
+  for (; t < end; t++) {
+    const uint8_t* row = embeddings + (size_t) t * num_channels;
+    __m256i sum = _mm256_setzero_si256();
+    for (unsigned int c = 0; c < vector_channels; c += 16) {
+      sum = madd_avx2(
+          row + c, _mm256_loadu_si256((const __m256i*) (weights + c)), sum);
+    }
+    scores[t] = sum_lanes(sum)
+        + score_tail(row, vector_channels, num_channels, weights);
+  }
+}
+
+// Returns the sum of the lanes. This adds the halves and reuses the AVX2
+// reduction. The halves are extracted with a zeroing mask because GCC 12
+// warns of an uninitialized variable inside _mm512_reduce_add_epi32(),
+// _mm512_castsi512_si256() and the unmasked _mm512_extracti64x4_epi64().
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline int32_t sum_lanes(const __m512i v) {
+  const __m256i low = _mm512_maskz_extracti64x4_epi64(0xff, v, 0);
+  const __m256i high = _mm512_maskz_extracti64x4_epi64(0xff, v, 1);
+  return sum_lanes(_mm256_add_epi32(low, high));
+}
+
+// Multiplies the masked ones of 32 embedding values by 32 weights, and adds
+// the products in pairs to the sixteen lanes of the sum.
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static inline __m512i madd_avx512(
+    const uint8_t* values,
+    const __mmask32 mask,
+    const __m512i w,
+    const __m512i sum
+) {
+  const __m512i v =
+      _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(mask, values));
+  return _mm512_add_epi32(sum, _mm512_madd_epi16(v, w));
+}
+
+// Scores rows [begin, end), 32 channels at a time.
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static void score_avx512(
+    const uint8_t* embeddings,
+    const uint16_t num_channels,
+    const unsigned int begin,
+    const unsigned int end,
+    const int16_t* weights,
+    int32_t* scores
+) {
+  const unsigned int num_blocks = (num_channels + 31) / 32;
+  const unsigned int tail = num_channels - (num_blocks - 1) * 32;
+  const __mmask32 tail_mask = (__mmask32) (UINT32_MAX >> (32 - tail));
+  unsigned int t = begin;
+  for (; t + ROW_BLOCK <= end; t += ROW_BLOCK) {
+    const uint8_t* row = embeddings + (size_t) t * num_channels;
+    __m512i sums[ROW_BLOCK];
+    for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+      sums[r] = _mm512_setzero_si512();
+    }
+    for (unsigned int b = 0; b < num_blocks; b++) {
+      const unsigned int c = b * 32;
+      const __mmask32 mask = b + 1 < num_blocks ? UINT32_MAX : tail_mask;
+      const __m512i w = _mm512_maskz_loadu_epi16(mask, weights + c);
+      for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+        sums[r] = madd_avx512(row + r * num_channels + c, mask, w, sums[r]);
+      }
+    }
+    for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+      scores[t + r] = sum_lanes(sums[r]);
+    }
+  }
+  for (; t < end; t++) {
+    const uint8_t* row = embeddings + (size_t) t * num_channels;
+    __m512i sum = _mm512_setzero_si512();
+    for (unsigned int b = 0; b < num_blocks; b++) {
+      const unsigned int c = b * 32;
+      const __mmask32 mask = b + 1 < num_blocks ? UINT32_MAX : tail_mask;
+      sum = madd_avx512(
+          row + c, mask, _mm512_maskz_loadu_epi16(mask, weights + c), sum);
+    }
+    scores[t] = sum_lanes(sum);
+  }
+}
+
+// Multiplies the masked ones of 64 embedding values by 64 8-bit weights, and
+// adds the products in fours to the sixteen lanes of the sum.
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni")))
+static inline __m512i dot_vnni(
+    const uint8_t* values,
+    const __mmask64 mask,
+    const __m512i w,
+    const __m512i sum
+) {
+  return _mm512_dpbusd_epi32(sum, _mm512_maskz_loadu_epi8(mask, values), w);
+}
+
+// Scores rows [begin, end), 64 channels at a time, with 8-bit weights.
+// Falls back to the 16-bit kernel if a weight doesn't fit in 8 bits.
+__attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni")))
+static void score_avx512vnni(
+    const uint8_t* embeddings,
+    const uint16_t num_channels,
+    const unsigned int begin,
+    const unsigned int end,
+    const int16_t* weights,
+    int32_t* scores
+) {
+  if (num_channels > MAX_NARROW_CHANNELS) {
+    score_avx512(embeddings, num_channels, begin, end, weights, scores);
+    return;
+  }
+
+  // The weights are padded with zeros to a whole number of blocks.
+  const unsigned int num_blocks = (num_channels + 63) / 64;
+  alignas(64) int8_t narrow_weights[MAX_NARROW_CHANNELS];
+  for (unsigned int c = 0; c < num_channels; c++) {
+    if (weights[c] > INT8_MAX) {
+      score_avx512(embeddings, num_channels, begin, end, weights, scores);
+      return;
+    }
+    narrow_weights[c] = weights[c];
+  }
+  for (unsigned int c = num_channels; c < num_blocks * 64; c++) {
+    narrow_weights[c] = 0;
+  }
+
+  const unsigned int tail = num_channels - (num_blocks - 1) * 64;
+  const __mmask64 tail_mask = (__mmask64) (UINT64_MAX >> (64 - tail));
+  unsigned int t = begin;
+  for (; t + ROW_BLOCK <= end; t += ROW_BLOCK) {
+    const uint8_t* row = embeddings + (size_t) t * num_channels;
+    __m512i sums[ROW_BLOCK];
+    for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+      sums[r] = _mm512_setzero_si512();
+    }
+    for (unsigned int b = 0; b < num_blocks; b++) {
+      const unsigned int c = b * 64;
+      const __mmask64 mask = b + 1 < num_blocks ? UINT64_MAX : tail_mask;
+      const __m512i w = _mm512_load_si512(narrow_weights + c);
+      for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+        sums[r] = dot_vnni(row + r * num_channels + c, mask, w, sums[r]);
+      }
+    }
+    for (unsigned int r = 0; r < ROW_BLOCK; r++) {
+      scores[t + r] = sum_lanes(sums[r]);
+    }
+  }
+  for (; t < end; t++) {
+    const uint8_t* row = embeddings + (size_t) t * num_channels;
+    __m512i sum = _mm512_setzero_si512();
+    for (unsigned int b = 0; b < num_blocks; b++) {
+      const unsigned int c = b * 64;
+      const __mmask64 mask = b + 1 < num_blocks ? UINT64_MAX : tail_mask;
+      sum = dot_vnni(
+          row + c, mask, _mm512_load_si512(narrow_weights + c), sum);
+    }
+    scores[t] = sum_lanes(sum);
+  }
+}
+
+// A kernel and the CPU features it requires.
+struct KernelInfo {
+  const char* name;
+  EmbeddingKernel kernel;
+  bool (*is_supported)();
+};
+
+static bool is_avx512_supported() {
+  return __builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512vl");
+}
+
+static bool is_avx512vnni_supported() {
+  return is_avx512_supported() && __builtin_cpu_supports("avx512vnni");
+}
+
+static bool is_avx2_supported() {
+  return __builtin_cpu_supports("avx2");
+}
+
+static bool is_always_supported() {
+  return true;
+}
+
+// The kernels, from most to least preferred.
+static const KernelInfo KERNELS[] = {
+  {"avx512vnni", score_avx512vnni, is_avx512vnni_supported},
+  {"avx512", score_avx512, is_avx512_supported},
+  {"avx2", score_avx2, is_avx2_supported},
+  {"scalar", score_scalar, is_always_supported},
+};
+
+// Returns the most preferred kernel that the CPU supports.
+static const KernelInfo* select_best_kernel() {
+  __builtin_cpu_init();
+  for (const KernelInfo& info : KERNELS) {
+    if (info.is_supported()) {
+      return &info;
+    }
+  }
+  return nullptr;  // Not reached, scalar is always supported.
+}
+
+// The selected kernel.
+static const KernelInfo* selected_kernel = select_best_kernel();
+
+void score_embeddings(
+    const uint8_t* embeddings,
+    const uint16_t num_channels,
+    const unsigned int begin,
+    const unsigned int end,
+    const int16_t* weights,
+    int32_t* scores
+) {
+  selected_kernel->kernel(
+      embeddings, num_channels, begin, end, weights, scores);
+}
+
+const char* embedding_kernel_name() {
+  return selected_kernel->name;
+}
+
+bool select_embedding_kernel(const char* name) {
+  for (const KernelInfo& info : KERNELS) {
+    if (strcmp(info.name, name) == 0) {
+      if (!info.is_supported()) {
+        return false;
+      }
+      selected_kernel = &info;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,33 @@
+#ifndef _embedding_kernels_h
+#define _embedding_kernels_h
+
+#include <cstdint>
+
+// The largest sum of the weights that score_embeddings() accepts, which
+// keeps every score within an int32_t.
+static constexpr int32_t MAX_EMBEDDING_WEIGHT_SUM = INT32_MAX / UINT8_MAX;
+
+// Scores tokens [begin, end) against a vector of channel weights, setting
+// scores[t] to the dot product of token t's embedding and the weights.
+// The embeddings are the rows of a matrix with num_channels values per token.
+// The weights mustn't be negative, and their sum mustn't exceed
+// MAX_EMBEDDING_WEIGHT_SUM.
+// The work is done by a SIMD kernel selected for the CPU at runtime. Several
+// rows are scored at once, so that each block of weights is loaded once for
+// all of them. The scores are exact, so every kernel produces the same ones.
+void score_embeddings(
+    const uint8_t* embeddings,
+    uint16_t num_channels,
+    unsigned int begin,
+    unsigned int end,
+    const int16_t* weights,
+    int32_t* scores);
+
+// Returns the name of the kernel used by score_embeddings().
+const char* embedding_kernel_name();
+
+// Selects a kernel by name: "scalar", "avx2", "avx512" or "avx512vnni".
+// Returns false if the name isn't recognized or the CPU doesn't support it.
+bool select_embedding_kernel(const char* name);
+
+#endif // _embedding_kernels_h
@@ -1,33 +1,110 @@
 #include "hippocampus.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <immintrin.h>
+
+// The maximum allowed value of the negative weight.
+// This value affects how far a weight can decay before it's ignored.
+static constexpr int MAX_NEGATIVE_WEIGHT = -4;
+
 Hippocampus::Hippocampus(
     const uint16_t num_channels_,
     const Parameters& parameters
 ) :
   num_channels(num_channels_),
-  cumulative_inputs(new DecayingValue*[num_channels])
+  cumulative_inputs(
+      num_channels_, parameters.DECAY_HALF_LIFE, parameters.SPIKE_FRACTION),
+  negative_weight_controllers(
+      num_channels_,
+      parameters.NEGATIVE_WEIGHT_HALF_LIFE,
+      parameters.NEGATIVE_SPIKE_FRACTION),
+  activation_levels(num_channels_, 0),
+  negative_weights(num_channels_),
+  decayed_channels(num_channels_)
 {
+  fired_channels.reserve(num_channels);
   for (uint16_t i = 0; i < num_channels; i++) {
-    cumulative_inputs[i] = new DecayingValue(
-        parameters.DECAY_HALF_LIFE, parameters.SPIKE_FRACTION);
+    update_negative_weight(i);
   }
-  for (uint16_t i = 0; i < num_channels; i++) {
-    channels.emplace_back(
-        /* channel= */ i,
-        parameters.NEGATIVE_WEIGHT_HALF_LIFE,
-        parameters.NEGATIVE_SPIKE_FRACTION);
+}
+
+// Adds the weighted input and negative weights to channels [begin, end), one
+// at a time, and appends the channels that fire.
+static void activate_scalar(
+    const unsigned int begin,
+    const unsigned int end,
+    const int8_t weighted_input,
+    const int8_t* negative_weights,
+    int16_t* activation_levels,
+    std::vector<uint16_t>* fired_channels
+) {
+  for (unsigned int i = begin; i < end; i++) {
+    const int activation_level =
+        activation_levels[i] + weighted_input + negative_weights[i];
+    if (activation_level >= 128) {  // Under-construction neuron fires.
+      activation_levels[i] = 0;
+      fired_channels->push_back(i);
+    } else if (activation_level < 0) {
+      // Clip activation level at zero.
+      activation_levels[i] = 0;
+    } else {
+      activation_levels[i] = activation_level;
+    }
   }
 }
 
-Hippocampus::~Hippocampus() {
-  for (uint16_t i = 0; i < num_channels; i++) {
-    delete cumulative_inputs[i];
+// Adds the weighted input and negative weights to channels [0, n), sixteen
+// at a time, and appends the channels that fire.
+// Zero activation levels with a non-positive net input are clipped straight
+// back to zero, so they are unchanged without any branching.
+__attribute__((target("avx2")))
+static void activate_avx2(
+    const unsigned int n,
+    const int8_t weighted_input,
+    const int8_t* negative_weights,
+    int16_t* activation_levels,
+    std::vector<uint16_t>* fired_channels
+) {
+  const __m256i input = _mm256_set1_epi16(weighted_input);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max_level = _mm256_set1_epi16(127);
+
+  unsigned int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i sum = _mm256_add_epi16(
+        _mm256_add_epi16(
+            _mm256_loadu_si256((const __m256i*) (activation_levels + i)),
+            input),
+        _mm256_cvtepi8_epi16(
+            _mm_loadu_si128((const __m128i*) (negative_weights + i))));
+    const __m256i fire = _mm256_cmpgt_epi16(sum, max_level);
+    _mm256_storeu_si256(
+        (__m256i*) (activation_levels + i),
+        _mm256_andnot_si256(fire, _mm256_max_epi16(sum, zero)));
+    uint32_t mask = _mm_movemask_epi8(_mm_packs_epi16(
+        _mm256_castsi256_si128(fire), _mm256_extracti128_si256(fire, 1)));
+    while (mask != 0) {
+      fired_channels->push_back(i + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
   }
-  delete[] cumulative_inputs;
+  activate_scalar(
+      i, n, weighted_input, negative_weights, activation_levels, fired_channels);
 }
 
+// Returns true if the CPU supports AVX2.
+static bool check_avx2_support() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+// Whether the CPU supports AVX2.
+static const bool is_avx2_supported = check_avx2_support();
+
 void Hippocampus::receive_input(
-    const float timestamp,
+    const Tick timestamp,
     const uint16_t input_channel,
     const Parameters& parameters,
     Cortex* cortex,
@@ -35,47 +112,121 @@ void Hippocampus::receive_input(
 ) {
   // Apply the weighted spike to all the under-construction neurons.
   const int8_t weighted_input =
-      cumulative_inputs[input_channel]->get_weight(timestamp);
+      cumulative_inputs.get_weight(input_channel, timestamp);
   if (weighted_input > 0) {
-    for (HCChannel& channel : channels) {
-      if (!channel.activate(timestamp, weighted_input)) {
-        continue;
-      }
-      outputs->push_back(channel.get_id());
-      if (!channel.should_create_neuron()) {
-        continue;
-      }
-      // Add the under-construction neuron to the cortex.
-      int8_t weights[num_channels];
-      for (uint16_t i = 0; i < num_channels; i++) {
-        weights[i] = cumulative_inputs[i]->get_weight(timestamp)
-            + channel.calculate_negative_weight(timestamp);
-      }
-      cortex->add_neuron(channel.get_id(), num_channels, weights, parameters);
-      channel.reset();
+    refresh_negative_weights(timestamp);
+    if (is_avx2_supported) {
+      activate_avx2(
+          num_channels,
+          weighted_input,
+          negative_weights.data(),
+          activation_levels.data(),
+          &fired_channels);
+    } else {
+      activate_scalar(
+          0,
+          num_channels,
+          weighted_input,
+          negative_weights.data(),
+          activation_levels.data(),
+          &fired_channels);
     }
+
+    for (const uint16_t channel : fired_channels) {
+      outputs->push_back(channel);
+      // Add the under-construction neuron to the cortex, writing its weights
+      // straight into the cortex's storage.
+      cumulative_inputs.calculate_weights(
+          timestamp, negative_weights[channel], cortex->new_neuron_weights());
+      cortex->add_neuron(channel, parameters);
+      // Start constructing a new neuron.
+      negative_weight_controllers.reset(channel);
+      update_negative_weight(channel);
+    }
+    fired_channels.clear();
   }
 
   // Spike the cumulative inputs to update the weight of the input channel.
-  cumulative_inputs[input_channel]->spike(timestamp);
+  cumulative_inputs.spike(input_channel, timestamp);
 
   // Indicate an input on the hippocampus channel.
-  channels[input_channel].receive_input(timestamp);
+  negative_weight_controllers.spike(input_channel, timestamp);
+  update_negative_weight(input_channel);
+  activation_levels[input_channel] = 0;
 }
 
 void Hippocampus::receive_output(
-    const float timestamp,
+    const Tick timestamp,
     const uint16_t output_channel
 ) {
   // Indicate an output on the hippocampus channel.
-  channels[output_channel].receive_output(timestamp);
+  negative_weight_controllers.negative_spike(output_channel, timestamp);
+  update_negative_weight(output_channel);
+  activation_levels[output_channel] = 0;
+}
+
+bool Hippocampus::save(BrainCheckpointWriter* writer) const {
+  const size_t n = num_channels;
+  return writer->begin_section(8, &writer->header()->hippocampus_offset)
+      && writer->write(
+          cumulative_inputs.get_previous_timestamps(), n * sizeof(Tick))
+      && writer->write(
+          negative_weight_controllers.get_previous_timestamps(),
+          n * sizeof(Tick))
+      && writer->write(cumulative_inputs.get_values(), n * sizeof(float))
+      && writer->write(
+          negative_weight_controllers.get_values(), n * sizeof(float))
+      && writer->write(activation_levels.data(), n * sizeof(int16_t))
+      && writer->write(negative_weights.data(), n);
+}
+
+bool Hippocampus::load(const BrainCheckpoint& checkpoint) {
+  if (!checkpoint.has_hippocampus()) {
+    fprintf(stderr, "brain checkpoint has no hippocampus\n");
+    return false;
+  }
+  if (checkpoint.num_channels() != num_channels) {
+    fprintf(stderr, "brain checkpoint has %u channels, not %u\n",
+        checkpoint.num_channels(), num_channels);
+    return false;
+  }
+
+  // The arrays are in the order that save() writes them.
+  const size_t n = num_channels;
+  const uint8_t* section = checkpoint.hippocampus();
+  const Tick* input_timestamps = (const Tick*) section;
+  const Tick* controller_timestamps = input_timestamps + n;
+  const float* input_values = (const float*) (controller_timestamps + n);
+  const float* controller_values = input_values + n;
+  const int16_t* levels = (const int16_t*) (controller_values + n);
+  const int8_t* weights = (const int8_t*) (levels + n);
+  cumulative_inputs.restore(input_values, input_timestamps);
+  negative_weight_controllers.restore(
+      controller_values, controller_timestamps);
+  activation_levels.assign(levels, levels + n);
+  negative_weights.assign(weights, weights + n);
+  return true;
 }
 
 void Hippocampus::reset() {
+  cumulative_inputs.reset();
+  negative_weight_controllers.reset();
+  std::fill(activation_levels.begin(), activation_levels.end(), 0);
   for (uint16_t i = 0; i < num_channels; i++) {
-    cumulative_inputs[i]->reset();
+    update_negative_weight(i);
   }
-  for (HCChannel& channel : channels) {
-    channel.reset();
+}
+
+void Hippocampus::refresh_negative_weights(const Tick timestamp) {
+  const unsigned int num_decayed = negative_weight_controllers.decay_due(
+      timestamp, decayed_channels.data());
+  for (unsigned int i = 0; i < num_decayed; i++) {
+    update_negative_weight(decayed_channels[i]);
   }
 }
+
+void Hippocampus::update_negative_weight(const uint16_t channel) {
+  const int negative_weight = roundf(
+      (negative_weight_controllers.get_value(channel) - 1.0f) * 128);
+  negative_weights[channel] = std::min(negative_weight, MAX_NEGATIVE_WEIGHT);
+}
@@ -1,34 +1,44 @@
 #ifndef _hippocampus_h
 #define _hippocampus_h
 
+#include "brain_checkpoint.h"
+#include "brain_checkpoint_writer.h"
 #include "cortex.h"
-#include "decaying_value.h"
-#include "hc_channel.h"
+#include "decaying_value_bank.h"
 #include "parameters.h"
 
 #include <vector>
 
 // The hippocampus interface.
+// Each channel has an under-construction neuron that is activated by the
+// weighted inputs, less a negative weight that balances inputs and outputs.
+// When an under-construction neuron fires it is added to the cortex.
 class Hippocampus {
   public:
     // Constructor.
     Hippocampus(uint16_t num_channels, const Parameters& parameters);
 
-    // Destructor.
-    ~Hippocampus();
-
     // Processes a spike on an input channel.
     // Adds newly-created neurons to the cortex.
     // Returns a list of the output channels that fire as a result.
     void receive_input(
-        float timestamp,
+        Tick timestamp,
         uint16_t input_channel,
         const Parameters& parameters,
         Cortex* cortex,
         std::vector<uint16_t>* outputs);
 
     // Processes a spike on an output channel.
-    void receive_output(float timestamp, uint16_t output_channel);
+    void receive_output(Tick timestamp, uint16_t output_channel);
+
+    // Appends the hippocampus section to a checkpoint.
+    // Returns false if it can't be written.
+    bool save(BrainCheckpointWriter* writer) const;
+
+    // Restores the state saved in a checkpoint.
+    // Returns false if the checkpoint has no hippocampus or a different
+    // number of channels.
+    bool load(const BrainCheckpoint& checkpoint);
 
     // Resets the cumulative inputs and channels.
     void reset();
@@ -38,10 +48,39 @@ class Hippocampus {
     const uint16_t num_channels;
 
     // The cumulative input values.
-    DecayingValue **cumulative_inputs;
+    DecayingValueBank cumulative_inputs;
+
+    // The negative weight controller of each channel.
+    // At zero, the negative weight is most negative.
+    // As the controller goes higher, the weight gets closer to zero.
+    DecayingValueBank negative_weight_controllers;
+
+    // The activation level of each channel's under-construction neuron.
+    // If the value goes negative, it's clipped to zero.
+    // If the value goes >= 128, it's reset to zero and the neuron fires.
+    // Technically this is a decaying value, but given the frequency of spikes
+    // the decay will be negligible. And calculating decay is expensive.
+    std::vector<int16_t> activation_levels;
+
+    // The negative weight that should be applied to all inputs to each
+    // channel's under-construction neuron.
+    // A negative weight only changes when its controller is spiked or
+    // decays meaningfully, so it's cached rather than recalculated for every
+    // input spike.
+    std::vector<int8_t> negative_weights;
+
+    // The channels whose controllers were decayed by a refresh.
+    std::vector<uint16_t> decayed_channels;
+
+    // The channels whose under-construction neurons fired.
+    std::vector<uint16_t> fired_channels;
+
+    // Updates the cached negative weights of channels whose controllers have
+    // decayed meaningfully by the specified time.
+    void refresh_negative_weights(Tick timestamp);
 
-    // The channels in the hippocampus.
-    std::vector<HCChannel> channels;
+    // Recalculates a channel's cached negative weight from its controller.
+    void update_negative_weight(uint16_t channel);
 };
 
 #endif // _hippocampus_h
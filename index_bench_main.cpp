@@ -0,0 +1,227 @@
+#include "counter_rng.h"
+#include "embedding_kernels.h"
+#include "spike_scheduler.h"
+#include "token_index.h"
+#include "token_store.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+
+// The random number streams of the query tokens and of their spikes.
+static constexpr uint32_t QUERY_STREAM = 0;
+static constexpr uint32_t SPIKE_STREAM = 1;
+
+// The search options that are benchmarked, as probes and candidates.
+static constexpr unsigned int SEARCH_OPTIONS[][2] = {
+  {1, 16},
+  {2, 32},
+  {4, 64},
+  {8, 64},
+  {8, 256},
+  {16, 256},
+  {32, 1024},
+};
+
+// Returns the seconds elapsed since the start.
+static double seconds_since(
+    const std::chrono::steady_clock::time_point start
+) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// Sets the queries to the per-channel spike counts of random tokens, each
+// encoded as spikes for one sample, as TokenOutput sees them.
+static void make_queries(
+    const TokenStore& token_store,
+    const unsigned int num_queries,
+    const uint64_t seed,
+    std::vector<int16_t>* queries
+) {
+  const Parameters& parameters = Parameters::DEFAULT_PARAMETERS;
+  const uint16_t num_channels = token_store.num_channels();
+  const CounterRng rng(seed, QUERY_STREAM);
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, SPIKE_STREAM);
+  queries->assign((size_t) num_queries * num_channels, 0);
+  for (unsigned int q = 0; q < num_queries; q++) {
+    const unsigned int token_id =
+        rng.uniform(0, q) * token_store.tokens().size();
+    spike_scheduler.schedule_token(
+        q * parameters.TICKS_PER_SAMPLE,
+        parameters.TICKS_PER_SAMPLE,
+        token_store.tokens()[token_id],
+        /* randomize= */ true);
+    int16_t* query = &(*queries)[(size_t) q * num_channels];
+    for (const ScheduledSpike* spike = spike_scheduler.peek_next();
+         spike != nullptr;
+         spike = spike_scheduler.peek_next()) {
+      query[spike->channel]++;
+      spike_scheduler.advance();
+    }
+  }
+}
+
+// Returns the best token for a query by scoring every token.
+static int exact_search(
+    const TokenStore& token_store,
+    const int16_t* query,
+    std::vector<int32_t>* scores
+) {
+  const unsigned int num_tokens = token_store.tokens().size();
+  scores->resize(num_tokens);
+  score_embeddings(
+      token_store.embeddings(),
+      token_store.num_channels(),
+      0,
+      num_tokens,
+      query,
+      scores->data());
+  int best_token = -1;
+  int32_t best_score = INT32_MIN;
+  for (unsigned int t = 0; t < num_tokens; t++) {
+    if ((*scores)[t] > best_score) {
+      best_score = (*scores)[t];
+      best_token = t;
+    }
+  }
+  return best_token;
+}
+
+// Reports the recall@1 and speed of the index's current search options on
+// the queries, against the exact best tokens.
+static void benchmark_options(
+    const char* label,
+    const std::vector<int16_t>& queries,
+    const std::vector<int>& exact_tokens,
+    TokenIndex* index
+) {
+  const unsigned int num_queries = exact_tokens.size();
+  const size_t num_channels = queries.size() / num_queries;
+  unsigned int num_matches = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (unsigned int q = 0; q < num_queries; q++) {
+    int32_t score;
+    const int token = index->search(&queries[q * num_channels], &score);
+    num_matches += token == exact_tokens[q];
+  }
+  printf("%-8s probes=%-4u candidates=%-5u recall@1=%.3f %.1f us/query\n",
+      label,
+      index->probe_count(),
+      index->candidate_count(),
+      (double) num_matches / num_queries,
+      seconds_since(start) * 1e6 / num_queries);
+}
+
+// Reports the recall@1 and speed of the index against exhaustive scoring,
+// with the default search options, a range of them, and those tuned for the
+// target recall if it isn't zero.
+static void benchmark_index(
+    const TokenStore& token_store,
+    const unsigned int num_lists,
+    const unsigned int num_subspaces,
+    const unsigned int num_queries,
+    const double target_recall,
+    const uint64_t seed
+) {
+  const uint16_t num_channels = token_store.num_channels();
+  std::vector<int16_t> queries;
+  make_queries(token_store, num_queries, seed, &queries);
+
+  auto start = std::chrono::steady_clock::now();
+  TokenIndex index(
+      token_store.embeddings(),
+      token_store.tokens().size(),
+      num_channels,
+      num_lists,
+      num_subspaces,
+      seed);
+  printf("Built index of %zu tokens, %u lists, %u subspaces in %.2f s\n",
+      token_store.tokens().size(),
+      index.list_count(),
+      index.subspace_count(),
+      seconds_since(start));
+
+  std::vector<int32_t> scores;
+  std::vector<int> exact_tokens(num_queries);
+  start = std::chrono::steady_clock::now();
+  for (unsigned int q = 0; q < num_queries; q++) {
+    exact_tokens[q] = exact_search(
+        token_store, &queries[(size_t) q * num_channels], &scores);
+  }
+  printf("Exact (%s): %.1f us/query\n",
+      embedding_kernel_name(),
+      seconds_since(start) * 1e6 / num_queries);
+
+  benchmark_options("default", queries, exact_tokens, &index);
+  for (const auto& options : SEARCH_OPTIONS) {
+    index.set_search_options(options[0], options[1]);
+    benchmark_options("", queries, exact_tokens, &index);
+  }
+
+  // Tune on other queries than those benchmarked.
+  if (target_recall > 0) {
+    std::vector<int16_t> tuning_queries;
+    make_queries(token_store, num_queries, seed + 1, &tuning_queries);
+    start = std::chrono::steady_clock::now();
+    const double recall = index.tune_search_options(
+        tuning_queries.data(), num_queries, target_recall);
+    printf("Tuned for recall@1 %.3f to %.3f in %.2f s\n",
+        target_recall,
+        recall,
+        seconds_since(start));
+    benchmark_options("tuned", queries, exact_tokens, &index);
+  }
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  unsigned int num_lists = 0;
+  unsigned int num_subspaces = 0;
+  unsigned int num_queries = 1000;
+  double target_recall = 0;
+  const char* store_path = "data/tokens-20k.store";
+  while ((opt = getopt(argc, argv, "l:m:q:r:s:")) != -1) {
+    switch (opt) {
+      case 'l':
+        num_lists = atoi(optarg);
+        break;
+      case 'm':
+        num_subspaces = atoi(optarg);
+        break;
+      case 'q':
+        num_queries = atoi(optarg);
+        break;
+      case 'r':
+        target_recall = atof(optarg);
+        break;
+      case 's':
+        store_path = optarg;
+        break;
+      default:
+        printf(
+            "Usage: %s [-l lists] [-m subspaces] [-q queries] [-r recall] "
+            "[-s store] [seed]\n",
+            argv[0]);
+        return 1;
+    }
+  }
+
+  // The seed can be given to replay a run.
+  const uint64_t seed = optind < argc
+      ? strtoull(argv[optind], nullptr, 10) : CounterRng::time_seed();
+  printf("Random seed %llu\n", (unsigned long long) seed);
+
+  TokenStore token_store;
+  if (!token_store.open(store_path)) {
+    return 1;
+  }
+  if (token_store.tokens().empty() || num_queries == 0) {
+    return 1;
+  }
+  benchmark_index(
+      token_store, num_lists, num_subspaces, num_queries, target_recall, seed);
+  return 0;
+}
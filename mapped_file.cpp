@@ -0,0 +1,78 @@
+#include "mapped_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The size of the magic bytes at the start of a header.
+static constexpr size_t MAGIC_SIZE = 8;
+
+MappedFile::MappedFile() :
+  bytes(nullptr),
+  length(0)
+{
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(
+    const char* path,
+    const char* kind,
+    const char* magic,
+    const uint32_t version,
+    const size_t header_size
+) {
+  close();
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "open %s: %m\n", path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "fstat %s: %m\n", path);
+    ::close(fd);
+    return false;
+  }
+  if ((size_t) st.st_size < header_size) {
+    fprintf(stderr, "%s: too short for a %s\n", path, kind);
+    ::close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "mmap %s: %m\n", path);
+    return false;
+  }
+  bytes = (const uint8_t*) mapping;
+  length = st.st_size;
+
+  if (memcmp(bytes, magic, MAGIC_SIZE) != 0) {
+    fprintf(stderr, "%s: not a %s\n", path, kind);
+    close();
+    return false;
+  }
+  uint32_t file_version;
+  memcpy(&file_version, bytes + MAGIC_SIZE, sizeof(file_version));
+  if (file_version != version) {
+    fprintf(stderr, "%s: unsupported %s version %u\n",
+        path, kind, file_version);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close() {
+  if (bytes != nullptr) {
+    munmap((void*) bytes, length);
+  }
+  bytes = nullptr;
+  length = 0;
+}
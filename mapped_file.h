@@ -0,0 +1,49 @@
+#ifndef _mapped_file_h
+#define _mapped_file_h
+
+#include <cstddef>
+#include <cstdint>
+
+// A read-only memory mapping of a binary file whose header starts with eight
+// magic bytes and a uint32_t format version, as checkpoints, token stores and
+// spike traces do.
+class MappedFile {
+  public:
+    // Constructor.
+    MappedFile();
+
+    // Disable the copy constructor.
+    MappedFile(const MappedFile& file) = delete;
+
+    // Destructor. Unmaps the file.
+    ~MappedFile();
+
+    // Maps the file, and checks that it's at least header_size bytes long
+    // and starts with the magic bytes and version. The kind names the file
+    // in error messages, e.g. "spike trace".
+    // Returns false if the file can't be mapped or doesn't match.
+    bool open(
+        const char* path,
+        const char* kind,
+        const char* magic,
+        uint32_t version,
+        size_t header_size);
+
+    // Unmaps the file, if it's mapped.
+    void close();
+
+    // Returns the mapped file, or null.
+    const uint8_t* data() const { return bytes; }
+
+    // Returns the size of the mapped file.
+    size_t size() const { return length; }
+
+  private:
+    // The mapped file, or null.
+    const uint8_t* bytes;
+
+    // The size of the mapped file.
+    size_t length;
+};
+
+#endif // _mapped_file_h
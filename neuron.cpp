@@ -1,39 +1,28 @@
 #include "neuron.h"
 
-#include <cstring>
-
 Neuron::Neuron(
     const uint16_t output_channel_,
-    const uint16_t num_channels_,
     const int8_t* weights_,
     const Parameters& parameters
 ) :
-  output_channel(output_channel_),
-  activation_level(0),
-  refractory_period_end_time(0),
-  refractory_duration(parameters.MIN_SPIKE_INTERVAL),
-  num_channels(num_channels_),
-  weights(new int8_t[num_channels])
+  Neuron(output_channel_, weights_, parameters.MIN_SPIKE_INTERVAL_TICKS)
 {
-  memcpy(weights, weights_, num_channels * sizeof(int8_t));
 }
 
-Neuron::Neuron(const Neuron& neuron) :
-  output_channel(neuron.output_channel),
+Neuron::Neuron(
+    const uint16_t output_channel_,
+    const int8_t* weights_,
+    const Tick refractory_duration_
+) :
+  output_channel(output_channel_),
   activation_level(0),
   refractory_period_end_time(0),
-  refractory_duration(neuron.refractory_duration),
-  num_channels(neuron.num_channels),
-  weights(new int8_t[num_channels])
+  refractory_duration(refractory_duration_),
+  weights(weights_)
 {
-  memcpy(weights, neuron.weights, num_channels * sizeof(int8_t));
-}
-
-Neuron::~Neuron() {
-  delete[] weights;
 }
 
-bool Neuron::spike(const float timestamp, const uint16_t input_channel) {
+bool Neuron::spike(const Tick timestamp, const uint16_t input_channel) {
   if (timestamp < refractory_period_end_time) {
     return false;
   }
@@ -49,6 +38,20 @@ bool Neuron::spike(const float timestamp, const uint16_t input_channel) {
   return false;
 }
 
+bool Neuron::apply_input(const Tick timestamp, const int32_t input) {
+  if (timestamp < refractory_period_end_time) {
+    return false;
+  }
+  const int32_t level = activation_level + input;
+  if (level >= 128) {
+    activation_level = 0;
+    refractory_period_end_time = timestamp + refractory_duration;
+    return true;
+  }
+  activation_level = level < 0 ? 0 : level;
+  return false;
+}
+
 void Neuron::reset() {
   activation_level = 0;
   refractory_period_end_time = 0;
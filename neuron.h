@@ -10,25 +10,47 @@ class Neuron {
   public:
     // Constructor for a neuron.
     // The weights are normalized so that a value of 128 will activate the
-    // neuron.
+    // neuron. They aren't copied, so they must persist, typically in a
+    // NeuronArena.
     Neuron(
         uint16_t output_channel,
-        uint16_t num_channels,
         const int8_t* weights,
         const Parameters& parameters);
 
-    // Disable copy constructor.
-    Neuron(const Neuron& neuron);
+    // Constructor for a neuron with the specified refractory duration.
+    Neuron(
+        uint16_t output_channel,
+        const int8_t* weights,
+        Tick refractory_duration);
 
-    // Destructor.
-    ~Neuron();
+    // Disable the copy constructor.
+    Neuron(const Neuron& neuron) = delete;
+
+    // Move constructor. The weights stay where they are, so moving a neuron
+    // is cheap and preserves its state.
+    Neuron(Neuron&& neuron) = default;
 
     // Returns the neuron's output channel.
     uint16_t get_output_channel() const { return output_channel; }
 
     // Sends a spike to the specified input channel. Returns true if the
     // spike causes the neuron to fire.
-    bool spike(float timestamp, uint16_t input_channel);
+    bool spike(Tick timestamp, uint16_t input_channel);
+
+    // Applies the summed weights of a frame of spikes at once, with the same
+    // rule as spike(). Returns true if the neuron fires.
+    bool apply_input(Tick timestamp, int32_t input);
+
+    // Returns the weights, one per input channel.
+    const int8_t* get_weights() const { return weights; }
+
+    // Returns the duration of the refractory period, in ticks.
+    Tick get_refractory_duration() const { return refractory_duration; }
+
+    // Returns the weight on an input channel.
+    int8_t get_weight(const uint16_t input_channel) const {
+      return weights[input_channel];
+    }
 
     // Resets the neuron's activation level and refractory period end time.
     void reset();
@@ -47,16 +69,13 @@ class Neuron {
 
     // The time at which the neuron becomes active again.
     // After firing, a neuron remains inactive for a period.
-    float refractory_period_end_time;
-
-    // The duration of the refractory period, in seconds.
-    const float refractory_duration;
+    Tick refractory_period_end_time;
 
-    // The number of weights.
-    const uint16_t num_channels;
+    // The duration of the refractory period, in ticks.
+    const Tick refractory_duration;
 
-    // The weights on the input channels.
-    int8_t* const weights;
+    // The weights on the input channels. Not owned.
+    const int8_t* weights;
 };
 
 #endif // _neuron_h
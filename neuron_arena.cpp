@@ -0,0 +1,35 @@
+#include "neuron_arena.h"
+
+// The size of a chunk, in bytes, unless more is reserved.
+static constexpr unsigned int CHUNK_SIZE = 1 << 20;
+
+NeuronArena::NeuronArena(const uint16_t row_size_) :
+  row_size(row_size_),
+  num_used(0),
+  num_allocated(0)
+{
+}
+
+int8_t* NeuronArena::allocate() {
+  if (chunks.empty() || num_used == chunks.back().num_rows) {
+    const unsigned int chunk_rows = CHUNK_SIZE / row_size;
+    add_chunk(chunk_rows > 0 ? chunk_rows : 1);
+  }
+  num_allocated++;
+  return &chunks.back().rows[(size_t) row_size * num_used++];
+}
+
+void NeuronArena::reserve(const unsigned int num_rows) {
+  const unsigned int num_available =
+      chunks.empty() ? 0 : chunks.back().num_rows - num_used;
+  if (num_allocated + num_available < num_rows) {
+    add_chunk(num_rows - num_allocated);
+  }
+}
+
+void NeuronArena::add_chunk(const unsigned int num_rows) {
+  chunks.push_back({
+      std::unique_ptr<int8_t[]>(new int8_t[(size_t) row_size * num_rows]),
+      num_rows});
+  num_used = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _neuron_arena_h
+#define _neuron_arena_h
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Allocates fixed-size rows of neuron weights from large chunks.
+// Rows are never moved or freed individually, so their addresses remain
+// valid for the lifetime of the arena, and growing the arena never copies
+// existing weights.
+class NeuronArena {
+  public:
+    // Constructor. Each row holds row_size weights.
+    NeuronArena(uint16_t row_size);
+
+    // Disable the copy constructor.
+    NeuronArena(const NeuronArena& neuron_arena) = delete;
+
+    // Returns an uninitialized row.
+    int8_t* allocate();
+
+    // Makes sure that the specified number of rows, in total, can be
+    // allocated without allocating another chunk.
+    void reserve(unsigned int num_rows);
+
+  private:
+    // A block of memory that rows are allocated from.
+    struct Chunk {
+      std::unique_ptr<int8_t[]> rows;
+      unsigned int num_rows;
+    };
+
+    // The number of weights in a row.
+    const uint16_t row_size;
+
+    // The chunks. Rows are allocated from the last one.
+    std::vector<Chunk> chunks;
+
+    // The number of rows allocated from the last chunk.
+    unsigned int num_used;
+
+    // The total number of rows allocated from all the chunks.
+    unsigned int num_allocated;
+
+    // Adds a chunk with the specified number of rows. Any rows left in the
+    // previous chunk are abandoned.
+    void add_chunk(unsigned int chunk_rows);
+};
+
+#endif // _neuron_arena_h
@@ -0,0 +1,112 @@
+#include "neuron_matrix.h"
+
+#include "spike_kernels.h"
+
+#include <cstring>
+
+// The number of neurons that room is made for when the matrix first grows.
+static constexpr unsigned int MIN_CAPACITY = 64;
+
+NeuronMatrix::NeuronMatrix(const uint16_t num_channels_) :
+  num_channels(num_channels_),
+  capacity(0),
+  weight_data(nullptr)
+{
+}
+
+void NeuronMatrix::add_neuron(
+    const uint16_t output_channel,
+    const int8_t* neuron_weights,
+    const Tick refractory_duration
+) {
+  const unsigned int idx = states.size();
+  if (idx == capacity) {
+    // Double the capacity so that the cost of re-laying out the columns is
+    // amortized over the added neurons.
+    set_capacity(capacity < MIN_CAPACITY ? MIN_CAPACITY : capacity * 2);
+  }
+  for (uint16_t i = 0; i < num_channels; i++) {
+    weights[(size_t) i * capacity + idx] = neuron_weights[i];
+  }
+  states.add(output_channel, refractory_duration);
+}
+
+void NeuronMatrix::spike_range(
+    const Tick timestamp,
+    const uint16_t input_channel,
+    const unsigned int begin,
+    const unsigned int end,
+    std::vector<uint16_t>* outputs
+) {
+  if (begin >= end) {
+    return;
+  }
+  spike_neuron_range(
+      column(input_channel),
+      begin,
+      end,
+      timestamp,
+      &states,
+      outputs);
+}
+
+void NeuronMatrix::spike_frame_range(
+    const Tick timestamp,
+    const uint64_t* channel_bits,
+    const unsigned int begin,
+    const unsigned int end,
+    std::vector<uint16_t>* outputs
+) {
+  if (begin >= end) {
+    return;
+  }
+  spike_frame_neuron_range(
+      weight_data,
+      capacity,
+      channel_bits,
+      (num_channels + 63) / 64,
+      begin,
+      end,
+      timestamp,
+      &states,
+      outputs);
+}
+
+void NeuronMatrix::reserve(const unsigned int num_neurons) {
+  if (num_neurons > capacity) {
+    set_capacity(num_neurons);
+  }
+  states.reserve(num_neurons);
+}
+
+void NeuronMatrix::set_capacity(const unsigned int new_capacity) {
+  std::vector<int8_t> new_weights((size_t) num_channels * new_capacity);
+  const unsigned int n = states.size();
+  if (n > 0) {
+    for (uint16_t i = 0; i < num_channels; i++) {
+      memcpy(
+          &new_weights[(size_t) i * new_capacity],
+          column(i),
+          n * sizeof(int8_t));
+    }
+  }
+  weights.swap(new_weights);
+  weight_data = weights.data();
+  capacity = new_capacity;
+}
+
+void NeuronMatrix::use_weights(
+    const int8_t* column_weights,
+    const unsigned int num_neurons,
+    const uint16_t* output_channels,
+    const Tick* refractory_durations
+) {
+  std::vector<int8_t>().swap(weights);
+  weight_data = column_weights;
+  capacity = num_neurons;
+  states = NeuronStates();
+  states.reserve(num_neurons);
+  for (unsigned int i = 0; i < num_neurons; i++) {
+    states.add(output_channels[i], refractory_durations[i]);
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef _neuron_matrix_h
+#define _neuron_matrix_h
+
+#include "neuron_states.h"
+
+#include <cstdint>
+#include <vector>
+
+// Stores the weights of all the neurons in a cortex as a single channel-major
+// matrix, with one contiguous column of weights per input channel.
+// A spike on a channel only reads that channel's column, so it becomes a
+// linear sweep over contiguous memory rather than a pointer chase per neuron.
+class NeuronMatrix {
+  public:
+    // Constructor.
+    NeuronMatrix(uint16_t num_channels);
+
+    // Adds a neuron with the specified weights, one per input channel.
+    void add_neuron(
+        uint16_t output_channel,
+        const int8_t* weights,
+        Tick refractory_duration);
+
+    // Sends a spike to the specified input channel.
+    // Appends the output channels of the neurons that fire, in neuron order.
+    void spike(
+        Tick timestamp,
+        uint16_t input_channel,
+        std::vector<uint16_t>* outputs) {
+      spike_range(timestamp, input_channel, 0, neuron_count(), outputs);
+    }
+
+    // Sends a spike to the specified input channel of neurons [begin, end).
+    // Appends the output channels of the neurons that fire, in neuron order.
+    // Disjoint ranges can be spiked concurrently.
+    void spike_range(
+        Tick timestamp,
+        uint16_t input_channel,
+        unsigned int begin,
+        unsigned int end,
+        std::vector<uint16_t>* outputs);
+
+    // Sends a frame of spikes to neurons [begin, end). Each neuron takes the
+    // sum of its weights on the channels set in the bitset at once.
+    // Appends the output channels of the neurons that fire, in neuron order.
+    void spike_frame_range(
+        Tick timestamp,
+        const uint64_t* channel_bits,
+        unsigned int begin,
+        unsigned int end,
+        std::vector<uint16_t>* outputs);
+
+    // Replaces the neurons with ones whose weights are a column-major matrix
+    // of num_neurons weights per channel, such as a mapped checkpoint. The
+    // weights aren't copied until a neuron is added, so they must persist.
+    void use_weights(
+        const int8_t* column_weights,
+        unsigned int num_neurons,
+        const uint16_t* output_channels,
+        const Tick* refractory_durations);
+
+    // Returns the weights of neurons on an input channel, one per neuron.
+    const int8_t* column(uint16_t input_channel) const {
+      return weight_data + (size_t) input_channel * capacity;
+    }
+
+    // Returns the state of the neurons.
+    const NeuronStates& neuron_states() const { return states; }
+
+    // Resets the activation level of all the neurons.
+    void reset() { states.reset(); }
+
+    // Reserves storage for the specified number of neurons.
+    void reserve(unsigned int num_neurons);
+
+    // Returns the number of neurons.
+    unsigned int neuron_count() const { return states.size(); }
+
+  private:
+    // The number of input channels, i.e. the number of columns.
+    const uint16_t num_channels;
+
+    // The number of neurons each column has room for.
+    unsigned int capacity;
+
+    // The weights, if they're owned. Column c starts at weights[c * capacity].
+    std::vector<int8_t> weights;
+
+    // The weights in use, which are either the owned weights or the ones
+    // passed to use_weights().
+    const int8_t* weight_data;
+
+    // The state of each neuron.
+    NeuronStates states;
+
+    // Re-lays out the matrix so that each column can hold new_capacity
+    // neurons.
+    void set_capacity(unsigned int new_capacity);
+};
+
+#endif // _neuron_matrix_h
@@ -0,0 +1,28 @@
+#include "neuron_states.h"
+
+#include <algorithm>
+
+void NeuronStates::add(
+    const uint16_t output_channel,
+    const Tick refractory_duration
+) {
+  output_channels.push_back(output_channel);
+  activation_levels.push_back(0);
+  refractory_period_end_times.push_back(0);
+  refractory_durations.push_back(refractory_duration);
+}
+
+void NeuronStates::reserve(const unsigned int num_neurons) {
+  output_channels.reserve(num_neurons);
+  activation_levels.reserve(num_neurons);
+  refractory_period_end_times.reserve(num_neurons);
+  refractory_durations.reserve(num_neurons);
+}
+
+void NeuronStates::reset() {
+  std::fill(activation_levels.begin(), activation_levels.end(), 0);
+  std::fill(
+      refractory_period_end_times.begin(),
+      refractory_period_end_times.end(),
+      0);
+}
@@ -0,0 +1,79 @@
+#ifndef _neuron_states_h
+#define _neuron_states_h
+
+#include "tick.h"
+
+#include <cstdint>
+#include <vector>
+
+// The mutable state of a set of neurons, stored as parallel arrays so that
+// each field can be swept linearly.
+// Neuron i is described by element i of each array.
+struct NeuronStates {
+  // The channel that each neuron outputs to.
+  std::vector<uint16_t> output_channels;
+
+  // The current activation level of each neuron.
+  // See Neuron::activation_level for the clipping and firing rules.
+  std::vector<int16_t> activation_levels;
+
+  // The time at which each neuron becomes active again.
+  std::vector<Tick> refractory_period_end_times;
+
+  // The duration of each neuron's refractory period, in ticks.
+  std::vector<Tick> refractory_durations;
+
+  // Returns the number of neurons.
+  unsigned int size() const { return output_channels.size(); }
+
+  // Appends a neuron with zero activation.
+  void add(uint16_t output_channel, Tick refractory_duration);
+
+  // Reserves storage for the specified number of neurons.
+  void reserve(unsigned int num_neurons);
+
+  // Resets the activation level and refractory period end time of all the
+  // neurons.
+  void reset();
+
+  // Applies a weighted spike to neuron i. Returns true if it fires.
+  // This is the same rule as Neuron::spike().
+  bool spike(const unsigned int i, const Tick timestamp, const int8_t weight) {
+    if (timestamp < refractory_period_end_times[i]) {
+      return false;
+    }
+    int16_t activation_level = activation_levels[i] + weight;
+    if (activation_level >= 128) {
+      activation_levels[i] = 0;
+      refractory_period_end_times[i] = timestamp + refractory_durations[i];
+      return true;
+    }
+    if (activation_level < 0) {
+      activation_level = 0;
+    }
+    activation_levels[i] = activation_level;
+    return false;
+  }
+
+  // Applies the summed weights of a frame of spikes to neuron i at once.
+  // Returns true if it fires. This is the same rule as spike().
+  bool apply_input(
+      const unsigned int i,
+      const Tick timestamp,
+      const int32_t input
+  ) {
+    if (timestamp < refractory_period_end_times[i]) {
+      return false;
+    }
+    const int32_t activation_level = activation_levels[i] + input;
+    if (activation_level >= 128) {
+      activation_levels[i] = 0;
+      refractory_period_end_times[i] = timestamp + refractory_durations[i];
+      return true;
+    }
+    activation_levels[i] = activation_level < 0 ? 0 : activation_level;
+    return false;
+  }
+};
+
+#endif // _neuron_states_h
@@ -9,35 +9,36 @@ class OutputState {
     // Constructor. The token must be persistent.
     OutputState(const Token& token);
 
-    // Copy constructor.
-    OutputState(const OutputState& output_state);
-
-    // Destructor.
-    ~OutputState();
-
     // Processes a spike on the specified channel.
     void spike(const uint16_t channel) {
-      activation_level += embedding_weights[channel];
+      activation_sum += token->embedding[channel];
+    }
+
+    // Processes a spike on the specified channel that carries a weight, such
+    // as a LATENCY-encoded value scaled by 256.
+    void spike(const uint16_t channel, const uint16_t weight) {
+      activation_sum += token->embedding[channel] * weight;
     }
 
     // Returns the output's activation level.
-    float get_activation_level() const { return activation_level; }
+    float get_activation_level() const { return activation_sum / 256.0f; }
+
+    // Returns the output's activation level, scaled by 256.
+    uint32_t get_activation_sum() const { return activation_sum; }
 
     // Returns a reference to the token.
-    const Token& get_token() const { return token; }
+    const Token& get_token() const { return *token; }
 
     // Resets the output state.
     void reset();
 
   private:
-    // A reference to the token.
-    const Token& token;
-
-    // The activation level of the output token.
-    float activation_level;
+    // The token, whose embedding is shared rather than copied.
+    const Token* token;
 
-    // The token's embedding, normalized to [0, 1).
-    float* const embedding_weights;
+    // The sum of the token's embedding values on the channels that have
+    // spiked. Dividing by 256 normalizes each value to [0, 1).
+    uint32_t activation_sum;
 };
 
 #endif // _output_state_h
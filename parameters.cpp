@@ -21,5 +21,7 @@ Parameters::Parameters(
   SPIKE_FRACTION(spike_fraction),
   DECAY_HALF_LIFE(decay_half_life),
   NEGATIVE_SPIKE_FRACTION(negative_spike_fraction),
-  NEGATIVE_WEIGHT_HALF_LIFE(negative_weight_half_life) {
+  NEGATIVE_WEIGHT_HALF_LIFE(negative_weight_half_life),
+  MIN_SPIKE_INTERVAL_TICKS(seconds_to_ticks(min_spike_interval)),
+  TICKS_PER_SAMPLE(seconds_to_ticks(seconds_per_sample)) {
 }
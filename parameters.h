@@ -1,6 +1,8 @@
 #ifndef _parameters_h
 #define _parameters_h
 
+#include "tick.h"
+
 // Various parameters that control the system.
 class Parameters {
   public:
@@ -31,6 +33,12 @@ class Parameters {
     // The exponential decay half life applied to negative weights.
     const float NEGATIVE_WEIGHT_HALF_LIFE;
 
+    // MIN_SPIKE_INTERVAL, in ticks.
+    const Tick MIN_SPIKE_INTERVAL_TICKS;
+
+    // SECONDS_PER_SAMPLE, in ticks.
+    const Tick TICKS_PER_SAMPLE;
+
     // Static parameters containing default values.
     static const Parameters DEFAULT_PARAMETERS;
 };
@@ -3,6 +3,11 @@
 #include "spike_scheduler.h"
 
 #include <cstdio>
+#include <cstdlib>
+
+// The random number streams of the training and testing schedulers.
+static constexpr uint32_t TRAINING_STREAM = 0;
+static constexpr uint32_t TESTING_STREAM = 1;
 
 // Schedules spikes to create a "bell" stimulus followed by a "food" stimulus.
 static void schedule_training_spikes(
@@ -15,17 +20,19 @@ static void schedule_training_spikes(
     SpikeScheduler* spike_scheduler
 ) {
   // Channels 0-2 are for the bell, 3-5 are for the food.
-  spike_scheduler->schedule_value(0, bell_duration, 0, bell_intensity, true);
-  spike_scheduler->schedule_value(0, bell_duration, 1, bell_intensity, true);
-  spike_scheduler->schedule_value(0, bell_duration, 2, bell_intensity, true);
+  const Tick bell_ticks = seconds_to_ticks(bell_duration);
+  spike_scheduler->schedule_value(0, bell_ticks, 0, bell_intensity, true);
+  spike_scheduler->schedule_value(0, bell_ticks, 1, bell_intensity, true);
+  spike_scheduler->schedule_value(0, bell_ticks, 2, bell_intensity, true);
 
-  const float food_start = bell_duration + gap_duration;
+  const Tick food_start = seconds_to_ticks(bell_duration + gap_duration);
+  const Tick food_ticks = seconds_to_ticks(food_duration);
   spike_scheduler->schedule_value(
-      food_start, food_duration, 3, food_intensity, /* randomize= */ true);
+      food_start, food_ticks, 3, food_intensity, /* randomize= */ true);
   spike_scheduler->schedule_value(
-      food_start, food_duration, 4, food_intensity, /* randomize= */ true);
+      food_start, food_ticks, 4, food_intensity, /* randomize= */ true);
   spike_scheduler->schedule_value(
-      food_start, food_duration, 5, food_intensity, /* randomize= */ true);
+      food_start, food_ticks, 5, food_intensity, /* randomize= */ true);
 }
 
 // Applies the spikes to the brain to train it.
@@ -34,23 +41,12 @@ static void apply_training_spikes(
     SpikeScheduler* spike_scheduler,
     Brain* brain
 ) {
-  // Apply the scheduled spikes, one at a time.
-  std::vector<uint16_t> outputs;
-  for (;;) {
-    const ScheduledSpike* scheduled_spike = spike_scheduler->peek_next();
-    if (scheduled_spike == nullptr) {
-      break;
-    }
-    brain->spike(
-        scheduled_spike->timestamp,
-        scheduled_spike->channel,
-        /* use_hippocampus= */ true,
-        parameters,
-        &outputs);
-    spike_scheduler->advance();
-    // We don't care about the outputs during training.
-    outputs.clear();
-  }
+  // We don't care about the outputs during training.
+  brain->present_spikes(
+      spike_scheduler,
+      /* use_hippocampus= */ true,
+      parameters,
+      /* outputs= */ nullptr);
 }
 
 // Trains the brain with a "bell" stimulus followed by a "food" stimulus.
@@ -62,9 +58,11 @@ static void train_brain_pavlovian(
     const float food_duration,
     const float food_intensity,
     const Parameters& parameters,
+    const uint64_t seed,
     Brain* brain
 ) {
-  SpikeScheduler spike_scheduler(num_channels, parameters);
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, TRAINING_STREAM);
   schedule_training_spikes(
       bell_duration,
       bell_intensity,
@@ -84,9 +82,10 @@ static void schedule_testing_spikes(
     SpikeScheduler* spike_scheduler
 ) {
   // Channels 0-2 are for the bell.
-  spike_scheduler->schedule_value(0, bell_duration, 0, bell_intensity, true);
-  spike_scheduler->schedule_value(0, bell_duration, 1, bell_intensity, true);
-  spike_scheduler->schedule_value(0, bell_duration, 2, bell_intensity, true);
+  const Tick bell_ticks = seconds_to_ticks(bell_duration);
+  spike_scheduler->schedule_value(0, bell_ticks, 0, bell_intensity, true);
+  spike_scheduler->schedule_value(0, bell_ticks, 1, bell_intensity, true);
+  spike_scheduler->schedule_value(0, bell_ticks, 2, bell_intensity, true);
 }
 
 // Applies a "bell" stimulus to the brain and reports how it responds.
@@ -96,28 +95,16 @@ static void apply_testing_spikes(
     SpikeScheduler* spike_scheduler,
     Brain* brain
 ) {
-  // Apply the scheduled spikes, one at a time.
-  std::vector<uint16_t> outputs;
-  for (;;) {
-    const ScheduledSpike* scheduled_spike = spike_scheduler->peek_next();
-    if (scheduled_spike == nullptr) {
-      break;
-    }
-    brain->spike(
-        scheduled_spike->timestamp,
-        scheduled_spike->channel,
-        /* use_hippocampus= */ false,
-        parameters,
-        &outputs);
-    spike_scheduler->advance();
-  }
+  SpikeOutputs outputs;
+  brain->present_spikes(
+      spike_scheduler, /* use_hippocampus= */ false, parameters, &outputs);
 
   // Analyze the outputs.
   unsigned int outputs_count[num_channels];
   for (uint16_t i = 0; i < num_channels; i++) {
     outputs_count[i] = 0;
   }
-  for (const uint16_t channel : outputs) {
+  for (const uint16_t channel : outputs.channels) {
     outputs_count[channel]++;
   }
   printf("Output spikes with bell input. [0-2] bell, [3-5] food.\n");
@@ -132,9 +119,11 @@ static void test_brain_pavlovian(
     const float bell_duration,
     const float bell_intensity,
     const Parameters& parameters,
+    const uint64_t seed,
     Brain* brain
 ) {
-  SpikeScheduler spike_scheduler(num_channels, parameters);
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, TESTING_STREAM);
   schedule_testing_spikes(
       bell_duration,
       bell_intensity,
@@ -152,7 +141,8 @@ static void test_pavlovian_learning(
     const float gap_duration,
     const float food_duration,
     const float food_intensity,
-    const Parameters& parameters
+    const Parameters& parameters,
+    const uint64_t seed
 ) {
   Brain brain(num_channels, parameters);
   brain.reserve(num_channels * 100);
@@ -165,16 +155,22 @@ static void test_pavlovian_learning(
       food_duration,
       food_intensity,
       parameters,
+      seed,
       &brain);
 
   printf("%u neurons created during training.\n", brain.neuron_count());
   brain.reset();
 
   test_brain_pavlovian(
-      num_channels, bell_duration, bell_intensity, parameters, &brain);
+      num_channels, bell_duration, bell_intensity, parameters, seed, &brain);
 }
 
 int main(int argc, char** argv) {
+  // The seed can be given to replay a run.
+  const uint64_t seed =
+      argc > 1 ? strtoull(argv[1], nullptr, 10) : CounterRng::time_seed();
+  printf("Random seed %llu\n", (unsigned long long) seed);
+
   const Parameters parameters(
       /* MIN_SPIKE_INTERVAL= */ 0.01f,
       /* SECONDS_PER_SAMPLE= */ 0.5f,
@@ -190,7 +186,8 @@ int main(int argc, char** argv) {
       /* gap_duration= */ 0.25f,
       /* food_duration= */ 0.5f,
       /* food_intensity= */ 0.7f,
-      parameters);
+      parameters,
+      seed);
 
   return 0;
 }
@@ -1,12 +1,18 @@
 #include "brain.h"
 #include "spike_scheduler.h"
-#include "token.h"
+#include "spike_trace_writer.h"
 #include "token_output.h"
+#include "token_store.h"
 
 #include <cmath>
-#include <ctime>
+#include <cstdlib>
 #include <getopt.h>
 
+// The random number streams of the token, the noise and the token selection.
+static constexpr uint32_t TOKEN_STREAM = 0;
+static constexpr uint32_t NOISE_STREAM = 1;
+static constexpr uint32_t SELECTION_STREAM = 2;
+
 // Prints the token decoded from spikes.
 // Returns false if the spikes can't be decoded.
 static bool print_token_output(
@@ -20,50 +26,27 @@ static bool print_token_output(
       idx, neuron_count, correlation, relative_volume);
 
   // Exit if no token passes the validity threshold.
-  const Token* best_token = token_output->best_token();
-  if (best_token == nullptr) {
+  std::vector<TokenScore> top_tokens;
+  const float margin = token_output->top_k(1, &top_tokens);
+  if (top_tokens.empty()) {
     printf("no output\n");
     return false;
   }
+  const Token* best_token = top_tokens[0].token;
   if (best_token->is_suffix) {
     printf("-");
   }
-  printf("%s\n", best_token->text.c_str());
+  printf("%s margin=%.2f\n", best_token->text, margin);
   return true;
 }
 
-// Applies the scheduled spikes to the brain and prints its output.
-// Returns true if the output could be decoded.
-static void apply_spikes_to_brain(
-    const Parameters& parameters,
-    const bool use_hippocampus,
-    SpikeScheduler* spike_scheduler,
-    Brain* brain,
-    unsigned int* inputs_count,
-    unsigned int* outputs_count,
-    TokenOutput* token_output
+// Counts the output spikes on each channel.
+static void count_outputs(
+    const SpikeOutputs& outputs,
+    unsigned int* outputs_count
 ) {
-  std::vector<uint16_t> outputs;
-  for (;;) {
-    const ScheduledSpike* scheduled_spike = spike_scheduler->peek_next();
-    if (scheduled_spike == nullptr) {
-      break;
-    }
-    inputs_count[scheduled_spike->channel]++;
-    brain->spike(
-        scheduled_spike->timestamp,
-        scheduled_spike->channel,
-        use_hippocampus,
-        parameters,
-        &outputs);
-    if (token_output != nullptr) {
-      token_output->spike(outputs);
-    }
-    for (const uint16_t channel : outputs) {
-      outputs_count[channel]++;
-    }
-    outputs.clear();
-    spike_scheduler->advance();
+  for (const uint16_t channel : outputs.channels) {
+    outputs_count[channel]++;
   }
 }
 
@@ -74,6 +57,7 @@ static void evaluate_noise(
     const uint16_t num_channels,
     const Parameters& parameters,
     const bool randomize,
+    const uint64_t seed,
     Brain* brain
 ) {
   uint8_t embedding[num_channels];
@@ -81,24 +65,23 @@ static void evaluate_noise(
     embedding[i] = 128;
   }
 
-  SpikeScheduler spike_scheduler(num_channels, parameters);
-  spike_scheduler.schedule_embedding(
-      /* timestamp= */ 0,
-      /* duration= */ parameters.SECONDS_PER_SAMPLE,
-      embedding,
-      randomize);
-
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, NOISE_STREAM);
   unsigned int inputs_count[num_channels] = {0};
   unsigned int outputs_count[num_channels] = {0};
+  SpikeOutputs outputs;
   brain->reset();
-  apply_spikes_to_brain(
-      parameters,
+  brain->present_embedding(
+      /* timestamp= */ 0,
+      /* duration= */ parameters.TICKS_PER_SAMPLE,
+      embedding,
+      randomize,
       /* use_hippocampus= */ false,
+      parameters,
       &spike_scheduler,
-      brain,
-      inputs_count,
-      outputs_count,
-      /* token_output= */ nullptr);
+      &outputs,
+      inputs_count);
+  count_outputs(outputs, outputs_count);
 
   unsigned int in_sum = 0;
   unsigned int out_sum = 0;
@@ -151,39 +134,62 @@ static float correlation_coefficient(
 }
 
 // Repeatedly applies the token to a brain and prints the brain's output.
-static void repeat_token(
+// If the checkpoint isn't null, its cortex is loaded before training. The
+// hippocampus starts afresh, since the clock restarts at zero. If the
+// checkpoint path isn't null, the trained brain is saved to it.
+// Returns false if the checkpoint can't be loaded or saved.
+static bool repeat_token(
     const Parameters& parameters,
-    const uint16_t token_id,
+    const uint32_t token_id,
     const unsigned int repeat_count,
     const bool randomize,
+    const uint64_t seed,
+    const CortexStorage storage,
+    const unsigned int num_threads,
+    SpikeTraceWriter* input_trace,
+    SpikeTraceWriter* output_trace,
+    const BrainCheckpoint* checkpoint,
+    const char* checkpoint_path,
     const std::vector<Token>& tokens
 ) {
   const uint16_t num_channels = tokens[token_id].num_channels;
-  Brain brain(num_channels, parameters);
+  Brain brain(num_channels, parameters, storage);
+  if (checkpoint != nullptr
+      && !brain.load(*checkpoint, /* load_hippocampus= */ false)) {
+    return false;
+  }
+  brain.set_thread_count(num_threads);
+  brain.set_trace_writers(input_trace, output_trace);
   brain.reserve(num_channels * 100);
 
-  SpikeScheduler spike_scheduler(num_channels, parameters);
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, TOKEN_STREAM);
   TokenOutput token_output;
   token_output.set_tokens(tokens);
-  const float duration = parameters.SECONDS_PER_SAMPLE;
-  float timestamp = 0;
+  token_output.set_thread_count(num_threads);
+  const Tick duration = parameters.TICKS_PER_SAMPLE;
+  Tick timestamp = 0;
+  SpikeOutputs outputs;
   for (unsigned int i = 0; i < repeat_count; i++) {
     unsigned int inputs_count[num_channels] = {0};
     unsigned int outputs_count[num_channels] = {0};
     token_output.reset();
-    spike_scheduler.schedule_embedding(
+    outputs.clear();
+
+    // The token's cached spike trains are merged as they're presented.
+    spike_scheduler.schedule_token(
         timestamp,
         duration,
-        tokens[token_id].embedding,
+        tokens[token_id],
         randomize);
-    apply_spikes_to_brain(
-        parameters,
-        /* use_hippocampus= */ true,
+    brain.present_spikes(
         &spike_scheduler,
-        &brain,
-        inputs_count,
-        outputs_count,
-        &token_output);
+        /* use_hippocampus= */ true,
+        parameters,
+        &outputs,
+        inputs_count);
+    token_output.spike(outputs.channels);
+    count_outputs(outputs, outputs_count);
     const float correlation = correlation_coefficient(
         tokens[token_id].embedding,
         outputs_count,
@@ -195,13 +201,22 @@ static void repeat_token(
         i, brain.neuron_count(), correlation, relative_volume, &token_output);
   }
 
-  evaluate_noise(num_channels, parameters, randomize, &brain);
+  if (checkpoint_path != nullptr
+      && !brain.save(checkpoint_path, /* include_hippocampus= */ true)) {
+    return false;
+  }
+
+  // Only trace the training.
+  brain.set_trace_writers(nullptr, nullptr);
+  evaluate_noise(num_channels, parameters, randomize, seed, &brain);
+  return true;
 }
 
 // Returns the ID of the token that will be used to train the brain.
-static uint16_t select_token_id(
+static uint32_t select_token_id(
     const std::vector<Token>& tokens,
-    const bool randomize
+    const bool randomize,
+    const uint64_t seed
 ) {
   if (!randomize) {
     // Token for "American".
@@ -209,15 +224,15 @@ static uint16_t select_token_id(
   }
 
   // Select a token at random.
-  srand48(time(nullptr));
-  const uint16_t token_id = lrand48() % tokens.size();
+  const CounterRng rng(seed, SELECTION_STREAM);
+  const uint32_t token_id = rng.uniform(0, 0) * tokens.size();
   const Token& token = tokens[token_id];
 
   printf("Random token (%u): ", token_id);
   if (token.is_suffix) {
     printf("-");
   }
-  printf("%s\n", token.text.c_str());
+  printf("%s\n", token.text);
 
   return token_id;
 }
@@ -225,13 +240,48 @@ static uint16_t select_token_id(
 int main(int argc, char** argv) {
   int opt;
   bool randomize = false;
-  while ((opt = getopt(argc, argv, "R")) != -1) {
+  CortexStorage storage = CortexStorage::NEURON_OBJECTS;
+  unsigned int num_threads = 1;
+  uint64_t seed = CounterRng::time_seed();
+  const char* input_trace_path = nullptr;
+  const char* output_trace_path = nullptr;
+  const char* load_path = nullptr;
+  const char* save_path = nullptr;
+  while ((opt = getopt(argc, argv, "RS:i:l:o:s:t:w:")) != -1) {
     switch (opt) {
       case 'R':
         randomize = true;
         break;
+      case 'S':
+        seed = strtoull(optarg, nullptr, 10);
+        break;
+      case 'i':
+        input_trace_path = optarg;
+        break;
+      case 'l':
+        load_path = optarg;
+        break;
+      case 'o':
+        output_trace_path = optarg;
+        break;
+      case 's':
+        if (!Cortex::parse_storage(optarg, &storage)) {
+          fprintf(stderr, "Unknown cortex storage: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        num_threads = atoi(optarg);
+        break;
+      case 'w':
+        save_path = optarg;
+        break;
       default:
-        printf("Usage: %s [-R]\n", argv[0]);
+        printf(
+            "Usage: %s [-R] [-S seed] [-i inputs] [-l checkpoint] "
+            "[-o outputs] [-s objects|matrix|sparse] [-t threads] "
+            "[-w checkpoint]\n",
+            argv[0]);
         return 1;
     }
   }
@@ -244,21 +294,58 @@ int main(int argc, char** argv) {
       /* NEGATIVE_SPIKE_FRACTION= */ 0.08f,
       /* NEGATIVE_WEIGHT_HALF_LIFE= */ 5.0f);
 
-  std::vector<Token> tokens;
-  if (!Token::parse(
-      "data/tokens-20k.raw",
-      "data/embeddings-500.raw",
-      500,
-      &tokens)) {
+  TokenStore token_store;
+  if (!token_store.open("data/tokens-20k.store")) {
     return 1;
   }
-  printf("Parsed %lu tokens\n", tokens.size());
+  const std::vector<Token>& tokens = token_store.tokens();
+  printf("Loaded %zu tokens\n", tokens.size());
   if (tokens.empty()) {
     return 1;
   }
 
-  const uint16_t token_id = select_token_id(tokens, randomize);
-  repeat_token(parameters, token_id, 20, randomize, tokens);
+  if (randomize) {
+    printf("Random seed %llu\n", (unsigned long long) seed);
+  }
+  const uint32_t token_id = select_token_id(tokens, randomize, seed);
+  const uint16_t num_channels = tokens[token_id].num_channels;
+
+  SpikeTraceWriter input_trace;
+  if (input_trace_path != nullptr
+      && !input_trace.open(input_trace_path, num_channels)) {
+    return 1;
+  }
+  SpikeTraceWriter output_trace;
+  if (output_trace_path != nullptr
+      && !output_trace.open(output_trace_path, num_channels)) {
+    return 1;
+  }
+
+  // The checkpoint must stay open for as long as the brain loaded from it.
+  BrainCheckpoint checkpoint;
+  if (load_path != nullptr && !checkpoint.open(load_path)) {
+    return 1;
+  }
+
+  if (!repeat_token(
+      parameters,
+      token_id,
+      20,
+      randomize,
+      seed,
+      storage,
+      num_threads,
+      input_trace_path != nullptr ? &input_trace : nullptr,
+      output_trace_path != nullptr ? &output_trace : nullptr,
+      load_path != nullptr ? &checkpoint : nullptr,
+      save_path,
+      tokens)) {
+    return 1;
+  }
+  if ((input_trace_path != nullptr && !input_trace.close())
+      || (output_trace_path != nullptr && !output_trace.close())) {
+    return 1;
+  }
 
   return 0;
 }
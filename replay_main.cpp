@@ -0,0 +1,148 @@
+#include "brain.h"
+#include "spike_trace_reader.h"
+#include "spike_trace_writer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+
+// Replays a spike trace into a brain, as one batch per chunk, and reports how
+// fast the brain processed it. If the checkpoint isn't null, the brain's cortex
+// is loaded from it first.
+// Returns false if the frame width isn't supported, the checkpoint can't be
+// loaded or the output trace can't be written.
+static bool replay_trace(
+    const Parameters& parameters,
+    const bool use_hippocampus,
+    const CortexStorage storage,
+    const unsigned int num_threads,
+    const Tick frame_ticks,
+    const BrainCheckpoint* checkpoint,
+    SpikeTraceReader* reader,
+    SpikeTraceWriter* output_trace
+) {
+  Brain brain(reader->num_channels(), parameters, storage);
+  brain.set_thread_count(num_threads);
+  if (!brain.set_frame_ticks(frame_ticks, parameters)) {
+    return false;
+  }
+  if (checkpoint != nullptr) {
+    const auto load_start = std::chrono::steady_clock::now();
+    if (!brain.load(*checkpoint, /* load_hippocampus= */ false)) {
+      return false;
+    }
+    const double load_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - load_start).count();
+    printf("Loaded %u neurons in %.3f ms\n",
+        brain.neuron_count(), load_seconds * 1000);
+  } else {
+    brain.reserve(reader->num_channels() * 100);
+  }
+  brain.set_trace_writers(/* input_trace= */ nullptr, output_trace);
+
+  SpikeOutputs outputs;
+  uint64_t num_spikes = 0;
+  uint64_t num_outputs = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (;;) {
+    unsigned int count;
+    const ScheduledSpike* spikes = reader->peek_chunk(&count);
+    if (count == 0) {
+      break;
+    }
+    outputs.clear();
+    brain.spike_batch(spikes, count, use_hippocampus, parameters, &outputs);
+    reader->advance(count);
+    num_spikes += count;
+    num_outputs += outputs.channels.size();
+  }
+  const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  printf("Replayed %llu spikes in %.3f s (%.0f spikes/s)\n",
+      (unsigned long long) num_spikes,
+      seconds,
+      seconds > 0 ? num_spikes / seconds : 0);
+  printf("%llu output spikes, %u neurons\n",
+      (unsigned long long) num_outputs,
+      brain.neuron_count());
+  return output_trace == nullptr || output_trace->close();
+}
+
+// Prints the command-line usage.
+static void print_usage(const char* program) {
+  printf(
+      "Usage: %s [-H] [-f frame_ticks] [-l checkpoint] [-o outputs] "
+      "[-s objects|matrix|sparse] [-t threads] trace\n",
+      program);
+}
+
+int main(int argc, char** argv) {
+  int opt;
+  bool use_hippocampus = true;
+  CortexStorage storage = CortexStorage::NEURON_OBJECTS;
+  unsigned int num_threads = 1;
+  Tick frame_ticks = 0;
+  const char* checkpoint_path = nullptr;
+  const char* output_path = nullptr;
+  while ((opt = getopt(argc, argv, "Hf:l:o:s:t:")) != -1) {
+    switch (opt) {
+      case 'H':
+        use_hippocampus = false;
+        break;
+      case 'f':
+        frame_ticks = strtoll(optarg, nullptr, 10);
+        break;
+      case 'l':
+        checkpoint_path = optarg;
+        break;
+      case 'o':
+        output_path = optarg;
+        break;
+      case 's':
+        if (!Cortex::parse_storage(optarg, &storage)) {
+          fprintf(stderr, "Unknown cortex storage: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        num_threads = atoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  SpikeTraceReader reader;
+  if (!reader.open(argv[optind])) {
+    return 1;
+  }
+  BrainCheckpoint checkpoint;
+  if (checkpoint_path != nullptr && !checkpoint.open(checkpoint_path)) {
+    return 1;
+  }
+  SpikeTraceWriter output_trace;
+  if (output_path != nullptr
+      && !output_trace.open(output_path, reader.num_channels())) {
+    return 1;
+  }
+
+  if (!replay_trace(
+      Parameters::DEFAULT_PARAMETERS,
+      use_hippocampus,
+      storage,
+      num_threads,
+      frame_ticks,
+      checkpoint_path != nullptr ? &checkpoint : nullptr,
+      &reader,
+      output_path != nullptr ? &output_trace : nullptr)) {
+    return 1;
+  }
+  return 0;
+}
@@ -5,6 +5,12 @@
 #include <cstdio>
 #include <cstdlib>
 
+// The random number streams of the training and testing schedulers, and of
+// the feedback delays.
+static constexpr uint32_t TRAINING_STREAM = 0;
+static constexpr uint32_t TESTING_STREAM = 1;
+static constexpr uint32_t FEEDBACK_STREAM = 2;
+
 // Schedules spikes to create a sequence of unique vectors.
 static void schedule_training_spikes(
     const std::vector<float>& pattern,
@@ -14,12 +20,12 @@ static void schedule_training_spikes(
 ) {
   // Schedule a sequence of vectors.
   for (unsigned int i = 0; i < sequence_length; i++) {
-    const float start_time = i * parameters.SECONDS_PER_SAMPLE;
+    const Tick start_time = i * parameters.TICKS_PER_SAMPLE;
     unsigned int channel = i * pattern.size();
     for (const float value : pattern) {
       spike_scheduler->schedule_value(
           start_time,
-          parameters.SECONDS_PER_SAMPLE,
+          parameters.TICKS_PER_SAMPLE,
           channel,
           value,
           /* randomize= */ true);
@@ -34,23 +40,12 @@ static void apply_training_spikes(
     SpikeScheduler* spike_scheduler,
     Brain* brain
 ) {
-  // Apply the scheduled spikes, one at a time.
-  std::vector<uint16_t> outputs;
-  for (;;) {
-    const ScheduledSpike* scheduled_spike = spike_scheduler->peek_next();
-    if (scheduled_spike == nullptr) {
-      break;
-    }
-    brain->spike(
-        scheduled_spike->timestamp,
-        scheduled_spike->channel,
-        /* use_hippocampus= */ true,
-        parameters,
-        &outputs);
-    spike_scheduler->advance();
-    // We don't care about the outputs during training.
-    outputs.clear();
-  }
+  // We don't care about the outputs during training.
+  brain->present_spikes(
+      spike_scheduler,
+      /* use_hippocampus= */ true,
+      parameters,
+      /* outputs= */ nullptr);
 }
 
 // Trains a brain using a sequence of vectors.
@@ -59,9 +54,11 @@ static void train_brain_sequence(
     const std::vector<float>& pattern,
     const unsigned int sequence_length,
     const Parameters& parameters,
+    const uint64_t seed,
     Brain* brain
 ) {
-  SpikeScheduler spike_scheduler(num_channels, parameters);
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, TRAINING_STREAM);
   schedule_training_spikes(
       pattern, sequence_length, parameters, &spike_scheduler);
   apply_training_spikes(parameters, &spike_scheduler, brain);
@@ -77,7 +74,7 @@ static void schedule_testing_spikes(
   for (const float value : pattern) {
     spike_scheduler->schedule_value(
         0,
-        parameters.SECONDS_PER_SAMPLE,
+        parameters.TICKS_PER_SAMPLE,
         channel,
         value,
         /* randomize= */ true);
@@ -90,7 +87,7 @@ static void schedule_testing_spikes(
 static void report_values(
   uint16_t num_channels,
   unsigned int* values,
-  const float timestamp,
+  const Tick timestamp,
   const std::vector<float>& pattern,
   const unsigned int sequence_length,
   const Parameters& parameters
@@ -98,7 +95,7 @@ static void report_values(
   const unsigned int pstep = pattern.size();
   float pattern_activations[sequence_length] = {0};
 
-  printf("%4.2f:", timestamp);
+  printf("%4.2f:", ticks_to_seconds(timestamp));
   for (uint16_t i = 0; i < num_channels; i++) {
     const float value = values[i];
     printf(" %2u", values[i]);
@@ -130,11 +127,17 @@ static void report_values(
   printf("^^\n");
 }
 
-// Returns a random feedback delay.
+// Returns a random feedback delay for a channel's nth output spike.
 // This is to prevent neurons from firing simultaneously, which can cause
 // problems.
-static float random_feedback_delay(const Parameters& parameters) {
-  return parameters.MIN_SPIKE_INTERVAL * (1.0f + 2.0 * drand48());
+static Tick random_feedback_delay(
+    const Parameters& parameters,
+    const CounterRng& rng,
+    const uint16_t channel,
+    const uint64_t n
+) {
+  const double fraction = rng.uniform(channel, n);
+  return llround(parameters.MIN_SPIKE_INTERVAL_TICKS * (1.0 + 2.0 * fraction));
 }
 
 // Provides spikes to the brain and reports how the generated sequence
@@ -144,48 +147,65 @@ static void apply_testing_spikes(
     const std::vector<float>& pattern,
     const unsigned int sequence_length,
     const Parameters& parameters,
+    const uint64_t seed,
     SpikeScheduler* spike_scheduler,
     Brain* brain
 ) {
   // Apply the prompt spikes and keep feeding back the cortex output and
   // printing the output.
-  const float duration = parameters.SECONDS_PER_SAMPLE * (sequence_length + 2);
-  SpikeQueue feedback_queue;
+  const Tick duration = parameters.TICKS_PER_SAMPLE * (sequence_length + 2);
+  SpikeQueue feedback_queue(parameters);
   SequenceMerger sequence_merger(spike_scheduler, &feedback_queue, duration);
-  std::vector<uint16_t> output_spikes;
+  std::vector<ScheduledSpike> batch;
+  SpikeOutputs batch_outputs;
 
   // Outputs per channel.
   unsigned int values[num_channels] = {0};
 
-  const float reporting_interval = 0.1f;
-  float reporting_deadline = reporting_interval;
-  float timestamp;
-  uint16_t channel;
-  while (sequence_merger.get_next(&timestamp, &channel)) {
-    brain->spike(
-        timestamp,
-        channel,
+  // Feedback delays are keyed by channel and the number of outputs on it.
+  const CounterRng feedback_rng(seed, FEEDBACK_STREAM);
+  std::vector<uint64_t> feedback_counts(num_channels, 0);
+
+  const Tick reporting_interval = seconds_to_ticks(0.1);
+  Tick reporting_deadline = reporting_interval;
+  for (const ScheduledSpike* next;
+      (next = sequence_merger.peek_next()) != nullptr;) {
+    // A feedback delay is at least MIN_SPIKE_INTERVAL_TICKS, so no output can
+    // feed back sooner than that after the next spike, and the spikes until
+    // then can be sent as a batch.
+    batch.clear();
+    sequence_merger.drain_until(
+        next->timestamp + parameters.MIN_SPIKE_INTERVAL_TICKS, &batch);
+    batch_outputs.clear();
+    brain->spike_batch(
+        batch.data(),
+        batch.size(),
         /* use_hippocampus= */ false,
         parameters,
-        &output_spikes);
-    spike_scheduler->advance();
+        &batch_outputs);
 
-    for (uint16_t chan : output_spikes) {
-      const float feedback_delay = random_feedback_delay(parameters);
-      feedback_queue.add(timestamp + feedback_delay, chan);
-      values[chan]++;
-    }
-    output_spikes.clear();
-
-    if (timestamp >= reporting_deadline) {
-      report_values(
-          num_channels,
-          values,
-          reporting_deadline,
-          pattern,
-          sequence_length,
-          parameters);
-      reporting_deadline += reporting_interval;
+    for (unsigned int i = 0; i < batch.size(); i++) {
+      const Tick timestamp = batch[i].timestamp;
+      for (unsigned int j = batch_outputs.offsets[i];
+          j < batch_outputs.offsets[i + 1];
+          j++) {
+        const uint16_t chan = batch_outputs.channels[j];
+        const Tick feedback_delay = random_feedback_delay(
+            parameters, feedback_rng, chan, feedback_counts[chan]++);
+        feedback_queue.add(timestamp + feedback_delay, chan);
+        values[chan]++;
+      }
+
+      if (timestamp >= reporting_deadline) {
+        report_values(
+            num_channels,
+            values,
+            reporting_deadline,
+            pattern,
+            sequence_length,
+            parameters);
+        reporting_deadline += reporting_interval;
+      }
     }
   }
   report_values(
@@ -204,20 +224,28 @@ static void test_brain_sequence(
     const std::vector<float> pattern,
     const unsigned int sequence_length,
     const Parameters& parameters,
+    const uint64_t seed,
     Brain* brain
 ) {
-  SpikeScheduler spike_scheduler(num_channels, parameters);
+  SpikeScheduler spike_scheduler(
+      num_channels, parameters, seed, TESTING_STREAM);
   schedule_testing_spikes(pattern, parameters, &spike_scheduler);
   apply_testing_spikes(
       num_channels,
       pattern,
       sequence_length,
       parameters,
+      seed,
       &spike_scheduler,
       brain);
 }
 
 int main(int argc, char** argv) {
+  // The seed can be given to replay a run.
+  const uint64_t seed =
+      argc > 1 ? strtoull(argv[1], nullptr, 10) : CounterRng::time_seed();
+  printf("Random seed %llu\n", (unsigned long long) seed);
+
   const Parameters parameters(
       /* MIN_SPIKE_INTERVAL= */ 0.01f,
       /* SECONDS_PER_SAMPLE= */ 0.5f,
@@ -234,13 +262,13 @@ int main(int argc, char** argv) {
   brain.reserve(num_channels * 100);
 
   train_brain_sequence(
-      num_channels, pattern, sequence_length, parameters, &brain);
+      num_channels, pattern, sequence_length, parameters, seed, &brain);
 
   printf("%u neurons created during training.\n", brain.neuron_count());
   brain.reset();
 
   test_brain_sequence(
-      num_channels, pattern, sequence_length, parameters, &brain);
+      num_channels, pattern, sequence_length, parameters, seed, &brain);
 
   return 0;
 }
@@ -1,41 +1,146 @@
 #include "sequence_merger.h"
 
+// Returns the sources that aren't null.
+static std::vector<SpikeSource*> non_null_sources(
+    SpikeScheduler* spike_scheduler,
+    SpikeQueue* spike_queue
+) {
+  std::vector<SpikeSource*> sources = {spike_scheduler};
+  if (spike_queue != nullptr) {
+    sources.push_back(spike_queue);
+  }
+  return sources;
+}
+
+SequenceMerger::SequenceMerger(
+    SpikeScheduler* spike_scheduler,
+    SpikeQueue* spike_queue,
+    const Tick deadline_
+) :
+  SequenceMerger(non_null_sources(spike_scheduler, spike_queue), deadline_)
+{
+}
+
 SequenceMerger::SequenceMerger(
-    SpikeScheduler* spike_scheduler_,
-    SpikeQueue* spike_queue_,
-    const float deadline_
+    const std::vector<SpikeSource*>& sources_,
+    const Tick deadline_
 ) :
-  spike_scheduler(spike_scheduler_),
-  spike_queue(spike_queue_),
+  sources(sources_),
+  winner(0),
   deadline(deadline_)
 {
+  for (unsigned int i = 0; i < sources.size(); i++) {
+    if (sources[i]->is_mutable()) {
+      mutable_sources.push_back(i);
+    } else {
+      tree_sources.push_back(i);
+    }
+  }
+  build_tree();
+}
+
+bool SequenceMerger::get_next(Tick* timestamp, uint16_t* channel) {
+  const int source = find_next_source();
+  if (source < 0) {
+    return false;
+  }
+  const ScheduledSpike* spike = sources[source]->peek_next();
+  *timestamp = spike->timestamp;
+  *channel = spike->channel;
+  advance();
+  return true;
+}
+
+unsigned int SequenceMerger::drain_until(
+    const Tick drain_deadline,
+    std::vector<ScheduledSpike>* buffer
+) {
+  unsigned int count = 0;
+  for (const ScheduledSpike* spike; (spike = peek_next()) != nullptr;
+      advance()) {
+    if (spike->timestamp >= drain_deadline) {
+      break;
+    }
+    buffer->push_back(*spike);
+    count++;
+  }
+  return count;
 }
 
-bool SequenceMerger::get_next(float* timestamp, uint16_t* channel) {
-  // Check if there's anything valid in the spike scheduler.
-  bool spike_scheduler_found = false;
-  const ScheduledSpike* scheduled_spike = spike_scheduler->peek_next();
-  if (scheduled_spike != nullptr && scheduled_spike->timestamp < deadline) {
-    spike_scheduler_found = true;
+const ScheduledSpike* SequenceMerger::peek_next() const {
+  const int source = find_next_source();
+  return source < 0 ? nullptr : sources[source]->peek_next();
+}
+
+void SequenceMerger::advance() {
+  const int source = find_next_source();
+  if (source < 0) {
+    return;
   }
+  sources[source]->advance();
+  if (!tree_sources.empty() && (unsigned int) source == tree_sources[winner]) {
+    replay_winner();
+  }
+}
 
-  // Check if there's anything valid in the spike queue.
-  bool spike_queue_found = spike_queue != nullptr && !spike_queue->empty()
-      && spike_queue->front().timestamp < deadline;
+void SequenceMerger::read_leaf(const unsigned int leaf) {
+  const ScheduledSpike* spike = sources[tree_sources[leaf]]->peek_next();
+  leaf_timestamps[leaf] = spike == nullptr ? EXHAUSTED : spike->timestamp;
+}
+
+void SequenceMerger::build_tree() {
+  const unsigned int num_leaves = tree_sources.size();
+  leaf_timestamps.resize(num_leaves);
+  for (unsigned int i = 0; i < num_leaves; i++) {
+    read_leaf(i);
+  }
+  if (num_leaves == 0) {
+    return;
+  }
+
+  // Play the matches bottom up, recording each node's winner temporarily.
+  std::vector<unsigned int> winners(2 * num_leaves);
+  for (unsigned int i = 0; i < num_leaves; i++) {
+    winners[num_leaves + i] = i;
+  }
+  losers.resize(num_leaves);
+  for (unsigned int n = num_leaves - 1; n >= 1; n--) {
+    const unsigned int a = winners[2 * n];
+    const unsigned int b = winners[2 * n + 1];
+    winners[n] = leaf_precedes(a, b) ? a : b;
+    losers[n] = leaf_precedes(a, b) ? b : a;
+  }
+  winner = winners[1];
+}
+
+void SequenceMerger::replay_winner() {
+  const unsigned int num_leaves = tree_sources.size();
+  read_leaf(winner);
+  unsigned int candidate = winner;
+  for (unsigned int n = (num_leaves + winner) / 2; n >= 1; n /= 2) {
+    if (leaf_precedes(losers[n], candidate)) {
+      std::swap(losers[n], candidate);
+    }
+  }
+  winner = candidate;
+}
 
-  // Return the spike with the earliest timestamp.
-  if (spike_scheduler_found && (!spike_queue_found
-      || scheduled_spike->timestamp <= spike_queue->front().timestamp)) {
-    *timestamp = scheduled_spike->timestamp;
-    *channel = scheduled_spike->channel;
-    spike_scheduler->advance();
-    return true;
+int SequenceMerger::find_next_source() const {
+  // Start with the tree's winner, then check the mutable sources.
+  int best = -1;
+  Tick best_timestamp = deadline;
+  if (!tree_sources.empty() && leaf_timestamps[winner] < deadline) {
+    best = tree_sources[winner];
+    best_timestamp = leaf_timestamps[winner];
   }
-  if (spike_queue_found) {
-    *timestamp = spike_queue->front().timestamp;
-    *channel = spike_queue->front().channel;
-    spike_queue->pop();
-    return true;
+  for (const unsigned int i : mutable_sources) {
+    const ScheduledSpike* spike = sources[i]->peek_next();
+    if (spike != nullptr && (spike->timestamp < best_timestamp
+        || (spike->timestamp == best_timestamp && best >= 0
+            && (int) i < best))) {
+      best = i;
+      best_timestamp = spike->timestamp;
+    }
   }
-  return false;
+  return best;
 }
@@ -3,10 +3,18 @@
 
 #include "spike_queue.h"
 #include "spike_scheduler.h"
+#include "spike_source.h"
 
-// Merges sequences of spikes from a SpikeScheduler and an optional SpikeQueue
-// to provide a time-ordered sequence of spikes up to a deadline.
-class SequenceMerger {
+#include <vector>
+
+// Merges any number of time-ordered spike sources to provide a time-ordered
+// sequence of spikes up to a deadline. Spikes with the same timestamp are
+// provided in the order of their sources.
+// Sources that only change when advanced are merged with a loser tree, so
+// each spike costs O(log k) comparisons for k sources. Mutable sources, like
+// feedback queues, can gain earlier spikes at any time, so they're checked
+// against the tree's winner for every spike. They should be few.
+class SequenceMerger : public SpikeSource {
   public:
     // Constructor.
     // The output queue is optional, and can be null. If it isn't null, it's
@@ -15,22 +23,81 @@ class SequenceMerger {
     SequenceMerger(
         SpikeScheduler* spike_scheduler,
         SpikeQueue* output_queue,
-        float deadline);
+        Tick deadline);
+
+    // Constructor for merging any number of sources. The sources aren't
+    // owned, and must outlive the merger.
+    // Spikes will be provided until the deadline.
+    SequenceMerger(const std::vector<SpikeSource*>& sources, Tick deadline);
 
     // If there is a spike before the deadline, returns true, sets its
-    // timestamp and deadline, and advances to the next spike.
-    bool get_next(float* timestamp, uint16_t* channel);
+    // timestamp and channel, and advances to the next spike.
+    bool get_next(Tick* timestamp, uint16_t* channel);
+
+    // Appends every spike before both the specified deadline and the
+    // merger's own deadline to the buffer, so that they can be processed as
+    // a batch. Spikes added to mutable sources later aren't included.
+    // Returns the number of spikes appended.
+    unsigned int drain_until(
+        Tick deadline,
+        std::vector<ScheduledSpike>* buffer);
+
+    // Returns a pointer to the next spike before the deadline, or null if
+    // there are none.
+    const ScheduledSpike* peek_next() const override;
+
+    // Advances past the next spike.
+    void advance() override;
+
+    // Returns true if any of the sources are mutable.
+    bool is_mutable() const override { return !mutable_sources.empty(); }
 
   private:
-    // Provides a time-ordered sequence of spikes.
-    SpikeScheduler* spike_scheduler;
+    // The timestamp used for exhausted sources in the tree.
+    static constexpr Tick EXHAUSTED = INT64_MAX;
+
+    // All the sources, in tie-breaking order.
+    std::vector<SpikeSource*> sources;
+
+    // The indices of the sources merged by the tree. Leaf i of the tree is
+    // source tree_sources[i].
+    std::vector<unsigned int> tree_sources;
 
-    // Nullable. Provides a time-ordered sequence of spikes. Can be appended to
-    // at any time.
-    SpikeQueue* spike_queue;
+    // The indices of the mutable sources.
+    std::vector<unsigned int> mutable_sources;
+
+    // The timestamp of each leaf's next spike, or EXHAUSTED.
+    std::vector<Tick> leaf_timestamps;
+
+    // losers[n] is the leaf that lost the match at internal node n, for
+    // 1 <= n < the number of leaves. Leaf i is node i + the number of
+    // leaves, and node n's parent is n / 2.
+    std::vector<unsigned int> losers;
+
+    // The leaf that won the tree.
+    unsigned int winner;
 
     // Spikes will only be provided if their timestamp is before this deadline.
-    const float deadline;
+    const Tick deadline;
+
+    // Returns true if leaf a's next spike comes before leaf b's.
+    bool leaf_precedes(unsigned int a, unsigned int b) const {
+      return leaf_timestamps[a] < leaf_timestamps[b]
+          || (leaf_timestamps[a] == leaf_timestamps[b] && a < b);
+    }
+
+    // Reads the timestamp of a leaf's next spike.
+    void read_leaf(unsigned int leaf);
+
+    // Plays the matches from every leaf to find the winner.
+    void build_tree();
+
+    // Replays the matches on the winner's path after it has advanced.
+    void replay_winner();
+
+    // Returns the index of the source with the next spike, or -1 if there
+    // are no spikes before the deadline.
+    int find_next_source() const;
 };
 
 #endif // _sequence_merger_h
@@ -0,0 +1,33 @@
+#ifndef _spike_encoding_h
+#define _spike_encoding_h
+
+#include "tick.h"
+
+#include <algorithm>
+
+// How values are encoded as spikes.
+enum class SpikeEncoding {
+  // A value is the rate of a train of spikes over the duration.
+  RATE,
+
+  // A value is the time of a single spike in the duration's latency window:
+  // the higher the value, the sooner the spike. A 500-value embedding costs
+  // one spike per channel rather than thousands per sample.
+  LATENCY,
+};
+
+// Returns the time of a LATENCY-encoded [0-1] value's spike, from the start
+// of the window.
+inline Tick latency_offset(const float value, const Tick window) {
+  return llround((1 - std::min(1.0f, std::max(0.0f, value))) * window);
+}
+
+// Returns the [0-1] value of a LATENCY-encoded spike at the time from the
+// start of the window.
+inline float latency_value(const Tick offset, const Tick window) {
+  return window > 0
+      ? 1 - std::min(1.0f, std::max(0.0f, (float) offset / window))
+      : 1;
+}
+
+#endif // _spike_encoding_h
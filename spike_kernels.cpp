@@ -0,0 +1,552 @@
+#include "spike_kernels.h"
+
+#include <cstring>
+#include <immintrin.h>
+
+// Each kernel updates the activation levels of a block of neurons with vector
+// instructions, producing a bitmask of the neurons that fire. Only the set
+// bits of the mask are visited to update refractory periods and emit output
+// channels, so the cost of firing is proportional to the number that fire.
+// A scalar loop handles whatever doesn't fill a block.
+// Refractory period end times are 64-bit ticks, so the comparisons that find
+// the active neurons are done on 64-bit lanes and narrowed to 16-bit masks.
+// The frame kernels first sum the weights of a block of neurons on every
+// channel in the frame in 32-bit lanes, then saturate the sums to 16 bits and
+// apply them with the same instructions as a spike. Saturation can't change
+// the result, as a sum beyond the 16-bit range fires or clips either way.
+
+// A function that applies a spike to a range of neurons.
+typedef void (*SpikeKernel)(
+    const int8_t* column,
+    unsigned int begin,
+    unsigned int end,
+    Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs);
+
+// A function that applies a frame of spikes to a range of neurons.
+typedef void (*FrameKernel)(
+    const int8_t* weights,
+    size_t column_stride,
+    const uint64_t* channel_bits,
+    unsigned int num_words,
+    unsigned int begin,
+    unsigned int end,
+    Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs);
+
+// Returns the weights of the channel with the lowest set bit in a word of a
+// channel bitset, whose first channel is word_base.
+static inline const int8_t* column_of(
+    const int8_t* weights,
+    const size_t column_stride,
+    const unsigned int word_base,
+    const uint64_t bits
+) {
+  return weights + (word_base + __builtin_ctzll(bits)) * column_stride;
+}
+
+// Applies a spike to neurons [begin, end), one neuron at a time.
+static void spike_scalar(
+    const int8_t* column,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  for (unsigned int i = begin; i < end; i++) {
+    if (states->spike(i, timestamp, column[i])) {
+      outputs->push_back(states->output_channels[i]);
+    }
+  }
+}
+
+// Applies a frame to neurons [begin, end), one neuron at a time.
+static void spike_frame_scalar(
+    const int8_t* weights,
+    const size_t column_stride,
+    const uint64_t* channel_bits,
+    const unsigned int num_words,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  for (unsigned int i = begin; i < end; i++) {
+    int32_t input = 0;
+    for (unsigned int word = 0; word < num_words; word++) {
+      for (uint64_t bits = channel_bits[word]; bits != 0; bits &= bits - 1) {
+        input += column_of(weights, column_stride, word * 64, bits)[i];
+      }
+    }
+    if (input != 0 && states->apply_input(i, timestamp, input)) {
+      outputs->push_back(states->output_channels[i]);
+    }
+  }
+}
+
+// Fires the neurons in a block, whose first neuron is base, with a set bit in
+// the mask.
+static inline void fire_masked(
+    const unsigned int base,
+    uint32_t mask,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  while (mask != 0) {
+    const unsigned int i = base + __builtin_ctz(mask);
+    states->refractory_period_end_times[i] =
+        timestamp + states->refractory_durations[i];
+    outputs->push_back(states->output_channels[i]);
+    mask &= mask - 1;
+  }
+}
+
+// Applies the inputs of neurons [i, i + 8).
+__attribute__((target("sse4.2")))
+static inline void apply_inputs_sse42(
+    const __m128i w,
+    const unsigned int i,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  int16_t* activation_levels = states->activation_levels.data();
+  const Tick* end_times = states->refractory_period_end_times.data();
+  const __m128i t = _mm_set1_epi64x(timestamp);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i all_ones = _mm_set1_epi32(-1);
+  const __m128i max_level = _mm_set1_epi16(127);
+
+  const __m128i a = _mm_loadu_si128((const __m128i*) (activation_levels + i));
+  __m128i inactive[4];
+  for (unsigned int j = 0; j < 4; j++) {
+    inactive[j] = _mm_cmpgt_epi64(
+        _mm_loadu_si128((const __m128i*) (end_times + i + 2 * j)), t);
+  }
+  // Keep the low half of each 64-bit mask, then narrow to 16 bits.
+  const __m128i active = _mm_xor_si128(
+      _mm_packs_epi32(
+          _mm_castps_si128(_mm_shuffle_ps(
+              _mm_castsi128_ps(inactive[0]),
+              _mm_castsi128_ps(inactive[1]),
+              _MM_SHUFFLE(2, 0, 2, 0))),
+          _mm_castps_si128(_mm_shuffle_ps(
+              _mm_castsi128_ps(inactive[2]),
+              _mm_castsi128_ps(inactive[3]),
+              _MM_SHUFFLE(2, 0, 2, 0)))),
+      all_ones);
+  const __m128i sum = _mm_adds_epi16(a, w);
+  const __m128i fire = _mm_and_si128(_mm_cmpgt_epi16(sum, max_level), active);
+  const __m128i level = _mm_andnot_si128(fire, _mm_max_epi16(sum, zero));
+  _mm_storeu_si128(
+      (__m128i*) (activation_levels + i), _mm_blendv_epi8(a, level, active));
+  const uint32_t mask = _mm_movemask_epi8(_mm_packs_epi16(fire, zero));
+  if (mask != 0) {
+    fire_masked(i, mask, timestamp, states, outputs);
+  }
+}
+
+// Applies a spike to neurons [begin, end), eight at a time.
+__attribute__((target("sse4.2")))
+static void spike_sse42(
+    const int8_t* column,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  unsigned int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    apply_inputs_sse42(
+        _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*) (column + i))),
+        i,
+        timestamp,
+        states,
+        outputs);
+  }
+  spike_scalar(column, i, end, timestamp, states, outputs);
+}
+
+// Applies a frame to neurons [begin, end), eight at a time.
+__attribute__((target("sse4.2")))
+static void spike_frame_sse42(
+    const int8_t* weights,
+    const size_t column_stride,
+    const uint64_t* channel_bits,
+    const unsigned int num_words,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  unsigned int i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m128i low = _mm_setzero_si128();
+    __m128i high = _mm_setzero_si128();
+    for (unsigned int word = 0; word < num_words; word++) {
+      for (uint64_t bits = channel_bits[word]; bits != 0; bits &= bits - 1) {
+        const __m128i w = _mm_loadl_epi64((const __m128i*)
+            (column_of(weights, column_stride, word * 64, bits) + i));
+        low = _mm_add_epi32(low, _mm_cvtepi8_epi32(w));
+        high = _mm_add_epi32(high, _mm_cvtepi8_epi32(_mm_srli_si128(w, 4)));
+      }
+    }
+    apply_inputs_sse42(
+        _mm_packs_epi32(low, high), i, timestamp, states, outputs);
+  }
+  spike_frame_scalar(
+      weights,
+      column_stride,
+      channel_bits,
+      num_words,
+      i,
+      end,
+      timestamp,
+      states,
+      outputs);
+}
+
+// Narrows two vectors of four 64-bit lane masks to one of eight 32-bit ones.
+__attribute__((target("avx2")))
+static inline __m256i narrow_masks(const __m256i low, const __m256i high) {
+  const __m256i even_lanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  return _mm256_blend_epi32(
+      _mm256_permutevar8x32_epi32(low, even_lanes),
+      _mm256_permutevar8x32_epi32(high, even_lanes),
+      0xf0);
+}
+
+// Applies the inputs of neurons [i, i + 16).
+__attribute__((target("avx2")))
+static inline void apply_inputs_avx2(
+    const __m256i w,
+    const unsigned int i,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  int16_t* activation_levels = states->activation_levels.data();
+  const Tick* end_times = states->refractory_period_end_times.data();
+  const __m256i t = _mm256_set1_epi64x(timestamp);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i all_ones = _mm256_set1_epi32(-1);
+  const __m256i max_level = _mm256_set1_epi16(127);
+
+  const __m256i a = _mm256_loadu_si256(
+      (const __m256i*) (activation_levels + i));
+  __m256i inactive[4];
+  for (unsigned int j = 0; j < 4; j++) {
+    inactive[j] = _mm256_cmpgt_epi64(
+        _mm256_loadu_si256((const __m256i*) (end_times + i + 4 * j)), t);
+  }
+  // Packing works within 128-bit lanes, so restore the neuron order.
+  const __m256i active = _mm256_xor_si256(
+      _mm256_permute4x64_epi64(
+          _mm256_packs_epi32(
+              narrow_masks(inactive[0], inactive[1]),
+              narrow_masks(inactive[2], inactive[3])),
+          0xd8),
+      all_ones);
+  const __m256i sum = _mm256_adds_epi16(a, w);
+  const __m256i fire = _mm256_and_si256(
+      _mm256_cmpgt_epi16(sum, max_level), active);
+  const __m256i level = _mm256_andnot_si256(
+      fire, _mm256_max_epi16(sum, zero));
+  _mm256_storeu_si256(
+      (__m256i*) (activation_levels + i),
+      _mm256_blendv_epi8(a, level, active));
+  const uint32_t mask = _mm_movemask_epi8(_mm_packs_epi16(
+      _mm256_castsi256_si128(fire), _mm256_extracti128_si256(fire, 1)));
+  if (mask != 0) {
+    fire_masked(i, mask, timestamp, states, outputs);
+  }
+}
+
+// Applies a spike to neurons [begin, end), sixteen at a time.
+__attribute__((target("avx2")))
+static void spike_avx2(
+    const int8_t* column,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  unsigned int i = begin;
+  for (; i + 16 <= end; i += 16) {
+    apply_inputs_avx2(
+        _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (column + i))),
+        i,
+        timestamp,
+        states,
+        outputs);
+  }
+  spike_sse42(column, i, end, timestamp, states, outputs);
+}
+
+// Applies a frame to neurons [begin, end), sixteen at a time.
+__attribute__((target("avx2")))
+static void spike_frame_avx2(
+    const int8_t* weights,
+    const size_t column_stride,
+    const uint64_t* channel_bits,
+    const unsigned int num_words,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  unsigned int i = begin;
+  for (; i + 16 <= end; i += 16) {
+    __m256i low = _mm256_setzero_si256();
+    __m256i high = _mm256_setzero_si256();
+    for (unsigned int word = 0; word < num_words; word++) {
+      for (uint64_t bits = channel_bits[word]; bits != 0; bits &= bits - 1) {
+        const __m128i w = _mm_loadu_si128((const __m128i*)
+            (column_of(weights, column_stride, word * 64, bits) + i));
+        low = _mm256_add_epi32(low, _mm256_cvtepi8_epi32(w));
+        high = _mm256_add_epi32(
+            high, _mm256_cvtepi8_epi32(_mm_srli_si128(w, 8)));
+      }
+    }
+    // Packing works within 128-bit lanes, so restore the neuron order.
+    apply_inputs_avx2(
+        _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8),
+        i,
+        timestamp,
+        states,
+        outputs);
+  }
+  spike_frame_sse42(
+      weights,
+      column_stride,
+      channel_bits,
+      num_words,
+      i,
+      end,
+      timestamp,
+      states,
+      outputs);
+}
+
+// Applies the inputs of neurons [i, i + 32).
+__attribute__((target("avx512f,avx512bw")))
+static inline void apply_inputs_avx512(
+    const __m512i w,
+    const unsigned int i,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  int16_t* activation_levels = states->activation_levels.data();
+  Tick* end_times = states->refractory_period_end_times.data();
+  const Tick* durations = states->refractory_durations.data();
+  const __m512i t = _mm512_set1_epi64(timestamp);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i max_level = _mm512_set1_epi16(127);
+
+  const __m512i a = _mm512_loadu_si512(activation_levels + i);
+  __mmask32 active = 0;
+  for (unsigned int j = 0; j < 4; j++) {
+    active |= (__mmask32) _mm512_cmp_epi64_mask(
+        t, _mm512_loadu_si512(end_times + i + 8 * j), _MM_CMPINT_NLT)
+        << (8 * j);
+  }
+  const __m512i sum = _mm512_adds_epi16(a, w);
+  const __mmask32 fire = _mm512_mask_cmpgt_epi16_mask(active, sum, max_level);
+  _mm512_storeu_si512(
+      activation_levels + i,
+      _mm512_mask_mov_epi16(
+          a, active, _mm512_maskz_max_epi16(~fire, sum, zero)));
+  if (fire != 0) {
+    // Start the refractory periods with masked stores, then emit the
+    // output channels of the set bits.
+    for (unsigned int j = 0; j < 4; j++) {
+      _mm512_mask_storeu_epi64(
+          end_times + i + 8 * j,
+          (__mmask8) (fire >> (8 * j)),
+          _mm512_add_epi64(t, _mm512_loadu_si512(durations + i + 8 * j)));
+    }
+    for (uint32_t mask = fire; mask != 0; mask &= mask - 1) {
+      outputs->push_back(states->output_channels[i + __builtin_ctz(mask)]);
+    }
+  }
+}
+
+// Applies a spike to neurons [begin, end), thirty-two at a time.
+__attribute__((target("avx512f,avx512bw")))
+static void spike_avx512(
+    const int8_t* column,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  unsigned int i = begin;
+  for (; i + 32 <= end; i += 32) {
+    apply_inputs_avx512(
+        _mm512_cvtepi8_epi16(
+            _mm256_loadu_si256((const __m256i*) (column + i))),
+        i,
+        timestamp,
+        states,
+        outputs);
+  }
+  spike_avx2(column, i, end, timestamp, states, outputs);
+}
+
+// Applies a frame to neurons [begin, end), thirty-two at a time.
+__attribute__((target("avx512f,avx512bw")))
+static void spike_frame_avx512(
+    const int8_t* weights,
+    const size_t column_stride,
+    const uint64_t* channel_bits,
+    const unsigned int num_words,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  unsigned int i = begin;
+  for (; i + 32 <= end; i += 32) {
+    __m512i low = _mm512_setzero_si512();
+    __m512i high = _mm512_setzero_si512();
+    for (unsigned int word = 0; word < num_words; word++) {
+      for (uint64_t bits = channel_bits[word]; bits != 0; bits &= bits - 1) {
+        const int8_t* column =
+            column_of(weights, column_stride, word * 64, bits) + i;
+        low = _mm512_add_epi32(low, _mm512_cvtepi8_epi32(
+            _mm_loadu_si128((const __m128i*) column)));
+        high = _mm512_add_epi32(high, _mm512_cvtepi8_epi32(
+            _mm_loadu_si128((const __m128i*) (column + 16))));
+      }
+    }
+    apply_inputs_avx512(
+        _mm512_inserti64x4(
+            _mm512_castsi256_si512(_mm512_cvtsepi32_epi16(low)),
+            _mm512_cvtsepi32_epi16(high),
+            1),
+        i,
+        timestamp,
+        states,
+        outputs);
+  }
+  spike_frame_avx2(
+      weights,
+      column_stride,
+      channel_bits,
+      num_words,
+      i,
+      end,
+      timestamp,
+      states,
+      outputs);
+}
+
+// A kernel and the CPU features it requires.
+struct KernelInfo {
+  const char* name;
+  SpikeKernel kernel;
+  FrameKernel frame_kernel;
+  bool (*is_supported)();
+};
+
+static bool is_avx512_supported() {
+  return __builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512bw");
+}
+
+static bool is_avx2_supported() {
+  return __builtin_cpu_supports("avx2");
+}
+
+static bool is_sse42_supported() {
+  return __builtin_cpu_supports("sse4.2");
+}
+
+static bool is_always_supported() {
+  return true;
+}
+
+// The kernels, from most to least preferred.
+static const KernelInfo KERNELS[] = {
+  {"avx512", spike_avx512, spike_frame_avx512, is_avx512_supported},
+  {"avx2", spike_avx2, spike_frame_avx2, is_avx2_supported},
+  {"sse4.2", spike_sse42, spike_frame_sse42, is_sse42_supported},
+  {"scalar", spike_scalar, spike_frame_scalar, is_always_supported},
+};
+
+// Returns the most preferred kernel that the CPU supports.
+static const KernelInfo* select_best_kernel() {
+  __builtin_cpu_init();
+  for (const KernelInfo& info : KERNELS) {
+    if (info.is_supported()) {
+      return &info;
+    }
+  }
+  return nullptr;  // Not reached, scalar is always supported.
+}
+
+// The selected kernel.
+static const KernelInfo* selected_kernel = select_best_kernel();
+
+void spike_neuron_range(
+    const int8_t* column,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  selected_kernel->kernel(column, begin, end, timestamp, states, outputs);
+}
+
+void spike_frame_neuron_range(
+    const int8_t* weights,
+    const size_t column_stride,
+    const uint64_t* channel_bits,
+    const unsigned int num_words,
+    const unsigned int begin,
+    const unsigned int end,
+    const Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs
+) {
+  selected_kernel->frame_kernel(
+      weights,
+      column_stride,
+      channel_bits,
+      num_words,
+      begin,
+      end,
+      timestamp,
+      states,
+      outputs);
+}
+
+const char* spike_kernel_name() {
+  return selected_kernel->name;
+}
+
+bool select_spike_kernel(const char* name) {
+  for (const KernelInfo& info : KERNELS) {
+    if (strcmp(info.name, name) == 0) {
+      if (!info.is_supported()) {
+        return false;
+      }
+      selected_kernel = &info;
+      return true;
+    }
+  }
+  return false;
+}
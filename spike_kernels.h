@@ -0,0 +1,48 @@
+#ifndef _spike_kernels_h
+#define _spike_kernels_h
+
+#include "neuron_states.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Applies a spike to neurons [begin, end), whose weights on the spiking
+// channel are column[begin] to column[end - 1].
+// Applies the same rule as Neuron::spike() to every neuron, and appends the
+// output channels of the neurons that fire, in neuron order.
+// The work is done by a SIMD kernel selected for the CPU at runtime.
+void spike_neuron_range(
+    const int8_t* column,
+    unsigned int begin,
+    unsigned int end,
+    Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs);
+
+// Applies a frame of spikes to neurons [begin, end). Each neuron takes the sum
+// of its weights on the channels set in the bitset of num_words words, where
+// channel c's weights start at weights[c * column_stride].
+// Applies the same rule as NeuronStates::apply_input() to every neuron, and
+// appends the output channels of the neurons that fire, in neuron order.
+// The work is done by a SIMD kernel selected for the CPU at runtime.
+void spike_frame_neuron_range(
+    const int8_t* weights,
+    size_t column_stride,
+    const uint64_t* channel_bits,
+    unsigned int num_words,
+    unsigned int begin,
+    unsigned int end,
+    Tick timestamp,
+    NeuronStates* states,
+    std::vector<uint16_t>* outputs);
+
+// Returns the name of the kernels used by spike_neuron_range() and
+// spike_frame_neuron_range().
+const char* spike_kernel_name();
+
+// Selects a kernel by name: "scalar", "sse4.2", "avx2" or "avx512".
+// Returns false if the name isn't recognized or the CPU doesn't support it.
+bool select_spike_kernel(const char* name);
+
+#endif // _spike_kernels_h
@@ -0,0 +1,29 @@
+#ifndef _spike_outputs_h
+#define _spike_outputs_h
+
+#include <cstdint>
+#include <vector>
+
+// The output channels produced by a batch of spikes, stored in two flat
+// arrays so that a batch needs no allocation per spike.
+// The outputs of spike i are channels[offsets[i]] to
+// channels[offsets[i + 1] - 1].
+struct SpikeOutputs {
+  // The index of each spike's first output channel, plus a final element
+  // holding the total number of output channels.
+  std::vector<unsigned int> offsets = {0};
+
+  // The output channels of all the spikes, in spike order.
+  std::vector<uint16_t> channels;
+
+  // Returns the number of spikes.
+  unsigned int spike_count() const { return offsets.size() - 1; }
+
+  // Removes all the spikes, keeping the allocated storage.
+  void clear() {
+    offsets.resize(1);
+    channels.clear();
+  }
+};
+
+#endif // _spike_outputs_h
@@ -1,18 +1,137 @@
 #include "spike_queue.h"
 
-void SpikeQueue::add(const float timestamp, const uint16_t channel) {
-  if (scheduled_spikes.empty()
-      || timestamp >= scheduled_spikes.back().timestamp) {
-    scheduled_spikes.push_back({timestamp, channel});
-  } else if (timestamp < scheduled_spikes.front().timestamp) {
-    scheduled_spikes.push_front({timestamp, channel});
-  } else {
-    for (auto it = scheduled_spikes.rbegin(); it != scheduled_spikes.rend();
-        ++it) {
-      if (timestamp >= (*it).timestamp) {
-        scheduled_spikes.insert(it.base(), {timestamp, channel});
-        break;
+#include <algorithm>
+
+SpikeQueue::SpikeQueue(const Parameters& parameters) :
+  bucket_width(std::max<Tick>(parameters.MIN_SPIKE_INTERVAL_TICKS, 1)),
+  num_spikes(0),
+  next_sequence(0),
+  next_bucket(0),
+  wheel_counts()
+{
+  for (int level = 0; level < LEVEL_COUNT; level++) {
+    wheels[level].resize(SLOT_COUNT);
+  }
+}
+
+void SpikeQueue::add(const Tick timestamp, const uint16_t channel) {
+  if (num_spikes == 0) {
+    // Start the wheels at this spike, so that it becomes current.
+    next_bucket = bucket_of(timestamp) + 1;
+  }
+  num_spikes++;
+  place({{timestamp, channel}, next_sequence++});
+}
+
+void SpikeQueue::pop() {
+  current_spikes.pop_front();
+  num_spikes--;
+  if (current_spikes.empty() && num_spikes > 0) {
+    refill();
+  }
+}
+
+void SpikeQueue::place(const Entry& entry) {
+  const Tick bucket = bucket_of(entry.spike.timestamp);
+  if (bucket < next_bucket) {
+    // Insert into the current spikes after any with the same time. These
+    // spikes are usually near the back.
+    auto it = current_spikes.end();
+    while (it != current_spikes.begin()
+        && (it - 1)->spike.timestamp > entry.spike.timestamp) {
+      --it;
+    }
+    current_spikes.insert(it, entry);
+    return;
+  }
+
+  // Use the finest wheel that reaches the bucket.
+  const Tick distance = bucket - next_bucket;
+  for (int level = 0; level < LEVEL_COUNT; level++) {
+    if (distance < (Tick) 1 << ((level + 1) * SLOT_BITS)) {
+      const unsigned int slot =
+          (bucket >> (level * SLOT_BITS)) & (SLOT_COUNT - 1);
+      wheels[level][slot].push_back(entry);
+      wheel_counts[level]++;
+      return;
+    }
+  }
+  overflow.push_back(entry);
+}
+
+void SpikeQueue::cascade(const int level, const unsigned int slot) {
+  std::vector<Entry> entries;
+  entries.swap(wheels[level][slot]);
+  wheel_counts[level] -= entries.size();
+  for (const Entry& entry : entries) {
+    place(entry);
+  }
+}
+
+void SpikeQueue::enter_bucket(const Tick bucket) {
+  next_bucket = bucket;
+
+  // Coarse slots that start at this bucket cascade before finer ones, since
+  // they may refill them.
+  for (int level = LEVEL_COUNT - 1; level > 0; level--) {
+    const int shift = level * SLOT_BITS;
+    if ((bucket & (((Tick) 1 << shift) - 1)) != 0) {
+      continue;
+    }
+    if (level == LEVEL_COUNT - 1 && !overflow.empty()) {
+      std::vector<Entry> entries;
+      entries.swap(overflow);
+      for (const Entry& entry : entries) {
+        place(entry);
       }
     }
+    cascade(level, (bucket >> shift) & (SLOT_COUNT - 1));
+  }
+}
+
+void SpikeQueue::refill() {
+  while (current_spikes.empty()) {
+    // Find the finest wheel holding any spikes, and skip to the start of its
+    // next slot if the finer wheels are empty.
+    int level = 0;
+    while (level < LEVEL_COUNT && wheel_counts[level] == 0) {
+      level++;
+    }
+    if (level == LEVEL_COUNT) {
+      // Only the overflow list is left, so restart the wheels at its
+      // earliest spike.
+      Tick earliest = overflow.front().spike.timestamp;
+      for (const Entry& entry : overflow) {
+        earliest = std::min(earliest, entry.spike.timestamp);
+      }
+      next_bucket = bucket_of(earliest);
+      std::vector<Entry> entries;
+      entries.swap(overflow);
+      for (const Entry& entry : entries) {
+        place(entry);
+      }
+      continue;
+    }
+    if (level > 0) {
+      const Tick slot_size = (Tick) 1 << (level * SLOT_BITS);
+      enter_bucket((next_bucket & ~(slot_size - 1)) + slot_size);
+      continue;
+    }
+
+    // Sort the next bucket into the current spikes.
+    std::vector<Entry>& entries =
+        wheels[0][next_bucket & (SLOT_COUNT - 1)];
+    wheel_counts[0] -= entries.size();
+    std::sort(
+        entries.begin(),
+        entries.end(),
+        [](const Entry& a, const Entry& b) {
+          return a.spike.timestamp < b.spike.timestamp
+              || (a.spike.timestamp == b.spike.timestamp
+                  && a.sequence < b.sequence);
+        });
+    current_spikes.insert(current_spikes.end(), entries.begin(), entries.end());
+    entries.clear();
+    enter_bucket(next_bucket + 1);
   }
 }
@@ -1,28 +1,111 @@
 #ifndef _spike_queue_h
 #define _spike_queue_h
 
+#include "parameters.h"
 #include "scheduled_spike.h"
+#include "spike_source.h"
 
 #include <deque>
+#include <vector>
 
 // Maintains a queue of scheduled spikes, ordered by scheduled time.
-class SpikeQueue {
+// Spikes with the same time are provided in the order they were added.
+// The queue is a hierarchical timing wheel, so adding and removing spikes
+// takes constant amortized time however far ahead they're scheduled.
+// Spikes are binned into buckets of time, and only the current bucket is
+// sorted. Later buckets live in wheels of increasingly coarse resolution,
+// and are cascaded into finer wheels as time reaches them.
+class SpikeQueue : public SpikeSource {
   public:
+    // Constructor.
+    // The finest buckets are the minimum spike interval wide.
+    SpikeQueue(const Parameters& parameters);
+
+    // Disable the copy constructor.
+    SpikeQueue(const SpikeQueue& spike_queue) = delete;
+
     // Schedules a spike at the specified time.
-    void add(float timestamp, uint16_t channel);
+    void add(Tick timestamp, uint16_t channel);
 
     // Returns true if there are no scheduled spikes.
-    bool empty() const { return scheduled_spikes.empty(); }
+    bool empty() const { return num_spikes == 0; }
 
     // Returns a reference to the next scheduled spike.
-    const ScheduledSpike& front() const { return scheduled_spikes.front(); }
+    const ScheduledSpike& front() const { return current_spikes.front().spike; }
+
+    // Removes the first scheduled spike.
+    void pop();
+
+    // Returns a pointer to the next scheduled spike, or null if there are
+    // none.
+    const ScheduledSpike* peek_next() const override {
+      return empty() ? nullptr : &front();
+    }
 
     // Removes the first scheduled spike.
-    void pop() { scheduled_spikes.pop_front(); }
+    void advance() override { pop(); }
+
+    // Spikes can be added at any time.
+    bool is_mutable() const override { return true; }
 
   private:
-    // The scheduled spikes.
-    std::deque<ScheduledSpike> scheduled_spikes;
+    // A scheduled spike, and the order in which it was added.
+    struct Entry {
+      ScheduledSpike spike;
+      uint64_t sequence;
+    };
+
+    // The log2 of the number of slots in each wheel.
+    static constexpr int SLOT_BITS = 8;
+
+    // The number of slots in each wheel.
+    static constexpr unsigned int SLOT_COUNT = 1 << SLOT_BITS;
+
+    // The number of wheels. Together they span 2^32 buckets, and anything
+    // further ahead waits in the overflow list.
+    static constexpr int LEVEL_COUNT = 4;
+
+    // The width of a bucket in the finest wheel, in ticks.
+    const Tick bucket_width;
+
+    // The number of scheduled spikes.
+    unsigned int num_spikes;
+
+    // The sequence number of the next spike added.
+    uint64_t next_sequence;
+
+    // The index of the next bucket to be sorted into current_spikes.
+    // Earlier buckets have been taken from the wheels.
+    Tick next_bucket;
+
+    // The spikes in buckets before next_bucket, in time order.
+    // Never empty while there are scheduled spikes.
+    std::deque<Entry> current_spikes;
+
+    // wheels[level][slot] holds the spikes of bucket b in
+    // slot (b >> (level * SLOT_BITS)) % SLOT_COUNT.
+    std::vector<std::vector<Entry>> wheels[LEVEL_COUNT];
+
+    // The number of spikes in each wheel.
+    unsigned int wheel_counts[LEVEL_COUNT];
+
+    // Spikes too far ahead for the wheels.
+    std::vector<Entry> overflow;
+
+    // Returns the bucket containing the timestamp.
+    Tick bucket_of(Tick timestamp) const { return timestamp / bucket_width; }
+
+    // Places a spike in current_spikes, a wheel or the overflow list.
+    void place(const Entry& entry);
+
+    // Moves a coarse slot's spikes down to finer wheels.
+    void cascade(int level, unsigned int slot);
+
+    // Moves to next_bucket, cascading the slots that start there.
+    void enter_bucket(Tick bucket);
+
+    // Refills current_spikes from the earliest non-empty bucket.
+    void refill();
 };
 
 #endif // _spike_queue_h
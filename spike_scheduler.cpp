@@ -1,230 +1,321 @@
 #include "spike_scheduler.h"
 
+#include <algorithm>
 #include <cmath>
-#include <cstdlib>
-#include <cstring>
-#include <ctime>
 
-bool SpikeScheduler::is_random_seeded = false;
+// The most compiled token templates that are cached. The cache is emptied
+// when it's full, which only a very varied sequence of tokens would cause.
+static constexpr size_t MAX_TEMPLATES = 4096;
 
 SpikeScheduler::SpikeScheduler(
     const uint16_t num_channels_,
-    const Parameters& parameters
+    const Parameters& parameters,
+    const uint64_t seed,
+    const uint32_t stream,
+    const SpikeEncoding encoding_
 ) :
   num_channels(num_channels_),
-  min_spike_interval(parameters.MIN_SPIKE_INTERVAL),
+  encoding(encoding_),
+  min_spike_interval(parameters.MIN_SPIKE_INTERVAL_TICKS),
   spike_fraction(parameters.SPIKE_FRACTION),
-  num_spikes(0),
-  next_scheduled_spike(0),
-  allocated_spikes(0),
-  scheduled_spikes(nullptr)
+  next_spike({0, 0}),
+  next_buffered_spike(0),
+  rng(seed, stream),
+  channel_samples(num_channels_, 0)
 {
 }
 
-SpikeScheduler::~SpikeScheduler() {
-  if (scheduled_spikes != nullptr) {
-    delete[] scheduled_spikes;
-  }
-}
-
-void SpikeScheduler::seed_random_generator() {
-  if (is_random_seeded) {
-    return;
-  }
-  srand48(time(nullptr));
-  is_random_seeded = true;
-}
-
-float SpikeScheduler::calculate_period(const float value) const {
+Tick SpikeScheduler::calculate_period(const float value) const {
   if (value <= spike_fraction) {
     return 0;
   } else if (value > 1) {
     return min_spike_interval;
   } else {
-    return min_spike_interval / value;
+    return llround(min_spike_interval / (double) value);
   }
 }
 
-// Returns the number of spikes when they occur at the specified frequency (in
-// Hertz), for the specified duration (in seconds).
+// Returns the number of spikes when they occur with the specified period, for
+// the specified non-negative duration. Both are in ticks.
 static unsigned int calculate_spike_count(
-    const float period,
-    const float duration
+    const Tick period,
+    const Tick duration
 ) {
-  return 1 + (unsigned int) floorf(duration / period);
-}
-
-// Compares two scheduled spikes by ascending timestamp.
-static int scheduled_spike_cmp(const void* p1, const void* p2) {
-  const ScheduledSpike* ssp1 = (const ScheduledSpike*) p1;
-  const ScheduledSpike* ssp2 = (const ScheduledSpike*) p2;
-  const float diff = ssp1->timestamp - ssp2->timestamp;
-  if (diff < 0) {
-    return -1;
-  } else if (diff > 0) {
-    return 1;
-  } else {
-    return 0;
-  }
+  return 1 + (unsigned int) (duration / period);
 }
 
 void SpikeScheduler::schedule_value(
-    const float start_timestamp,
-    const float duration,
+    const Tick start_timestamp,
+    const Tick duration,
     const uint16_t channel,
     const float value,
     const bool randomize
 ) {
-  if (randomize) {
-    seed_random_generator();
-  }
+  const uint64_t sample = channel_samples[channel]++;
 
   // Calculate the period for encoding the value. Abort if the value can't be
   // encoded.
-  const float period = calculate_period(value);
+  const Tick period = calculate_period(value);
   if (period <= 0) {
     return;
   }
 
+  // Encode the value as the time of a single spike.
+  if (encoding == SpikeEncoding::LATENCY) {
+    const Tick window = latency_window(duration);
+    if (window < 0) {
+      return;
+    }
+    unbuffer_spikes();
+    add_train({
+        start_timestamp + latency_offset(value, window), period, 1, channel});
+    update_next_spike();
+    return;
+  }
+
   // Calculate the time of the first spike. Abort if it doesn't occur during
   // the duration.
-  const float start_offset_fraction = randomize ? (float) drand48() : 0.5f;
-  const float start_offset = start_offset_fraction * period;
+  const double start_offset_fraction =
+      randomize ? rng.uniform(channel, sample) : 0.5;
+  const Tick start_offset = llround(start_offset_fraction * period);
   if (start_offset > duration - min_spike_interval) {
     return;
   }
 
-  // Calculate how many spikes will be added and allocate space for them.
+  // Calculate how many spikes will be added, and add them as a train.
   const unsigned int count = calculate_spike_count(
       period, duration - start_offset - min_spike_interval);
-  allocate_additional_spikes(count);
-
-  float timestamp = start_timestamp + start_offset;
-  for (unsigned int i = 0; i < count; i++) {
-    ScheduledSpike* scheduled_spike = &scheduled_spikes[num_spikes + i];
-    scheduled_spike->timestamp = timestamp;
-    scheduled_spike->channel = channel;
-    timestamp += period;
-  }
-
-  // Sort the spikes by timestamp.
-  num_spikes += count;
-  qsort(
-      scheduled_spikes,
-      num_spikes,
-      sizeof(ScheduledSpike),
-      scheduled_spike_cmp);
+  unbuffer_spikes();
+  add_train({start_timestamp + start_offset, period, count, channel});
+  update_next_spike();
 }
 
 void SpikeScheduler::schedule_embedding(
-    const float start_timestamp,
-    const float duration,
+    const Tick start_timestamp,
+    const Tick duration,
     const uint8_t* embedding,
     const bool randomize
 ) {
-  if (randomize) {
-    seed_random_generator();
+  compile_template(duration, embedding, &embedding_template);
+  schedule_template(
+      start_timestamp,
+      embedding_template,
+      /* is_sorted= */ false,
+      randomize);
+}
+
+void SpikeScheduler::schedule_token(
+    const Tick start_timestamp,
+    const Tick duration,
+    const Token& token,
+    const bool randomize
+) {
+  const uint64_t key = ((uint64_t) duration << 32) | token.id;
+  auto it = templates.find(key);
+  if (it == templates.end()) {
+    if (templates.size() >= MAX_TEMPLATES) {
+      templates.clear();
+    }
+    it = templates.emplace(key, std::vector<TemplateTrain>()).first;
+    compile_template(duration, token.embedding, &it->second);
+
+    // Sort the trains by their fixed phase spikes, which pays for itself
+    // the first time the token is scheduled without random phases.
+    std::sort(
+        it->second.begin(),
+        it->second.end(),
+        [](const TemplateTrain& a, const TemplateTrain& b) {
+          return a.fixed_start_offset < b.fixed_start_offset
+              || (a.fixed_start_offset == b.fixed_start_offset
+                  && a.channel < b.channel);
+        });
   }
+  schedule_template(
+      start_timestamp, it->second, /* is_sorted= */ true, randomize);
+}
 
-  // Pre-calculate the spike count, period, and offset for each channel.
-  float periods[num_channels];
-  float start_offsets[num_channels];
-  unsigned int counts[num_channels];
-  unsigned int total_count = 0;
+void SpikeScheduler::compile_template(
+    const Tick duration,
+    const uint8_t* embedding,
+    std::vector<TemplateTrain>* template_trains
+) const {
+  template_trains->clear();
 
+  // The first spike must leave the minimum interval before the end.
+  const Tick available = duration - min_spike_interval;
+  if (available < 0) {
+    return;
+  }
   for (uint16_t i = 0; i < num_channels; i++) {
-    // Calculate the period for encoding the channel value. Skip if the value
-    // can't be encoded.
-    periods[i] = calculate_period(embedding[i] / 256.0f);
-    if (periods[i] == 0) {
-      counts[i] = 0;
-      start_offsets[i] = 0;
+    // Skip the channel if its value can't be encoded.
+    const float value = embedding[i] / 256.0f;
+    const Tick period = calculate_period(value);
+    if (period == 0) {
       continue;
     }
 
-    // Calculate the time of the first spike. Skip if it doesn't occur during
-    // the duration.
-    const float start_offset_fraction = randomize ? (float) drand48() : 0.5f;
-    start_offsets[i] = start_offset_fraction * periods[i];
-    if (start_offsets[i] > duration - min_spike_interval) {
-      counts[i] = 0;
+    // A LATENCY-encoded value is a train of one spike, at a fixed time.
+    if (encoding == SpikeEncoding::LATENCY) {
+      template_trains->push_back(
+          {period, latency_offset(value, available), available, 0, i});
       continue;
     }
-
-    // Calculate how many spikes will be added.
-    counts[i] = calculate_spike_count(
-        periods[i], duration - start_offsets[i] - min_spike_interval);
-    total_count += counts[i];
+    template_trains->push_back(
+        {period,
+         llround(0.5 * period),
+         available % period,
+         (unsigned int) (available / period),
+         i});
   }
-  if (total_count == 0) {
-    return;
-  }
-  allocate_additional_spikes(total_count);
+}
 
-  unsigned int ssidx = num_spikes;
-  for (uint16_t i = 0; i < num_channels; i++) {
-    const unsigned int count = counts[i];
-    if (count == 0) {
+void SpikeScheduler::schedule_template(
+    const Tick start_timestamp,
+    const std::vector<TemplateTrain>& template_trains,
+    const bool is_sorted,
+    const bool randomize
+) {
+  // Every channel counts as sampled, spiking or not, so that the random
+  // phases don't depend on the other values scheduled.
+  const bool random_phases = randomize && encoding == SpikeEncoding::RATE;
+  size_t first_train = 0;
+  bool is_unbuffered = false;
+  for (const TemplateTrain& template_train : template_trains) {
+    const uint16_t i = template_train.channel;
+
+    // Calculate the time of the first spike, and the number of spikes,
+    // 1 + (available - start_offset) / period. Skip the channel if its
+    // first spike doesn't occur during the duration.
+    const Tick start_offset = random_phases
+        ? llround(rng.uniform(i, channel_samples[i]) * template_train.period)
+        : template_train.fixed_start_offset;
+    unsigned int count = template_train.quotient;
+    if (start_offset <= template_train.remainder) {
+      count++;
+    } else if (count == 0) {
       continue;
     }
-    const float period = periods[i];
-    float timestamp = start_timestamp + start_offsets[i];
-    for (unsigned int j = 0; j < count; j++) {
-      scheduled_spikes[ssidx].timestamp = timestamp;
-      scheduled_spikes[ssidx].channel = i;
-      timestamp += period;
-      ssidx++;
+
+    // Add the train, and restore the heap once rather than once per train.
+    if (!is_unbuffered) {
+      unbuffer_spikes();
+      is_unbuffered = true;
+      first_train = trains.size();
     }
+    trains.push_back(
+        {start_timestamp + start_offset, template_train.period, count, i});
+  }
+  for (uint64_t& sample : channel_samples) {
+    sample++;
+  }
+  if (!is_unbuffered) {
+    return;
   }
 
-  next_scheduled_spike = 0;
-  num_spikes = ssidx;
-
-  // Sort the spikes by timestamp.
-  qsort(
-      scheduled_spikes,
-      num_spikes,
-      sizeof(ScheduledSpike),
-      scheduled_spike_cmp);
+  // Trains in the order of their fixed phase spikes need no reordering if
+  // there were no others.
+  if (random_phases || !is_sorted || first_train > 0) {
+    std::make_heap(trains.begin(), trains.end(), is_later);
+  }
+  update_next_spike();
 }
 
-const ScheduledSpike* SpikeScheduler::peek_next() const {
-  return next_scheduled_spike < num_spikes
-      ? &scheduled_spikes[next_scheduled_spike] : nullptr;
+void SpikeScheduler::advance() {
+  if (next_buffered_spike < buffered_spikes.size()) {
+    next_buffered_spike++;
+    return;
+  }
+  if (!trains.empty()) {
+    advance_trains();
+  }
 }
 
-// Returns a value greater than the requested size, and a power of two.
-static unsigned int add_headroom(const unsigned int requested_size) {
-  unsigned int n = 64;
-  while (n <= requested_size) {
-    n <<= 1;
+const ScheduledSpike* SpikeScheduler::peek_remaining(unsigned int* count) {
+  // Drain the trains into the buffer after any unconsumed spikes.
+  if (next_buffered_spike == buffered_spikes.size()) {
+    buffered_spikes.clear();
+    next_buffered_spike = 0;
   }
-  return n;
+  while (!trains.empty()) {
+    buffered_spikes.push_back(next_spike);
+    advance_trains();
+  }
+  *count = buffered_spikes.size() - next_buffered_spike;
+  return buffered_spikes.data() + next_buffered_spike;
 }
 
-void SpikeScheduler::allocate_additional_spikes(const unsigned int n) {
-  if (next_scheduled_spike > 0) {
-    // Delete consumed spikes.
-    memmove(
-        scheduled_spikes,
-        scheduled_spikes + next_scheduled_spike, 
-        (num_spikes - next_scheduled_spike) * sizeof(ScheduledSpike));
-    num_spikes -= next_scheduled_spike;
-    next_scheduled_spike = 0;
+void SpikeScheduler::advance(const unsigned int n) {
+  for (unsigned int i = 0; i < n; i++) {
+    advance();
   }
-  if (allocated_spikes >= num_spikes + n) {
-    // Enough space is already available.
-    return;
+}
+
+unsigned int SpikeScheduler::skip_until(const Tick timestamp) {
+  unsigned int num_skipped = 0;
+  while (next_buffered_spike < buffered_spikes.size()
+      && buffered_spikes[next_buffered_spike].timestamp < timestamp) {
+    next_buffered_spike++;
+    num_skipped++;
   }
-  // Allocate a new array and copy the existing spikes across.
-  const unsigned int new_size = add_headroom(num_spikes + n);
-  ScheduledSpike* new_spikes = new ScheduledSpike[new_size];
-  if (scheduled_spikes != nullptr) {
-    if (num_spikes > 0) {
-      memcpy(new_spikes, scheduled_spikes, num_spikes * sizeof(ScheduledSpike));
+
+  // Move each train on to its first spike at or after the timestamp, and
+  // drop the trains that have none.
+  size_t num_trains = 0;
+  for (SpikeTrain& train : trains) {
+    if (train.next_timestamp < timestamp) {
+      const unsigned int n = train.period == 0
+          ? train.remaining
+          : std::min<Tick>(
+              train.remaining,
+              (timestamp - train.next_timestamp + train.period - 1)
+                  / train.period);
+      train.remaining -= n;
+      train.next_timestamp += n * train.period;
+      num_skipped += n;
+    }
+    if (train.remaining > 0) {
+      trains[num_trains++] = train;
     }
-    delete[] scheduled_spikes;
   }
-  scheduled_spikes = new_spikes;
-  allocated_spikes = new_size;
+  trains.resize(num_trains);
+  std::make_heap(trains.begin(), trains.end(), is_later);
+  update_next_spike();
+  return num_skipped;
+}
+
+bool SpikeScheduler::is_later(const SpikeTrain& a, const SpikeTrain& b) {
+  return a.next_timestamp > b.next_timestamp
+      || (a.next_timestamp == b.next_timestamp && a.channel > b.channel);
+}
+
+void SpikeScheduler::advance_trains() {
+  // Move the earliest train on to its next spike, if it has one.
+  std::pop_heap(trains.begin(), trains.end(), is_later);
+  SpikeTrain& train = trains.back();
+  if (--train.remaining > 0) {
+    train.next_timestamp += train.period;
+    std::push_heap(trains.begin(), trains.end(), is_later);
+  } else {
+    trains.pop_back();
+  }
+  update_next_spike();
+}
+
+void SpikeScheduler::add_train(const SpikeTrain& train) {
+  trains.push_back(train);
+  std::push_heap(trains.begin(), trains.end(), is_later);
+}
+
+void SpikeScheduler::unbuffer_spikes() {
+  for (unsigned int i = next_buffered_spike; i < buffered_spikes.size(); i++) {
+    add_train({buffered_spikes[i].timestamp, 0, 1, buffered_spikes[i].channel});
+  }
+  buffered_spikes.clear();
+  next_buffered_spike = 0;
+}
+
+void SpikeScheduler::update_next_spike() {
+  if (!trains.empty()) {
+    next_spike = {trains.front().next_timestamp, trains.front().channel};
+  }
 }
@@ -1,80 +1,214 @@
 #ifndef _spike_scheduler_h
 #define _spike_scheduler_h
 
+#include "counter_rng.h"
 #include "parameters.h"
 #include "scheduled_spike.h"
+#include "spike_encoding.h"
+#include "spike_source.h"
+#include "token.h"
+
+#include <unordered_map>
+#include <vector>
 
 // A scheduler for spikes.
-class SpikeScheduler {
+// Each scheduled value is a periodic train of spikes on one channel, so
+// rather than generating and sorting every spike, the trains are kept in a
+// heap and merged lazily. Memory is proportional to the number of trains.
+// Simultaneous spikes are provided in channel order.
+class SpikeScheduler : public SpikeSource {
   public:
     // Constructor.
-    SpikeScheduler(uint16_t num_channels, const Parameters& parameters);
+    // Randomized spike timings come from the seed and stream, so schedulers
+    // with the same seed and stream schedule the same spikes.
+    SpikeScheduler(
+        uint16_t num_channels,
+        const Parameters& parameters,
+        uint64_t seed,
+        uint32_t stream,
+        SpikeEncoding encoding = SpikeEncoding::RATE);
 
     // Disable the copy constructor.
     SpikeScheduler(const SpikeScheduler& spike_scheduler) = delete;
 
-    // Destructor.
-    ~SpikeScheduler();
-
     // Converts a [0-1] value into time-ordered spikes on a channel.
-    // The start timestamp and duration are both expressed in seconds.
+    // If randomized, the phase of the spikes comes from the random number
+    // for the channel and the number of values previously scheduled on it.
+    // LATENCY-encoded spikes aren't randomized, as their time is their value.
+    // The start timestamp and duration are both expressed in ticks.
     void schedule_value(
-        float start_timestamp,
-        float duration,
+        Tick start_timestamp,
+        Tick duration,
         uint16_t channel,
         float value,
         bool randomize);
 
     // Converts an embedding into a time-ordered sequence of spikes.
-    // The start timestamp and duration are both expressed in seconds.
+    // The start timestamp and duration are both expressed in ticks.
     void schedule_embedding(
-        float start_timestamp,
-        float duration,
+        Tick start_timestamp,
+        Tick duration,
         const uint8_t* embedding,
         bool randomize);
 
+    // Converts a token's embedding into a time-ordered sequence of spikes,
+    // exactly as schedule_embedding() would. The spike trains of each token
+    // and duration are compiled once and cached, so scheduling a token again
+    // only draws the random phases and shifts the trains to the start.
+    void schedule_token(
+        Tick start_timestamp,
+        Tick duration,
+        const Token& token,
+        bool randomize);
+
     // Returns a pointer to the next scheduled spike, or null if the are none.
-    const ScheduledSpike* peek_next() const;
+    // The pointer is valid until the scheduler is next modified.
+    const ScheduledSpike* peek_next() const override {
+      return next_buffered_spike < buffered_spikes.size()
+          ? &buffered_spikes[next_buffered_spike]
+          : (trains.empty() ? nullptr : &next_spike);
+    }
 
     // Advances to the next scheduled spike.
-    void advance() { next_scheduled_spike++; }
+    void advance() override;
+
+    // Returns a pointer to the remaining scheduled spikes, which are
+    // contiguous and time-ordered, and sets their count.
+    // The spikes are generated into a buffer, so this costs memory in
+    // proportion to the number of spikes, which the lazy peek_next() and
+    // advance() avoid.
+    const ScheduledSpike* peek_remaining(unsigned int* count);
+
+    // Advances past the specified number of scheduled spikes.
+    void advance(unsigned int n);
+
+    // Returns the window of a duration in which LATENCY-encoded spikes fall,
+    // which leaves the minimum interval before the end, as rate-encoded
+    // spikes do.
+    Tick latency_window(const Tick duration) const {
+      return duration - min_spike_interval;
+    }
+
+    // Discards the scheduled spikes before the timestamp, and returns their
+    // number. The trains are moved on arithmetically, so skipping costs
+    // nothing per discarded spike.
+    unsigned int skip_until(Tick timestamp);
 
   private:
+    // A periodic train of spikes on one channel.
+    struct SpikeTrain {
+      // The time of the next spike.
+      Tick next_timestamp;
+
+      // The interval between spikes.
+      Tick period;
+
+      // The number of spikes remaining, including the next one.
+      unsigned int remaining;
+
+      // The channel.
+      uint16_t channel;
+    };
+
+    // A channel's spike train in a compiled embedding, relative to the start
+    // of the duration. The number of spikes depends on the phase of the
+    // first: the quotient and remainder of the time available for spikes,
+    // divided by the period, give it without a division.
+    struct TemplateTrain {
+      // The interval between spikes.
+      Tick period;
+
+      // The time of the first spike when the phase isn't randomized.
+      Tick fixed_start_offset;
+
+      // The remainder of the time available divided by the period.
+      Tick remainder;
+
+      // The quotient of the time available divided by the period.
+      unsigned int quotient;
+
+      // The channel.
+      uint16_t channel;
+    };
+
     // The number of channels.
     const uint16_t num_channels;
 
-    // The shortest interval between spikes.
-    const float min_spike_interval;
+    // How values are encoded.
+    const SpikeEncoding encoding;
+
+    // The shortest interval between spikes, in ticks.
+    const Tick min_spike_interval;
 
     // The incremental value of a spike, somewhere between zero and one.
     // The value will be incremented by this fraction of the distance to one.
     const float spike_fraction;
 
-    // The number of scheduled spikes.
-    unsigned int num_spikes;
+    // A min-heap of the spike trains with spikes remaining, ordered by the
+    // timestamp then channel of their next spike.
+    std::vector<SpikeTrain> trains;
+
+    // The next spike of the train at the top of the heap.
+    ScheduledSpike next_spike;
+
+    // Spikes taken from the trains by peek_remaining().
+    std::vector<ScheduledSpike> buffered_spikes;
+
+    // The index of the next spike in buffered_spikes.
+    unsigned int next_buffered_spike;
+
+    // Generates the random phases.
+    const CounterRng rng;
+
+    // The number of values scheduled on each channel, which indexes their
+    // random numbers.
+    std::vector<uint64_t> channel_samples;
 
-    // The index of the next scheduled spike.
-    unsigned int next_scheduled_spike;
+    // The compiled trains of the channels with spikes, by token ID and
+    // duration. They're sorted by their fixed phase spikes, so that without
+    // random phases they form a heap as they are.
+    std::unordered_map<uint64_t, std::vector<TemplateTrain>> templates;
 
-    // The maximum number of spikes that can be stored in the allocated array.
-    unsigned int allocated_spikes;
+    // The compiled trains of the embedding being scheduled, if uncached, in
+    // channel order.
+    std::vector<TemplateTrain> embedding_template;
 
-    // The scheduled spikes.
-    ScheduledSpike* scheduled_spikes;
+    // Compiles the spike trains of an embedding over the duration.
+    void compile_template(
+        Tick duration,
+        const uint8_t* embedding,
+        std::vector<TemplateTrain>* trains) const;
+
+    // Schedules the compiled spike trains of an embedding. If they're sorted
+    // by their fixed phase spikes, the heap needn't be rebuilt when there
+    // are no other trains and the phases aren't randomized.
+    void schedule_template(
+        Tick start_timestamp,
+        const std::vector<TemplateTrain>& template_trains,
+        bool is_sorted,
+        bool randomize);
+
+    // Returns true if train a's next spike comes after train b's. This is
+    // the heap ordering, so the earliest spike is at the top.
+    static bool is_later(const SpikeTrain& a, const SpikeTrain& b);
 
-    // Whether the random number generator has been seeded.
-    static bool is_random_seeded;
+    // Advances the train at the top of the heap past its next spike.
+    // The heap mustn't be empty.
+    void advance_trains();
 
-    // Allocates enough space for the specified number of additional spikes.
-    // Also deletes any previously-consumed spikes.
-    void allocate_additional_spikes(unsigned int n);
+    // Adds a spike train to the heap.
+    void add_train(const SpikeTrain& train);
+
+    // Returns any unconsumed buffered spikes to the heap, so that newly
+    // scheduled spikes are merged with them.
+    void unbuffer_spikes();
+
+    // Sets next_spike from the top of the heap.
+    void update_next_spike();
 
     // Calculates and returns the interval between spikes to represent the
     // value. Returns zero if the value can't be represented.
-    float calculate_period(float value) const;
-
-    // Seeds the random number generator.
-    static void seed_random_generator();
+    Tick calculate_period(float value) const;
 };
 
 #endif // _spike_scheduler_h
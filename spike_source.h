@@ -0,0 +1,26 @@
+#ifndef _spike_source_h
+#define _spike_source_h
+
+#include "scheduled_spike.h"
+
+// A time-ordered sequence of spikes, such as a scheduler, a feedback queue or
+// a recorded trace.
+class SpikeSource {
+  public:
+    // Destructor.
+    virtual ~SpikeSource() {}
+
+    // Returns a pointer to the next spike, or null if there are none.
+    // The pointer is valid until the source is next modified.
+    virtual const ScheduledSpike* peek_next() const = 0;
+
+    // Advances past the next spike.
+    virtual void advance() = 0;
+
+    // Returns true if spikes can be added at any time, so that the next spike
+    // can change without advance() being called. Other sources only change
+    // when advanced.
+    virtual bool is_mutable() const { return false; }
+};
+
+#endif // _spike_source_h
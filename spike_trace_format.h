@@ -0,0 +1,78 @@
+#ifndef _spike_trace_format_h
+#define _spike_trace_format_h
+
+#include <cstdint>
+
+// The layout of a spike trace file, which records a time-ordered sequence of
+// spikes. All fields are little-endian.
+//
+// The file starts with a SpikeTraceHeader, followed by the chunks, followed
+// by the index. Each chunk is a SpikeTraceChunkHeader followed by its
+// spikes, each encoded as the timestamp delta from the previous spike, then
+// the zigzag-encoded channel delta from the previous spike, both as LEB128
+// varints. The first spike of a chunk is relative to the chunk's first
+// timestamp and channel zero, so each chunk can be decoded on its own.
+// The encoded spikes are zero-padded to a multiple of 8 bytes, so that every
+// header stays aligned in a mapped file.
+// The index has a SpikeTraceIndexEntry per chunk, so that a reader can seek
+// by time.
+
+// The magic number at the start of the file.
+static constexpr char SPIKE_TRACE_MAGIC[8] = {
+  'S', 'P', 'K', 'T', 'R', 'A', 'C', 'E'
+};
+
+// The current version of the format.
+static constexpr uint32_t SPIKE_TRACE_VERSION = 1;
+
+// The maximum number of spikes in a chunk.
+static constexpr uint32_t SPIKE_TRACE_CHUNK_SPIKES = 4096;
+
+// The file header.
+struct SpikeTraceHeader {
+  // SPIKE_TRACE_MAGIC.
+  char magic[8];
+
+  // The format version.
+  uint32_t version;
+
+  // The number of channels the spikes are for.
+  uint32_t num_channels;
+
+  // The total number of spikes.
+  uint64_t num_spikes;
+
+  // The number of chunks.
+  uint64_t num_chunks;
+
+  // The file offset of the index, or zero if the writer didn't finish, in
+  // which case the chunks must be walked to find them.
+  uint64_t index_offset;
+};
+
+// The header of a chunk of spikes.
+struct SpikeTraceChunkHeader {
+  // The number of spikes in the chunk.
+  uint32_t num_spikes;
+
+  // The number of bytes of encoded spikes that follow, including padding.
+  uint32_t num_bytes;
+
+  // The timestamp of the first spike.
+  int64_t first_timestamp;
+};
+
+// An entry in the index.
+struct SpikeTraceIndexEntry {
+  // The timestamp of the chunk's first spike.
+  int64_t first_timestamp;
+
+  // The file offset of the chunk's header.
+  uint64_t offset;
+};
+
+static_assert(sizeof(SpikeTraceHeader) == 40, "unexpected header padding");
+static_assert(sizeof(SpikeTraceChunkHeader) == 16, "unexpected chunk padding");
+static_assert(sizeof(SpikeTraceIndexEntry) == 16, "unexpected index padding");
+
+#endif // _spike_trace_format_h
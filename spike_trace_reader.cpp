@@ -0,0 +1,159 @@
+#include "spike_trace_reader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+
+SpikeTraceReader::SpikeTraceReader() :
+  header(nullptr),
+  num_spikes(0),
+  next_spike(0),
+  next_chunk(0)
+{
+}
+
+SpikeTraceReader::~SpikeTraceReader() {
+  close();
+}
+
+bool SpikeTraceReader::open(const char* path) {
+  close();
+  if (!file.open(
+      path,
+      "spike trace",
+      SPIKE_TRACE_MAGIC,
+      SPIKE_TRACE_VERSION,
+      sizeof(SpikeTraceHeader))) {
+    return false;
+  }
+  madvise((void*) file.data(), file.size(), MADV_SEQUENTIAL);
+  header = (const SpikeTraceHeader*) file.data();
+
+  if (!load_index()) {
+    fprintf(stderr, "%s: malformed spike trace\n", path);
+    close();
+    return false;
+  }
+  decode_chunk(0);
+  return true;
+}
+
+void SpikeTraceReader::close() {
+  file.close();
+  header = nullptr;
+  index.clear();
+  num_spikes = 0;
+  chunk_spikes.clear();
+  next_spike = 0;
+  next_chunk = 0;
+}
+
+bool SpikeTraceReader::load_index() {
+  const uint8_t* data = file.data();
+  const size_t size = file.size();
+  if (header->index_offset != 0) {
+    const uint64_t index_size =
+        header->num_chunks * sizeof(SpikeTraceIndexEntry);
+    if (header->index_offset > size
+        || index_size > size - header->index_offset) {
+      return false;
+    }
+    const SpikeTraceIndexEntry* entries =
+        (const SpikeTraceIndexEntry*) (data + header->index_offset);
+    index.assign(entries, entries + header->num_chunks);
+    for (const SpikeTraceIndexEntry& entry : index) {
+      if (entry.offset > header->index_offset - sizeof(SpikeTraceChunkHeader)) {
+        return false;
+      }
+    }
+    num_spikes = header->num_spikes;
+    return true;
+  }
+
+  // The writer didn't finish, so walk the complete chunks, and count their
+  // spikes. A spike takes at least two bytes, so a chunk claiming more is
+  // where the file stops making sense.
+  uint64_t offset = sizeof(SpikeTraceHeader);
+  while (size - offset >= sizeof(SpikeTraceChunkHeader)) {
+    const SpikeTraceChunkHeader* chunk_header =
+        (const SpikeTraceChunkHeader*) (data + offset);
+    const uint64_t chunk_size =
+        sizeof(SpikeTraceChunkHeader) + chunk_header->num_bytes;
+    if (chunk_header->num_spikes == 0
+        || chunk_header->num_spikes > chunk_header->num_bytes / 2
+        || chunk_size > size - offset) {
+      break;
+    }
+    index.push_back({chunk_header->first_timestamp, offset});
+    num_spikes += chunk_header->num_spikes;
+    offset += chunk_size;
+  }
+  return true;
+}
+
+void SpikeTraceReader::advance(const unsigned int n) {
+  next_spike += n;
+  if (next_spike == chunk_spikes.size()) {
+    decode_chunk(next_chunk);
+  }
+}
+
+void SpikeTraceReader::seek(const Tick timestamp) {
+  // Find the last chunk that starts before the timestamp, since its later
+  // spikes may be at or after it.
+  const auto it = std::lower_bound(
+      index.begin(),
+      index.end(),
+      timestamp,
+      [](const SpikeTraceIndexEntry& entry, const Tick t) {
+        return entry.first_timestamp < t;
+      });
+  decode_chunk(it == index.begin() ? 0 : it - index.begin() - 1);
+  while (peek_next() != nullptr && peek_next()->timestamp < timestamp) {
+    advance();
+  }
+}
+
+// Decodes an unsigned LEB128 varint, advancing the pointer past it.
+// Stops at the end of the buffer.
+static inline uint64_t read_varint(const uint8_t** p, const uint8_t* end) {
+  uint64_t value = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    const uint8_t byte = *(*p)++;
+    value |= (uint64_t) (byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      break;
+    }
+  }
+  return value;
+}
+
+void SpikeTraceReader::decode_chunk(const size_t chunk) {
+  chunk_spikes.clear();
+  next_spike = 0;
+  next_chunk = chunk + 1;
+  if (chunk >= index.size()) {
+    return;
+  }
+
+  const uint8_t* data = file.data();
+  const uint64_t offset = index[chunk].offset;
+  const SpikeTraceChunkHeader* chunk_header =
+      (const SpikeTraceChunkHeader*) (data + offset);
+  const uint8_t* p = data + offset + sizeof(SpikeTraceChunkHeader);
+  const uint8_t* end =
+      p + std::min<uint64_t>(chunk_header->num_bytes, file.size() - (p - data));
+  // Bound the count by the bytes, as a spike takes at least two, so a
+  // corrupt count can't cause a huge allocation.
+  chunk_spikes.resize(
+      std::min<uint64_t>(chunk_header->num_spikes, (end - p) / 2));
+  Tick timestamp = chunk_header->first_timestamp;
+  uint16_t channel = 0;
+  for (ScheduledSpike& spike : chunk_spikes) {
+    timestamp += read_varint(&p, end);
+    const uint32_t zigzag = read_varint(&p, end);
+    channel += (uint16_t) ((zigzag >> 1) ^ -(zigzag & 1));
+    spike = {timestamp, channel};
+  }
+}
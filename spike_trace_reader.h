@@ -0,0 +1,99 @@
+#ifndef _spike_trace_reader_h
+#define _spike_trace_reader_h
+
+#include "mapped_file.h"
+#include "spike_source.h"
+#include "spike_trace_format.h"
+
+#include <cstddef>
+#include <vector>
+
+// Reads a spike trace file written by SpikeTraceWriter, as a spike source.
+// The file is memory-mapped, and a chunk at a time is decoded into a
+// contiguous buffer, so that replay costs little more than reading memory.
+class SpikeTraceReader : public SpikeSource {
+  public:
+    // Constructor.
+    SpikeTraceReader();
+
+    // Disable the copy constructor.
+    SpikeTraceReader(const SpikeTraceReader& reader) = delete;
+
+    // Destructor. Unmaps the file.
+    ~SpikeTraceReader();
+
+    // Maps the file and positions the reader at its first spike.
+    // Returns false if the file can't be mapped or isn't a valid trace.
+    bool open(const char* path);
+
+    // Returns the number of channels the spikes are for.
+    uint16_t num_channels() const { return header->num_channels; }
+
+    // Returns the total number of spikes, in the complete chunks if the writer
+    // didn't finish.
+    uint64_t spike_count() const { return num_spikes; }
+
+    // Returns a pointer to the next spike, or null if there are none.
+    const ScheduledSpike* peek_next() const override {
+      return next_spike < chunk_spikes.size()
+          ? &chunk_spikes[next_spike] : nullptr;
+    }
+
+    // Advances to the next spike.
+    void advance() override {
+      if (++next_spike == chunk_spikes.size()) {
+        decode_chunk(next_chunk);
+      }
+    }
+
+    // Returns a pointer to the remaining decoded spikes of the current
+    // chunk, which are contiguous and time-ordered, and sets their count.
+    // The count is zero only at the end of the trace.
+    const ScheduledSpike* peek_chunk(unsigned int* count) const {
+      *count = chunk_spikes.size() - next_spike;
+      return chunk_spikes.data() + next_spike;
+    }
+
+    // Advances past the specified number of spikes, which mustn't exceed the
+    // count returned by peek_chunk().
+    void advance(unsigned int n);
+
+    // Positions the reader at the first spike at or after the timestamp.
+    void seek(Tick timestamp);
+
+  private:
+    // The mapped file.
+    MappedFile file;
+
+    // The header, which is at the start of the mapped file.
+    const SpikeTraceHeader* header;
+
+    // The index of the chunks.
+    std::vector<SpikeTraceIndexEntry> index;
+
+    // The total number of spikes in the chunks.
+    uint64_t num_spikes;
+
+    // The decoded spikes of the current chunk.
+    std::vector<ScheduledSpike> chunk_spikes;
+
+    // The index of the next spike in chunk_spikes.
+    unsigned int next_spike;
+
+    // The index of the chunk after the current one.
+    size_t next_chunk;
+
+    // Unmaps the file.
+    void close();
+
+    // Finds the chunks, either from the index or by walking them if the
+    // writer didn't finish. Returns false if the file is malformed.
+    bool load_index();
+
+    // Decodes a chunk into chunk_spikes, which is left empty if the chunk
+    // doesn't exist. A chunk that claims more spikes than its bytes can hold
+    // is truncated to as many as they can.
+    void decode_chunk(size_t chunk);
+};
+
+#endif // _spike_trace_reader_h
@@ -0,0 +1,137 @@
+#include "spike_trace_writer.h"
+
+#include <cstring>
+#include <limits>
+
+SpikeTraceWriter::SpikeTraceWriter() :
+  fp(nullptr),
+  header(),
+  next_offset(0),
+  chunk_header(),
+  previous_timestamp(std::numeric_limits<Tick>::min()),
+  previous_channel(0)
+{
+}
+
+SpikeTraceWriter::~SpikeTraceWriter() {
+  if (fp != nullptr) {
+    close();
+  }
+}
+
+bool SpikeTraceWriter::open(const char* path, const uint16_t num_channels) {
+  if ((fp = fopen(path, "w")) == nullptr) {
+    fprintf(stderr, "fopen %s: %m\n", path);
+    return false;
+  }
+
+  // Write a provisional header, which close() completes.
+  header = SpikeTraceHeader();
+  memcpy(header.magic, SPIKE_TRACE_MAGIC, sizeof(header.magic));
+  header.version = SPIKE_TRACE_VERSION;
+  header.num_channels = num_channels;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+    fprintf(stderr, "fwrite spike trace header: %m\n");
+    return false;
+  }
+  next_offset = sizeof(header);
+  index.clear();
+  chunk_header = SpikeTraceChunkHeader();
+  chunk_bytes.clear();
+  previous_timestamp = std::numeric_limits<Tick>::min();
+  return true;
+}
+
+// Appends an unsigned LEB128 varint to the bytes.
+static inline void append_varint(uint64_t value, std::vector<uint8_t>* bytes) {
+  while (value >= 0x80) {
+    bytes->push_back((uint8_t) (value | 0x80));
+    value >>= 7;
+  }
+  bytes->push_back((uint8_t) value);
+}
+
+bool SpikeTraceWriter::write(const Tick timestamp, const uint16_t channel) {
+  // Check the order against the last spike written, which may be in an
+  // earlier chunk, before starting a chunk.
+  if (timestamp < previous_timestamp) {
+    fprintf(stderr, "spike trace timestamps out of order\n");
+    return false;
+  }
+  if (chunk_header.num_spikes == 0) {
+    chunk_header.first_timestamp = timestamp;
+    previous_timestamp = timestamp;
+    previous_channel = 0;
+  }
+
+  // Zigzag-encode the channel delta, so small steps either way are short.
+  const int32_t channel_delta = (int32_t) channel - previous_channel;
+  append_varint(timestamp - previous_timestamp, &chunk_bytes);
+  append_varint(
+      ((uint32_t) channel_delta << 1) ^ (uint32_t) (channel_delta >> 31),
+      &chunk_bytes);
+  previous_timestamp = timestamp;
+  previous_channel = channel;
+
+  if (++chunk_header.num_spikes == SPIKE_TRACE_CHUNK_SPIKES) {
+    return flush_chunk();
+  }
+  return true;
+}
+
+bool SpikeTraceWriter::write(
+    const Tick timestamp,
+    const uint16_t* channels,
+    const unsigned int count
+) {
+  for (unsigned int i = 0; i < count; i++) {
+    if (!write(timestamp, channels[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SpikeTraceWriter::flush_chunk() {
+  if (chunk_header.num_spikes == 0) {
+    return true;
+  }
+  // Pad the chunk so the next chunk header, and the index, stay aligned.
+  chunk_bytes.resize((chunk_bytes.size() + 7) & ~(size_t) 7, 0);
+  chunk_header.num_bytes = chunk_bytes.size();
+  if (fwrite(&chunk_header, sizeof(chunk_header), 1, fp) != 1
+      || fwrite(chunk_bytes.data(), 1, chunk_bytes.size(), fp)
+          != chunk_bytes.size()) {
+    fprintf(stderr, "fwrite spike trace chunk: %m\n");
+    return false;
+  }
+  index.push_back({chunk_header.first_timestamp, next_offset});
+  next_offset += sizeof(chunk_header) + chunk_bytes.size();
+  header.num_spikes += chunk_header.num_spikes;
+  header.num_chunks++;
+  chunk_header = SpikeTraceChunkHeader();
+  chunk_bytes.clear();
+  return true;
+}
+
+bool SpikeTraceWriter::close() {
+  bool ok = flush_chunk();
+
+  // Append the index, then complete the header.
+  if (ok) {
+    header.index_offset = next_offset;
+    if (fwrite(index.data(), sizeof(SpikeTraceIndexEntry), index.size(), fp)
+            != index.size()
+        || fseek(fp, 0, SEEK_SET) != 0
+        || fwrite(&header, sizeof(header), 1, fp) != 1) {
+      fprintf(stderr, "fwrite spike trace index: %m\n");
+      ok = false;
+    }
+  }
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "fclose spike trace: %m\n");
+    ok = false;
+  }
+  fp = nullptr;
+  return ok;
+}
@@ -0,0 +1,67 @@
+#ifndef _spike_trace_writer_h
+#define _spike_trace_writer_h
+
+#include "scheduled_spike.h"
+#include "spike_trace_format.h"
+
+#include <cstdio>
+#include <vector>
+
+// Writes a time-ordered sequence of spikes to a spike trace file.
+// See spike_trace_format.h for the format.
+class SpikeTraceWriter {
+  public:
+    // Constructor.
+    SpikeTraceWriter();
+
+    // Disable the copy constructor.
+    SpikeTraceWriter(const SpikeTraceWriter& writer) = delete;
+
+    // Destructor. Closes the file if it's open.
+    ~SpikeTraceWriter();
+
+    // Creates the file, for spikes on the specified number of channels.
+    // Returns false if it can't be created.
+    bool open(const char* path, uint16_t num_channels);
+
+    // Appends a spike. Spikes must be written in time order.
+    // Returns false if the spike is out of order or can't be written.
+    bool write(Tick timestamp, uint16_t channel);
+
+    // Appends spikes that share a timestamp, such as the outputs of a spike.
+    // Returns false if they can't be written.
+    bool write(Tick timestamp, const uint16_t* channels, unsigned int count);
+
+    // Writes any buffered spikes and the index, and closes the file.
+    // Returns false if they can't be written.
+    bool close();
+
+  private:
+    // The file, or null if it isn't open.
+    FILE* fp;
+
+    // The header, updated as spikes are written.
+    SpikeTraceHeader header;
+
+    // The index of the chunks written so far.
+    std::vector<SpikeTraceIndexEntry> index;
+
+    // The file offset at which the next chunk will be written.
+    uint64_t next_offset;
+
+    // The header of the chunk being buffered.
+    SpikeTraceChunkHeader chunk_header;
+
+    // The encoded spikes of the chunk being buffered.
+    std::vector<uint8_t> chunk_bytes;
+
+    // The timestamp and channel of the last spike written.
+    Tick previous_timestamp;
+    uint16_t previous_channel;
+
+    // Writes the buffered chunk to the file.
+    // Returns false if it can't be written.
+    bool flush_chunk();
+};
+
+#endif // _spike_trace_writer_h
@@ -0,0 +1,77 @@
+#include "thread_pool.h"
+
+// How many times an idle worker polls for a new task before sleeping.
+// Tasks tend to arrive in quick succession, one per spike, so polling for a
+// short while avoids the cost of sleeping and being woken for each one.
+static constexpr unsigned int SPIN_COUNT = 4096;
+
+ThreadPool::ThreadPool(const unsigned int num_threads) :
+  task(nullptr),
+  generation(0),
+  num_running(0),
+  is_stopping(false)
+{
+  for (unsigned int i = 1; i < num_threads; i++) {
+    workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_stopping.store(true);
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run(const std::function<void(unsigned int)>& task_) {
+  if (workers.empty()) {
+    task_(0);
+    return;
+  }
+  task = &task_;
+  num_running.store(workers.size(), std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    generation.fetch_add(1, std::memory_order_release);
+  }
+  wake.notify_all();
+
+  task_(0);
+  while (num_running.load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+}
+
+void ThreadPool::work(const unsigned int shard) {
+  uint64_t previous_generation = 0;
+  for (;;) {
+    // Wait for a new task, polling at first and then sleeping.
+    unsigned int spins = 0;
+    while (generation.load(std::memory_order_acquire) == previous_generation
+        && spins < SPIN_COUNT) {
+      std::this_thread::yield();
+      spins++;
+    }
+    if (generation.load(std::memory_order_acquire) == previous_generation) {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] {
+        return is_stopping.load()
+            || generation.load(std::memory_order_acquire)
+                != previous_generation;
+      });
+    }
+    if (is_stopping.load()) {
+      return;
+    }
+
+    // A new task can't start until this one has finished on every shard, so
+    // exactly one generation has passed.
+    previous_generation++;
+    (*task)(shard);
+    num_running.fetch_sub(1, std::memory_order_release);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef _thread_pool_h
+#define _thread_pool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A persistent pool of threads that run a task on every shard of a job.
+// The threads are started once, so each job only pays for waking them.
+class ThreadPool {
+  public:
+    // Constructor. The calling thread counts as one of the threads, so
+    // num_threads - 1 worker threads are started.
+    ThreadPool(unsigned int num_threads);
+
+    // Disable the copy constructor.
+    ThreadPool(const ThreadPool& thread_pool) = delete;
+
+    // Destructor. Stops the worker threads.
+    ~ThreadPool();
+
+    // Returns the number of threads, including the calling thread.
+    unsigned int thread_count() const { return workers.size() + 1; }
+
+    // Calls task(shard) for every shard in [0, thread_count()), and returns
+    // once they have all finished. The calling thread runs shard zero.
+    void run(const std::function<void(unsigned int)>& task);
+
+  private:
+    // The worker threads. Worker i runs shard i + 1.
+    std::vector<std::thread> workers;
+
+    // The task being run.
+    const std::function<void(unsigned int)>* task;
+
+    // Incremented each time a task is started.
+    std::atomic<uint64_t> generation;
+
+    // The number of workers still running the current task.
+    std::atomic<unsigned int> num_running;
+
+    // Whether the workers should exit.
+    std::atomic<bool> is_stopping;
+
+    // Used with the condition variable to wake sleeping workers.
+    std::mutex mutex;
+
+    // Signalled when a task is started or the pool is stopping.
+    std::condition_variable wake;
+
+    // The main loop of a worker thread.
+    void work(unsigned int shard);
+};
+
+#endif // _thread_pool_h
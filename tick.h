@@ -0,0 +1,26 @@
+#ifndef _tick_h
+#define _tick_h
+
+#include <cmath>
+#include <cstdint>
+
+// A time or duration, in ticks of one microsecond.
+// A 64-bit count of microseconds can resolve the shortest spike interval
+// for hundreds of thousands of years, whereas a float in seconds can't
+// resolve 10 ms after about a day.
+typedef int64_t Tick;
+
+// The number of ticks in a second.
+static constexpr Tick TICKS_PER_SECOND = 1000000;
+
+// Converts a time or duration in seconds to the nearest tick.
+inline Tick seconds_to_ticks(const double seconds) {
+  return llround(seconds * TICKS_PER_SECOND);
+}
+
+// Converts a time or duration in ticks to seconds.
+inline double ticks_to_seconds(const Tick ticks) {
+  return (double) ticks / TICKS_PER_SECOND;
+}
+
+#endif // _tick_h
@@ -2,50 +2,35 @@
 #define _token_h
 
 #include <cstdint>
-#include <string>
-#include <vector>
 
 // A token, representing a string and an embedding.
+// A token is a view into a TokenStore, so it's cheap to copy, but is only
+// valid while the store is open.
 class Token {
   public:
-    // Constructor.
+    // Constructor. The text and embedding aren't copied.
     Token(
-        uint16_t id,
+        uint32_t id,
         bool is_suffix,
-        const std::string& text,
+        const char* text,
         const uint8_t* embedding,
-        const uint16_t num_channels);
-
-    // Copy constructor.
-    Token(const Token& token);
-
-    // Destructor.
-    ~Token();
+        uint16_t num_channels);
 
     // The token's ID.
-    const uint16_t id;
+    const uint32_t id;
 
     // Whether the token is a suffix (to be appended to the previous token),
     // or a new word.
     const bool is_suffix;
 
-    // The text string associated with the token.
-    const std::string text;
+    // The NUL-terminated text string associated with the token.
+    const char* const text;
 
     // The number of values in the embedding.
     const uint16_t num_channels;
 
     // The token's embedding.
-    uint8_t* const embedding;
-
-    // Parses the token strings and token embeddings files, returning a list
-    // of tokens.
-    // Returns true if both files are successfully parsed.
-    static bool parse(
-        const char* strings_path,
-        const char* embeddings_path,
-        const uint16_t num_channels,
-        std::vector<Token>* tokens);
+    const uint8_t* const embedding;
 };
 
 #endif // _token_h
@@ -0,0 +1,601 @@
+#include "token_index.h"
+
+#include "counter_rng.h"
+#include "embedding_kernels.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// The number of tokens the lists are trained on per list, and the most they
+// are trained on in all.
+static constexpr unsigned int LIST_SAMPLES_PER_LIST = 32;
+static constexpr unsigned int MAX_LIST_SAMPLES = 65536;
+
+// The most tokens the subspaces are trained on.
+static constexpr unsigned int MAX_PQ_SAMPLES = 2048;
+
+// The number of rows that are assigned to centroids together, which are
+// kept in cache while every centroid is scored against them.
+static constexpr unsigned int ASSIGN_BLOCK_ROWS = 1024;
+
+// The number of k-means iterations.
+static constexpr unsigned int KMEANS_ITERATIONS = 8;
+
+// The default number of lists per square root of the number of tokens.
+static constexpr double DEFAULT_LISTS_PER_ROOT = 4;
+
+// The default number of channels per subspace.
+static constexpr unsigned int DEFAULT_SUBSPACE_CHANNELS = 5;
+
+// The default number of lists per probe, and the fewest probes by default.
+// Lists grow more slowly than the vocabulary, so a fixed fraction of them
+// rather than a fixed number keeps recall from falling as much as it grows.
+static constexpr unsigned int DEFAULT_LISTS_PER_PROBE = 64;
+static constexpr unsigned int MIN_DEFAULT_PROBES = 8;
+
+// The number of candidates scored exactly per probe, and the fewest.
+static constexpr unsigned int CANDIDATES_PER_PROBE = 8;
+static constexpr unsigned int MIN_CANDIDATES = 64;
+
+// The random number stream that the training samples are chosen with.
+static constexpr uint32_t SAMPLE_STREAM = 0;
+
+TokenIndex::TokenIndex(
+    const uint8_t* embeddings_,
+    const unsigned int num_tokens_,
+    const uint16_t num_channels_,
+    const unsigned int num_lists,
+    const unsigned int num_subspaces,
+    const uint64_t seed
+) :
+  embeddings(embeddings_),
+  num_tokens(num_tokens_),
+  num_channels(num_channels_),
+  num_probes(0),
+  num_candidates(0)
+{
+  build(num_lists, num_subspaces, seed);
+  const unsigned int default_probes = std::max(
+      MIN_DEFAULT_PROBES, list_count() / DEFAULT_LISTS_PER_PROBE);
+  set_search_options(
+      default_probes,
+      std::max(MIN_CANDIDATES, default_probes * CANDIDATES_PER_PROBE));
+}
+
+void TokenIndex::set_search_options(
+    const unsigned int num_probes_,
+    const unsigned int num_candidates_
+) {
+  num_probes = std::max(1u, num_probes_);
+  num_candidates = std::max(1u, num_candidates_);
+}
+
+double TokenIndex::tune_search_options(
+    const int16_t* queries,
+    const unsigned int num_queries,
+    const double target_recall
+) {
+  // Find each query's best token by scoring every token. Ties go to the
+  // lowest token, as they do in search().
+  std::vector<int> exact_tokens(num_queries, -1);
+  std::vector<int32_t> scores(num_tokens);
+  for (unsigned int q = 0; q < num_queries; q++) {
+    score_embeddings(
+        embeddings,
+        num_channels,
+        0,
+        num_tokens,
+        &queries[(size_t) q * num_channels],
+        scores.data());
+    if (num_tokens > 0) {
+      exact_tokens[q] =
+          std::max_element(scores.begin(), scores.end()) - scores.begin();
+    }
+  }
+
+  // Double the probes until the target is reached, or every list is probed.
+  for (unsigned int probes = 1; ; probes *= 2) {
+    probes = std::min(probes, list_count());
+    set_search_options(
+        probes, std::max(MIN_CANDIDATES, probes * CANDIDATES_PER_PROBE));
+    unsigned int num_matches = 0;
+    for (unsigned int q = 0; q < num_queries; q++) {
+      int32_t score;
+      num_matches += search(&queries[(size_t) q * num_channels], &score)
+          == exact_tokens[q];
+    }
+    const double recall =
+        num_queries > 0 ? (double) num_matches / num_queries : 1;
+    if (recall >= target_recall || probes == list_count()) {
+      return recall;
+    }
+  }
+}
+
+// Returns the squared distance between two points.
+static inline float distance2(
+    const float* a,
+    const float* b,
+    const unsigned int dims
+) {
+  float sum = 0;
+  for (unsigned int d = 0; d < dims; d++) {
+    const float diff = a[d] - b[d];
+    sum += diff * diff;
+  }
+  return sum;
+}
+
+// Returns the index of the centroid nearest to the point.
+static unsigned int nearest_centroid(
+    const float* point,
+    const float* centroids,
+    const unsigned int k,
+    const unsigned int dims
+) {
+  unsigned int nearest = 0;
+  float nearest_distance = FLT_MAX;
+  for (unsigned int j = 0; j < k; j++) {
+    const float d = distance2(point, centroids + j * dims, dims);
+    if (d < nearest_distance) {
+      nearest_distance = d;
+      nearest = j;
+    }
+  }
+  return nearest;
+}
+
+// Moves each centroid to the mean of its points. Centroids without points
+// stay where they are.
+static void update_centroids(
+    const float* points,
+    const unsigned int n,
+    const unsigned int dims,
+    const unsigned int k,
+    const std::vector<unsigned int>& assignments,
+    float* centroids
+) {
+  std::vector<double> sums((size_t) k * dims, 0);
+  std::vector<unsigned int> counts(k, 0);
+  for (unsigned int i = 0; i < n; i++) {
+    double* sum = &sums[(size_t) assignments[i] * dims];
+    for (unsigned int d = 0; d < dims; d++) {
+      sum[d] += points[(size_t) i * dims + d];
+    }
+    counts[assignments[i]]++;
+  }
+  for (unsigned int j = 0; j < k; j++) {
+    if (counts[j] == 0) {
+      continue;
+    }
+    for (unsigned int d = 0; d < dims; d++) {
+      centroids[(size_t) j * dims + d] =
+          sums[(size_t) j * dims + d] / counts[j];
+    }
+  }
+}
+
+// Clusters n points, with dims values each, into k clusters with Lloyd's
+// algorithm, starting from the first k points, and sets the centroids.
+static void cluster(
+    const float* points,
+    const unsigned int n,
+    const unsigned int dims,
+    const unsigned int k,
+    float* centroids
+) {
+  std::copy(points, points + (size_t) k * dims, centroids);
+  std::vector<unsigned int> assignments(n);
+  for (unsigned int iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+    for (unsigned int i = 0; i < n; i++) {
+      assignments[i] = nearest_centroid(
+          points + (size_t) i * dims, centroids, k, dims);
+    }
+    update_centroids(points, n, dims, k, assignments, centroids);
+  }
+}
+
+// Sets the extra coordinate that each of the rows of a uint8 matrix is given
+// for clustering, sqrt(M^2 - |x - mean|^2), where M is the largest distance
+// of a row from the mean. The distance between two rows extended this way
+// falls as their dot product with any vector rises, so the lists are
+// clustered for ranking by dot product rather than by distance alone, and
+// rows with long embeddings aren't lost in lists with low-scoring centroids.
+static void compute_norm_terms(
+    const uint8_t* rows,
+    const unsigned int n,
+    const uint16_t num_channels,
+    std::vector<float>* norm_terms
+) {
+  std::vector<double> mean(num_channels, 0);
+  for (unsigned int i = 0; i < n; i++) {
+    for (unsigned int c = 0; c < num_channels; c++) {
+      mean[c] += rows[(size_t) i * num_channels + c];
+    }
+  }
+  for (unsigned int c = 0; c < num_channels; c++) {
+    mean[c] /= n;
+  }
+
+  norm_terms->resize(n);
+  float max_norm2 = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    float norm2 = 0;
+    for (unsigned int c = 0; c < num_channels; c++) {
+      const float d = rows[(size_t) i * num_channels + c] - mean[c];
+      norm2 += d * d;
+    }
+    (*norm_terms)[i] = norm2;
+    max_norm2 = std::max(max_norm2, norm2);
+  }
+  for (float& term : *norm_terms) {
+    term = sqrtf(max_norm2 - term);
+  }
+}
+
+// Assigns each of the rows of a uint8 matrix, extended by their norm terms,
+// to its nearest centroid. The distances are found from dot products
+// computed by score_embeddings(), with the centroids rounded to integer
+// weights.
+static void assign_rows(
+    const uint8_t* rows,
+    const float* row_terms,
+    const unsigned int n,
+    const uint16_t num_channels,
+    const float* centroids,
+    const float* centroid_terms,
+    const unsigned int k,
+    std::vector<unsigned int>* assignments
+) {
+  // The largest scale that keeps the sum of the weights within bounds.
+  const float scale = std::min(
+      16.0f, (float) MAX_EMBEDDING_WEIGHT_SUM / (UINT8_MAX * num_channels));
+  std::vector<int16_t> weights((size_t) k * num_channels);
+  std::vector<float> norms2(k, 0);
+  for (unsigned int j = 0; j < k; j++) {
+    for (unsigned int c = 0; c < num_channels; c++) {
+      const float value = centroids[(size_t) j * num_channels + c];
+      weights[(size_t) j * num_channels + c] = lroundf(value * scale);
+      norms2[j] += value * value;
+    }
+    norms2[j] += centroid_terms[j] * centroid_terms[j];
+  }
+
+  std::vector<int32_t> dots(n);
+  std::vector<float> nearest_distances(n, FLT_MAX);
+  assignments->assign(n, 0);
+  for (unsigned int begin = 0; begin < n; begin += ASSIGN_BLOCK_ROWS) {
+    const unsigned int end = std::min(n, begin + ASSIGN_BLOCK_ROWS);
+    for (unsigned int j = 0; j < k; j++) {
+      score_embeddings(
+          rows,
+          num_channels,
+          begin,
+          end,
+          &weights[(size_t) j * num_channels],
+          dots.data());
+
+      // The distance, less the row's own squared norm.
+      for (unsigned int i = begin; i < end; i++) {
+        const float d = norms2[j]
+            - 2 * (dots[i] / scale + row_terms[i] * centroid_terms[j]);
+        if (d < nearest_distances[i]) {
+          nearest_distances[i] = d;
+          (*assignments)[i] = j;
+        }
+      }
+    }
+  }
+}
+
+void TokenIndex::build(
+    unsigned int num_lists,
+    unsigned int num_subspaces,
+    const uint64_t seed
+) {
+  if (num_lists == 0) {
+    num_lists = std::max(1.0, round(DEFAULT_LISTS_PER_ROOT * sqrt(num_tokens)));
+  }
+  num_lists = std::max(1u, std::min(num_lists, num_tokens));
+  if (num_subspaces == 0) {
+    num_subspaces = (num_channels + DEFAULT_SUBSPACE_CHANNELS - 1)
+        / DEFAULT_SUBSPACE_CHANNELS;
+  }
+  num_subspaces =
+      std::max(1u, std::min<unsigned int>(num_subspaces, num_channels));
+  subspace_offsets.resize(num_subspaces + 1);
+  for (unsigned int m = 0; m <= num_subspaces; m++) {
+    subspace_offsets[m] = m * num_channels / num_subspaces;
+  }
+  list_offsets.assign(num_lists + 1, 0);
+  if (num_tokens == 0) {
+    return;
+  }
+
+  // Shuffle the tokens, so that any prefix is a random sample.
+  const CounterRng rng(seed, SAMPLE_STREAM);
+  std::vector<unsigned int> order(num_tokens);
+  for (unsigned int i = 0; i < num_tokens; i++) {
+    order[i] = i;
+  }
+  for (unsigned int i = 0; i + 1 < num_tokens; i++) {
+    const unsigned int j = i + rng.uniform(0, i) * (num_tokens - i);
+    std::swap(order[i], order[j]);
+  }
+
+  std::vector<float> norm_terms;
+  compute_norm_terms(embeddings, num_tokens, num_channels, &norm_terms);
+
+  // Cluster a sample of the embeddings into the lists.
+  const unsigned int num_samples = std::min(
+      num_tokens,
+      std::max(MAX_PQ_SAMPLES,
+          std::min(MAX_LIST_SAMPLES, num_lists * LIST_SAMPLES_PER_LIST)));
+  std::vector<uint8_t> sample_rows((size_t) num_samples * num_channels);
+  std::vector<float> samples((size_t) num_samples * num_channels);
+  std::vector<float> sample_terms(num_samples);
+  for (unsigned int i = 0; i < num_samples; i++) {
+    const uint8_t* row = embeddings + (size_t) order[i] * num_channels;
+    std::copy(row, row + num_channels, &sample_rows[(size_t) i * num_channels]);
+    std::copy(row, row + num_channels, &samples[(size_t) i * num_channels]);
+    sample_terms[i] = norm_terms[order[i]];
+  }
+  std::vector<float> list_centroids((size_t) num_lists * num_channels);
+  std::copy(
+      samples.begin(),
+      samples.begin() + (size_t) num_lists * num_channels,
+      list_centroids.begin());
+  std::vector<float> list_terms(
+      sample_terms.begin(), sample_terms.begin() + num_lists);
+  std::vector<unsigned int> assignments;
+  for (unsigned int iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+    assign_rows(
+        sample_rows.data(),
+        sample_terms.data(),
+        num_samples,
+        num_channels,
+        list_centroids.data(),
+        list_terms.data(),
+        num_lists,
+        &assignments);
+    update_centroids(
+        samples.data(),
+        num_samples,
+        num_channels,
+        num_lists,
+        assignments,
+        list_centroids.data());
+    update_centroids(
+        sample_terms.data(),
+        num_samples,
+        1,
+        num_lists,
+        assignments,
+        list_terms.data());
+  }
+
+  // Fill the lists with every token, in token order.
+  std::vector<unsigned int> token_lists;
+  assign_rows(
+      embeddings,
+      norm_terms.data(),
+      num_tokens,
+      num_channels,
+      list_centroids.data(),
+      list_terms.data(),
+      num_lists,
+      &token_lists);
+  for (const unsigned int list : token_lists) {
+    list_offsets[list + 1]++;
+  }
+  for (unsigned int l = 0; l < num_lists; l++) {
+    list_offsets[l + 1] += list_offsets[l];
+  }
+  list_tokens.resize(num_tokens);
+  std::vector<unsigned int> list_ends(
+      list_offsets.begin(), list_offsets.end() - 1);
+  for (unsigned int t = 0; t < num_tokens; t++) {
+    list_tokens[list_ends[token_lists[t]]++] = t;
+  }
+
+  // A search scores the lists by their centroids rounded to bytes, so the
+  // residuals are taken from the rounded centroids too, and the two parts of
+  // an estimated score add up to the score of the approximated embedding.
+  list_centroid_rows.resize(list_centroids.size());
+  for (size_t i = 0; i < list_centroids.size(); i++) {
+    list_centroid_rows[i] =
+        std::min(255L, std::max(0L, lroundf(list_centroids[i])));
+  }
+
+  // Train each subspace's codebook on a sample of the residuals, repeating
+  // the tokens if there are fewer than the centroids.
+  const unsigned int num_pq_samples =
+      std::max(std::min(num_tokens, MAX_PQ_SAMPLES), PQ_CENTROIDS);
+  std::vector<float> residuals((size_t) num_pq_samples * num_channels);
+  for (unsigned int i = 0; i < num_pq_samples; i++) {
+    const unsigned int t = order[i % num_tokens];
+    compute_residual(t, token_lists[t], &residuals[(size_t) i * num_channels]);
+  }
+  codebooks.assign((size_t) num_channels * PQ_CENTROIDS, 0);
+  std::vector<float> subspace_points;
+  std::vector<float> subspace_centroids;
+  std::vector<std::vector<float>> subspace_codebooks(num_subspaces);
+  for (unsigned int m = 0; m < num_subspaces; m++) {
+    const unsigned int first = subspace_offsets[m];
+    const unsigned int dims = subspace_offsets[m + 1] - first;
+    subspace_points.resize((size_t) num_pq_samples * dims);
+    for (unsigned int i = 0; i < num_pq_samples; i++) {
+      const float* residual = &residuals[(size_t) i * num_channels + first];
+      std::copy(residual, residual + dims, &subspace_points[(size_t) i * dims]);
+    }
+    subspace_codebooks[m].resize(PQ_CENTROIDS * dims);
+    cluster(
+        subspace_points.data(),
+        num_pq_samples,
+        dims,
+        PQ_CENTROIDS,
+        subspace_codebooks[m].data());
+    for (unsigned int j = 0; j < PQ_CENTROIDS; j++) {
+      for (unsigned int d = 0; d < dims; d++) {
+        codebooks[(first + d) * PQ_CENTROIDS + j] =
+            subspace_codebooks[m][j * dims + d];
+      }
+    }
+  }
+
+  // Encode every token's residual, in list order, two subspaces a byte.
+  const unsigned int num_code_bytes = code_size();
+  codes.assign((size_t) num_tokens * num_code_bytes, 0);
+  std::vector<float> residual(num_channels);
+  for (unsigned int i = 0; i < num_tokens; i++) {
+    const unsigned int t = list_tokens[i];
+    compute_residual(t, token_lists[t], residual.data());
+    for (unsigned int m = 0; m < num_subspaces; m++) {
+      const unsigned int first = subspace_offsets[m];
+      const unsigned int dims = subspace_offsets[m + 1] - first;
+      const unsigned int code = nearest_centroid(
+          &residual[first],
+          subspace_codebooks[m].data(),
+          PQ_CENTROIDS,
+          dims);
+      codes[(size_t) i * num_code_bytes + m / 2] |= code << (m % 2 * 4);
+    }
+  }
+}
+
+void TokenIndex::compute_residual(
+    const unsigned int token,
+    const unsigned int list,
+    float* residual
+) const {
+  const uint8_t* row = embeddings + (size_t) token * num_channels;
+  const uint8_t* centroid = &list_centroid_rows[(size_t) list * num_channels];
+  for (unsigned int c = 0; c < num_channels; c++) {
+    residual[c] = row[c] - centroid[c];
+  }
+}
+
+int TokenIndex::search(const int16_t* weights, int32_t* best_score) {
+  best_candidate.reset(1);
+  search(weights, &best_candidate);
+  const std::vector<ScoredItem>& best = best_candidate.sorted();
+  if (best.empty()) {
+    return -1;
+  }
+  *best_score = best[0].score;
+  return best[0].item;
+}
+
+void TokenIndex::search(const int16_t* weights, TopScores* top_scores) {
+  const unsigned int num_lists = list_count();
+  const unsigned int num_subspaces = subspace_count();
+  if (num_tokens == 0) {
+    return;
+  }
+
+  // Score the lists' centroids, and pick the best to probe.
+  list_scores.resize(num_lists);
+  score_embeddings(
+      list_centroid_rows.data(),
+      num_channels,
+      0,
+      num_lists,
+      weights,
+      list_scores.data());
+  const unsigned int n_probes = std::min(num_probes, num_lists);
+  probed_lists.resize(num_lists);
+  for (unsigned int l = 0; l < num_lists; l++) {
+    probed_lists[l] = l;
+  }
+  std::partial_sort(
+      probed_lists.begin(),
+      probed_lists.begin() + n_probes,
+      probed_lists.end(),
+      [&](const unsigned int a, const unsigned int b) {
+        return list_scores[a] > list_scores[b];
+      });
+
+  // Score every subspace centroid, so a residual's approximate score is the
+  // sum of a table entry per subspace. Each channel adds to all of its
+  // subspace's entries at once. A lone last subspace is paired with a table
+  // of zeros, as its high codes are always zero.
+  const unsigned int num_code_bytes = code_size();
+  lookup_table.assign(num_code_bytes * 2 * PQ_CENTROIDS, 0);
+  for (unsigned int m = 0; m < num_subspaces; m++) {
+    float* entries = &lookup_table[m * PQ_CENTROIDS];
+    const unsigned int end_channel = subspace_offsets[m + 1];
+    for (unsigned int c = subspace_offsets[m]; c < end_channel; c++) {
+      const float* centroid_values = &codebooks[c * PQ_CENTROIDS];
+      for (unsigned int j = 0; j < PQ_CENTROIDS; j++) {
+        entries[j] += centroid_values[j] * weights[c];
+      }
+    }
+  }
+
+  // Approximate the scores of the probed lists' tokens, from the two codes
+  // in each byte. The entries are summed in four independent chains, to
+  // overlap their latencies.
+  candidates.clear();
+  for (unsigned int p = 0; p < n_probes; p++) {
+    const unsigned int l = probed_lists[p];
+    for (unsigned int i = list_offsets[l]; i < list_offsets[l + 1]; i++) {
+      const uint8_t* code = &codes[(size_t) i * num_code_bytes];
+      float sums[4] = {0, 0, 0, 0};
+      unsigned int b = 0;
+      for (; b + 2 <= num_code_bytes; b += 2) {
+        for (unsigned int k = 0; k < 2; k++) {
+          const float* entries = &lookup_table[(b + k) * 2 * PQ_CENTROIDS];
+          sums[2 * k] += entries[code[b + k] % PQ_CENTROIDS];
+          sums[2 * k + 1] +=
+              entries[PQ_CENTROIDS + code[b + k] / PQ_CENTROIDS];
+        }
+      }
+      for (; b < num_code_bytes; b++) {
+        const float* entries = &lookup_table[b * 2 * PQ_CENTROIDS];
+        sums[0] += entries[code[b] % PQ_CENTROIDS];
+        sums[1] += entries[PQ_CENTROIDS + code[b] / PQ_CENTROIDS];
+      }
+      const float score =
+          list_scores[l] + (sums[0] + sums[1]) + (sums[2] + sums[3]);
+      candidates.emplace_back(score, list_tokens[i]);
+    }
+  }
+
+  if (candidates.empty()) {
+    return;
+  }
+
+  // Score the best candidates exactly.
+  const unsigned int n_candidates = std::min<size_t>(
+      std::max(num_candidates, top_scores->capacity()), candidates.size());
+  std::nth_element(
+      candidates.begin(),
+      candidates.begin() + n_candidates - 1,
+      candidates.end(),
+      [](const std::pair<float, unsigned int>& a,
+         const std::pair<float, unsigned int>& b) {
+        return a.first > b.first;
+      });
+
+  // Gather their embeddings, so they're scored with one call.
+  candidate_rows.resize((size_t) n_candidates * num_channels);
+  candidate_scores.resize(n_candidates);
+  for (unsigned int i = 0; i < n_candidates; i++) {
+    const uint8_t* row =
+        embeddings + (size_t) candidates[i].second * num_channels;
+    std::copy(
+        row, row + num_channels, &candidate_rows[(size_t) i * num_channels]);
+  }
+  score_embeddings(
+      candidate_rows.data(),
+      num_channels,
+      0,
+      n_candidates,
+      weights,
+      candidate_scores.data());
+
+  for (unsigned int i = 0; i < n_candidates; i++) {
+    top_scores->offer(candidate_scores[i], candidates[i].second);
+  }
+}
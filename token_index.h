@@ -0,0 +1,150 @@
+#ifndef _token_index_h
+#define _token_index_h
+
+#include "top_scores.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// An approximate index for finding the token whose embedding has the highest
+// dot product with a vector of channel weights, without scoring every token.
+// It's an inverted file with product quantization (IVF-PQ):
+// - The embeddings are clustered with k-means, and each cluster's tokens are
+//   kept in a list.
+// - Each token's residual from its cluster's centroid is split into
+//   subspaces, and each subspace is quantized to one of PQ_CENTROIDS
+//   centroids, so a token is stored as a 4-bit code per subspace, two to a
+//   byte.
+// A search scores the centroids, then approximates the scores of the tokens
+// in the best num_probes lists from their codes with a lookup table, and
+// finally scores the best num_candidates of those exactly. More probes and
+// candidates give higher recall and slower searches.
+class TokenIndex {
+  public:
+    // The number of centroids per subspace. Few centroids keep building the
+    // index cheap; the exact rescoring of the candidates makes up for the
+    // coarse approximation.
+    static constexpr unsigned int PQ_CENTROIDS = 16;
+    static_assert(PQ_CENTROIDS == 16, "codes are packed two to a byte");
+
+    // Constructor. Builds the index of the embeddings, which are the rows of
+    // a matrix with num_channels values per token. The embeddings aren't
+    // copied, and must outlive the index.
+    // A num_lists or num_subspaces of zero selects a default for the size of
+    // the matrix. The seed selects the samples the clusters are trained on.
+    // The search options default to probing a fixed fraction of the lists,
+    // with a fixed number of candidates per probe.
+    TokenIndex(
+        const uint8_t* embeddings,
+        unsigned int num_tokens,
+        uint16_t num_channels,
+        unsigned int num_lists,
+        unsigned int num_subspaces,
+        uint64_t seed);
+
+    // Sets the number of lists searched, and the number of candidates that
+    // are scored exactly.
+    void set_search_options(
+        unsigned int num_probes,
+        unsigned int num_candidates);
+
+    // Sets the fewest probes, doubling from one, whose recall@1 on the
+    // queries reaches the target, with a fixed number of candidates per
+    // probe. The queries are num_queries vectors of num_channels weights, with
+    // the same constraints as search()'s, ideally like those searched later.
+    // Returns the recall@1 that the options reach.
+    double tune_search_options(
+        const int16_t* queries,
+        unsigned int num_queries,
+        double target_recall);
+
+    // Returns the token with the highest score, i.e. the dot product of its
+    // embedding and the weights, among the candidates, and sets its score.
+    // Ties go to the lowest token. Returns -1 if there are no tokens.
+    // The weights have the same constraints as score_embeddings()'s.
+    int search(const int16_t* weights, int32_t* best_score);
+
+    // Offers the candidates to the selection, scored exactly, so that it
+    // keeps the highest-scoring of them. At least as many candidates as the
+    // selection keeps are scored, if the probed lists hold that many.
+    void search(const int16_t* weights, TopScores* top_scores);
+
+    // Returns the number of lists.
+    unsigned int list_count() const { return list_offsets.size() - 1; }
+
+    // Returns the number of lists searched.
+    unsigned int probe_count() const { return num_probes; }
+
+    // Returns the number of candidates scored exactly.
+    unsigned int candidate_count() const { return num_candidates; }
+
+    // Returns the number of subspaces.
+    unsigned int subspace_count() const { return subspace_offsets.size() - 1; }
+
+    // Returns the number of bytes of codes per token.
+    unsigned int code_size() const { return (subspace_count() + 1) / 2; }
+
+  private:
+    // The embedding matrix.
+    const uint8_t* const embeddings;
+
+    // The number of tokens.
+    const unsigned int num_tokens;
+
+    // The number of values in each embedding.
+    const uint16_t num_channels;
+
+    // The number of lists searched.
+    unsigned int num_probes;
+
+    // The number of candidates scored exactly.
+    unsigned int num_candidates;
+
+    // The centroids of the lists, num_channels values each, rounded to bytes
+    // so that they can be scored by score_embeddings(). The residuals are
+    // taken from these rounded centroids.
+    std::vector<uint8_t> list_centroid_rows;
+
+    // The tokens in list l are list_tokens[list_offsets[l]] up to
+    // list_tokens[list_offsets[l + 1]].
+    std::vector<unsigned int> list_offsets;
+    std::vector<unsigned int> list_tokens;
+
+    // Subspace m is channels [subspace_offsets[m], subspace_offsets[m + 1]).
+    std::vector<unsigned int> subspace_offsets;
+
+    // The centroids of each subspace, transposed so that the table of a
+    // query's scores can be computed a channel at a time. The value of
+    // centroid j on channel c is codebooks[c * PQ_CENTROIDS + j].
+    std::vector<float> codebooks;
+
+    // The codes of the tokens, in list order, a byte per pair of subspaces:
+    // the even subspace's code in the low four bits, and the odd one's in the
+    // high four bits.
+    std::vector<uint8_t> codes;
+
+    // Scratch space for searches.
+    std::vector<int32_t> list_scores;
+    std::vector<unsigned int> probed_lists;
+    std::vector<float> lookup_table;
+    std::vector<std::pair<float, unsigned int>> candidates;
+    std::vector<uint8_t> candidate_rows;
+    std::vector<int32_t> candidate_scores;
+    TopScores best_candidate;
+
+    // Clusters the embeddings into lists, and encodes their residuals.
+    void build(
+        unsigned int num_lists,
+        unsigned int num_subspaces,
+        uint64_t seed);
+
+    // Sets the residual of a token's embedding from a list's rounded
+    // centroid.
+    void compute_residual(
+        unsigned int token,
+        unsigned int list,
+        float* residual) const;
+};
+
+#endif // _token_index_h
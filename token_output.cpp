@@ -1,17 +1,147 @@
 #include "token_output.h"
 
-void TokenOutput::set_tokens(const std::vector<Token>& tokens) {
+#include "embedding_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Shards are a multiple of this many tokens, so that threads don't write to
+// the same cache lines.
+static constexpr unsigned int SHARD_ALIGNMENT = 16;
+
+// The number of runners-up that the leader's lead is tested against.
+static constexpr unsigned int NUM_RUNNERS_UP = 4;
+
+// The number of standard errors by which a safe lead's mean exceeds zero.
+// The chance of a lead this large arising by chance is about 0.1%.
+static constexpr double MIN_LEAD_Z_SCORE = 3;
+
+// The fewest spikes that a lead can be judged on.
+static constexpr int32_t MIN_CONFIDENT_SPIKES = 32;
+
+// The number of best tokens whose scores confident_token() keeps up to date
+// between rankings. More than the contenders, so that a token that climbs
+// into the lead is usually among them.
+static constexpr unsigned int NUM_CANDIDATES = 16;
+
+TokenOutput::TokenOutput(
+    const TokenDecoding decoding_,
+    const SpikeEncoding encoding_
+) :
+  decoding(decoding_),
+  encoding(encoding_),
+  latency_start(0),
+  latency_window(0),
+  tokens(nullptr),
+  embeddings(nullptr),
+  total_count(0),
+  num_spikes(0),
+  index(nullptr),
+  is_ranked(false)
+{
+}
+
+void TokenOutput::set_tokens(const std::vector<Token>& tokens_) {
+  tokens = &tokens_;
   output_states.clear();
-  if (tokens.empty()) {
+  owned_embeddings.clear();
+  embeddings = nullptr;
+  is_ranked = false;
+  if (tokens_.empty()) {
+    return;
+  }
+
+  const uint16_t num_channels = tokens_[0].num_channels;
+  channel_counts.assign(num_channels, 0);
+  total_count = 0;
+  num_spikes = 0;
+  if (decoding == TokenDecoding::PER_SPIKE) {
+    output_states.reserve(tokens_.size());
+    for (const Token& token : tokens_) {
+      output_states.emplace_back(token);
+    }
     return;
   }
-  output_states.reserve(tokens.size());
-  for (const Token& token : tokens) {
-    output_states.emplace_back(token);
+
+  // Use the tokens' embeddings in place if they're the rows of a matrix, as
+  // they are in a token store.
+  bool is_contiguous = true;
+  for (size_t i = 0; i < tokens_.size() && is_contiguous; i++) {
+    is_contiguous = tokens_[i].num_channels == num_channels
+        && tokens_[i].embedding == tokens_[0].embedding + i * num_channels;
+  }
+  if (is_contiguous) {
+    embeddings = tokens_[0].embedding;
+  } else {
+    owned_embeddings.resize(tokens_.size() * num_channels);
+    for (size_t i = 0; i < tokens_.size(); i++) {
+      std::copy(
+          tokens_[i].embedding,
+          tokens_[i].embedding + num_channels,
+          owned_embeddings.begin() + i * num_channels);
+    }
+    embeddings = owned_embeddings.data();
   }
+  scores.resize(tokens_.size());
+}
+
+void TokenOutput::set_thread_count(const unsigned int num_threads) {
+  if (num_threads <= 1) {
+    thread_pool.reset();
+  } else {
+    thread_pool.reset(new ThreadPool(num_threads));
+  }
+}
+
+void TokenOutput::set_latency_window(
+    const Tick start_timestamp,
+    const Tick window
+) {
+  latency_start = start_timestamp;
+  latency_window = window;
 }
 
-void TokenOutput::spike(const std::vector<uint16_t>& channels) {
+void TokenOutput::spike(
+    const std::vector<uint16_t>& channels,
+    const Tick timestamp
+) {
+  if (encoding == SpikeEncoding::LATENCY) {
+    // The value of a channel's first spike, scaled by 256 like an embedding
+    // value, weights its channel. Later spikes are ignored.
+    const uint16_t weight = lroundf(
+        256 * latency_value(timestamp - latency_start, latency_window));
+    for (const uint16_t channel : channels) {
+      if (channel_counts[channel] != 0 || weight == 0) {
+        continue;
+      }
+      channel_counts[channel] = weight;
+      total_count += weight;
+      num_spikes++;
+      if (is_ranked) {
+        update_candidates(channel, weight);
+      }
+      for (OutputState& output_state : output_states) {
+        output_state.spike(channel, weight);
+      }
+    }
+    return;
+  }
+
+  for (const uint16_t channel : channels) {
+    if (channel_counts[channel] < INT16_MAX
+        && total_count < MAX_EMBEDDING_WEIGHT_SUM) {
+      channel_counts[channel]++;
+      total_count++;
+      num_spikes++;
+      if (is_ranked) {
+        update_candidates(channel, 1);
+      }
+    }
+  }
+  if (decoding == TokenDecoding::DEFERRED) {
+    return;
+  }
+
   for (const uint16_t channel : channels) {
     for (OutputState& output_state : output_states) {
       output_state.spike(channel);
@@ -20,15 +150,64 @@ void TokenOutput::spike(const std::vector<uint16_t>& channels) {
 }
 
 void TokenOutput::reset() {
+  std::fill(channel_counts.begin(), channel_counts.end(), 0);
+  total_count = 0;
+  num_spikes = 0;
+  is_ranked = false;
   for (OutputState& output_state : output_states) {
     output_state.reset();
   }
 }
 
+void TokenOutput::compute_scores() {
+  const unsigned int n = scores.size();
+  const uint16_t num_channels = channel_counts.size();
+  if (thread_pool == nullptr) {
+    score_embeddings(
+        embeddings, num_channels, 0, n, channel_counts.data(), scores.data());
+    return;
+  }
+
+  const unsigned int num_shards = thread_pool->thread_count();
+  const unsigned int shard_size =
+      ((n + num_shards - 1) / num_shards + SHARD_ALIGNMENT - 1)
+      / SHARD_ALIGNMENT * SHARD_ALIGNMENT;
+  thread_pool->run([&](const unsigned int shard) {
+    const unsigned int begin = std::min(n, shard * shard_size);
+    const unsigned int end = std::min(n, begin + shard_size);
+    score_embeddings(
+        embeddings,
+        num_channels,
+        begin,
+        end,
+        channel_counts.data(),
+        scores.data());
+  });
+}
+
 const Token* TokenOutput::best_token() {
-  float best_activation_level = 0;
   const Token* best_token = nullptr;
+  if (decoding == TokenDecoding::DEFERRED) {
+    if (total_count == 0) {
+      return nullptr;
+    }
+    if (index != nullptr) {
+      int32_t score;
+      const int token = index->search(channel_counts.data(), &score);
+      return token >= 0 && score > 0 ? &(*tokens)[token] : nullptr;
+    }
+    compute_scores();
+    int32_t best_score = 0;
+    for (size_t i = 0; i < scores.size(); i++) {
+      if (scores[i] > best_score) {
+        best_score = scores[i];
+        best_token = &(*tokens)[i];
+      }
+    }
+    return best_token;
+  }
 
+  float best_activation_level = 0;
   for (OutputState& output_state : output_states) {
     const float activation_level = output_state.get_activation_level();
     if (activation_level > best_activation_level) {
@@ -38,3 +217,149 @@ const Token* TokenOutput::best_token() {
   }
   return best_token;
 }
+
+void TokenOutput::select_top(const unsigned int k) {
+  top_scores.reset(k);
+  if (decoding == TokenDecoding::DEFERRED) {
+    if (total_count == 0) {
+      return;
+    }
+    if (index != nullptr) {
+      index->search(channel_counts.data(), &top_scores);
+    } else {
+      compute_scores();
+      for (size_t i = 0; i < scores.size(); i++) {
+        if (scores[i] > 0) {
+          top_scores.offer(scores[i], i);
+        }
+      }
+    }
+  } else {
+    for (size_t i = 0; i < output_states.size(); i++) {
+      const uint32_t activation_sum = output_states[i].get_activation_sum();
+      if (activation_sum > 0) {
+        top_scores.offer(activation_sum, i);
+      }
+    }
+  }
+}
+
+float TokenOutput::top_k(
+    const unsigned int k,
+    std::vector<TokenScore>* top_tokens
+) {
+  top_tokens->clear();
+
+  // Keep at least two tokens, for the margin.
+  select_top(std::max(k, 2u));
+
+  // The index offers candidates of any score, so the invalid ones are
+  // dropped here.
+  const std::vector<ScoredItem>& top = top_scores.sorted();
+  for (size_t i = 0; i < top.size() && i < k && top[i].score > 0; i++) {
+    top_tokens->push_back({&(*tokens)[top[i].item], top[i].score / 256.0f});
+  }
+  const int64_t first =
+      top.size() > 0 ? std::max<int64_t>(top[0].score, 0) : 0;
+  const int64_t second =
+      top.size() > 1 ? std::max<int64_t>(top[1].score, 0) : 0;
+  return (first - second) / 256.0f;
+}
+
+void TokenOutput::rank_candidates() {
+  select_top(NUM_CANDIDATES);
+  candidates.clear();
+  for (const ScoredItem& scored_item : top_scores.sorted()) {
+    if (scored_item.score > 0) {
+      candidates.push_back(scored_item);
+    }
+  }
+  is_ranked = true;
+}
+
+void TokenOutput::update_candidates(
+    const uint16_t channel,
+    const int32_t weight
+) {
+  const uint16_t num_channels = channel_counts.size();
+  for (ScoredItem& candidate : candidates) {
+    candidate.score +=
+        weight * embeddings[(size_t) candidate.item * num_channels + channel];
+  }
+}
+
+void TokenOutput::set_contenders_from_candidates() {
+  std::sort(
+      candidates.begin(),
+      candidates.end(),
+      [](const ScoredItem& a, const ScoredItem& b) {
+        return a.score > b.score || (a.score == b.score && a.item < b.item);
+      });
+  contenders.clear();
+  for (size_t i = 0; i < candidates.size() && i <= NUM_RUNNERS_UP; i++) {
+    contenders.push_back(
+        {&(*tokens)[candidates[i].item], candidates[i].score / 256.0f});
+  }
+}
+
+bool TokenOutput::is_lead_safe() const {
+  if (contenders.empty()) {
+    return false;
+  }
+
+  // The per-spike differences are sampled by the counts, so their mean and
+  // variance come from a pass over the channels rather than the spikes.
+  // A LATENCY-encoded spike's difference is weighted by its value.
+  const Token* leader = contenders[0].token;
+  const uint16_t num_channels = channel_counts.size();
+  for (size_t i = 1; i < contenders.size(); i++) {
+    const uint8_t* runner_up = contenders[i].token->embedding;
+    int64_t sum = 0;
+    int64_t sum_of_squares = 0;
+    for (uint16_t c = 0; c < num_channels; c++) {
+      const int64_t difference = leader->embedding[c] - runner_up[c];
+      const int64_t lead = channel_counts[c] * difference;
+      sum += lead;
+      sum_of_squares += encoding == SpikeEncoding::LATENCY
+          ? lead * lead
+          : lead * difference;
+    }
+    const double mean = (double) sum / num_spikes;
+    const double variance =
+        std::max(0.0, (double) sum_of_squares / num_spikes - mean * mean);
+    if (mean <= MIN_LEAD_Z_SCORE * sqrt(variance / num_spikes)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const Token* TokenOutput::confident_token() {
+  if (num_spikes < MIN_CONFIDENT_SPIKES) {
+    return nullptr;
+  }
+  if (decoding == TokenDecoding::PER_SPIKE) {
+    top_k(NUM_RUNNERS_UP + 1, &contenders);
+    return is_lead_safe() ? contenders[0].token : nullptr;
+  }
+
+  // Test the lead among the candidates, and only rank all the tokens to
+  // confirm a lead that looks safe, in case a token outside them has climbed
+  // past the closest runners-up.
+  const bool was_ranked = is_ranked;
+  if (!is_ranked) {
+    rank_candidates();
+  }
+  set_contenders_from_candidates();
+  if (!is_lead_safe()) {
+    return nullptr;
+  }
+  if (was_ranked) {
+    rank_candidates();
+    set_contenders_from_candidates();
+    if (!is_lead_safe()) {
+      return nullptr;
+    }
+  }
+  return contenders[0].token;
+}
@@ -2,30 +2,168 @@
 #define _token_output_h
 
 #include "output_state.h"
+#include "spike_encoding.h"
+#include "thread_pool.h"
+#include "token_index.h"
+#include "top_scores.h"
 
+#include <memory>
 #include <vector>
 
+// How the output tokens are activated by spikes.
+enum class TokenDecoding {
+  // Every spike adds its channel's embedding value to every token's
+  // activation level.
+  PER_SPIKE,
+
+  // Spikes are only counted per channel. The activation levels are computed
+  // when the best token is requested, by multiplying the embedding matrix by
+  // the counts.
+  DEFERRED,
+};
+
+// A token and its activation level.
+struct TokenScore {
+  const Token* token;
+  float activation_level;
+};
+
 // Maintains the state of the output tokens.
 class TokenOutput {
   public:
+    // Constructor. The encoding is that of the spikes to be decoded.
+    TokenOutput(
+        TokenDecoding decoding = TokenDecoding::DEFERRED,
+        SpikeEncoding encoding = SpikeEncoding::RATE);
+
     // Sets the tokens used for output. The tokens should persist.
     // This should be called once.
     void set_tokens(const std::vector<Token>& tokens);
 
+    // Sets the number of threads that compute the deferred activation levels.
+    void set_thread_count(unsigned int num_threads);
+
+    // Sets an index of the tokens' embeddings, which is used to find the best
+    // token approximately when decoding is deferred, instead of scoring every
+    // token. The index isn't owned, and can be null to score every token.
+    void set_index(TokenIndex* index_) { index = index_; }
+
+    // Sets the latency window of the sample being decoded, which starts at
+    // the timestamp. Only LATENCY-encoded spikes need it.
+    void set_latency_window(Tick start_timestamp, Tick window);
+
     // Processes spikes on the specified channels.
-    // Uses the values to activate output tokens.
-    void spike(const std::vector<uint16_t>& channels);
+    // Uses the values to activate output tokens. The timestamp is only used
+    // to decode LATENCY-encoded spikes, where each channel's first spike
+    // since the reset carries its value.
+    void spike(const std::vector<uint16_t>& channels, Tick timestamp = 0);
 
     // Returns the token with the highest valid activation level.
     // Returns nullptr if none exceed a validity threshold.
     const Token* best_token();
 
+    // Sets the k tokens with the highest valid activation levels, best first,
+    // in one pass over the tokens. Returns the margin between the best and
+    // second best activation levels, which is the best level if only one
+    // token is valid, and zero if none are.
+    float top_k(unsigned int k, std::vector<TokenScore>* top_tokens);
+
+    // Returns the best token if its lead is statistically safe, so that the
+    // rest of the sample's spikes can be skipped, otherwise nullptr.
+    // Each spike adds the difference between the leader's and a runner-up's
+    // embedding values on its channel to the leader's lead, weighted by its
+    // value if LATENCY-encoded. The lead is safe when the mean of those
+    // differences is MIN_LEAD_Z_SCORE standard errors above zero, against
+    // each of the closest runners-up.
+    // When decoding is deferred, the first call after a reset ranks all the
+    // tokens, and the spikes after it only update the scores of the best few.
+    // The lead is tested among those, and all the tokens are only ranked
+    // again to confirm a lead that looks safe.
+    const Token* confident_token();
+
     // Resets the output state.
     void reset();
 
   private:
-    // The state of the output tokens.
+    // How spikes activate the tokens.
+    const TokenDecoding decoding;
+
+    // How the values are encoded as spikes.
+    const SpikeEncoding encoding;
+
+    // The latency window of the sample being decoded.
+    Tick latency_start;
+    Tick latency_window;
+
+    // The tokens, or null if they haven't been set.
+    const std::vector<Token>* tokens;
+
+    // The state of the output tokens, when decoding per spike.
     std::vector<OutputState> output_states;
+
+    // The embedding matrix, with a row per token, which all the tokens are
+    // scored against. Points to the tokens' own embeddings if they're
+    // contiguous, otherwise to owned_embeddings.
+    const uint8_t* embeddings;
+
+    // A contiguous copy of the embeddings, if the tokens' aren't contiguous.
+    std::vector<uint8_t> owned_embeddings;
+
+    // The number of spikes on each channel since the reset, or with LATENCY
+    // encoding the value of its spike, scaled by 256. Counting stops at
+    // INT16_MAX per channel, and at MAX_EMBEDDING_WEIGHT_SUM in total, so
+    // the deferred scores are exact.
+    std::vector<int16_t> channel_counts;
+
+    // The total of the channel counts.
+    int32_t total_count;
+
+    // The number of spikes counted.
+    int32_t num_spikes;
+
+    // The deferred activation level of each token, scaled by 256.
+    std::vector<int32_t> scores;
+
+    // Nullable. The index used to find the best token.
+    TokenIndex* index;
+
+    // The selection of the top tokens.
+    TopScores top_scores;
+
+    // The leader and runners-up tested by confident_token().
+    std::vector<TokenScore> contenders;
+
+    // Whether the tokens have been ranked since the reset. If so, spikes
+    // update the scores of the candidates.
+    bool is_ranked;
+
+    // The best tokens when they were last ranked, and their current scores.
+    std::vector<ScoredItem> candidates;
+
+    // The threads that compute the deferred activation levels, or null if
+    // there's only one.
+    std::unique_ptr<ThreadPool> thread_pool;
+
+    // Computes the deferred activation levels of all the tokens.
+    void compute_scores();
+
+    // Selects the k tokens with the highest valid activation levels into
+    // top_scores.
+    void select_top(unsigned int k);
+
+    // Ranks the tokens, and keeps the best as the candidates.
+    void rank_candidates();
+
+    // Adds a spike of the specified weight on a channel to the scores of the
+    // candidates.
+    void update_candidates(uint16_t channel, int32_t weight);
+
+    // Sorts the candidates, and sets the contenders to the best of them.
+    void set_contenders_from_candidates();
+
+    // Returns whether the leader of the contenders is safely ahead of each
+    // of the runners-up.
+    bool is_lead_safe() const;
 };
 
 #endif // _token_output_h
@@ -0,0 +1,225 @@
+#include "token_store.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TokenStore::TokenStore() :
+  header(nullptr)
+{
+}
+
+TokenStore::~TokenStore() {
+  close();
+}
+
+bool TokenStore::open(const char* path) {
+  close();
+  if (!file.open(
+      path,
+      "token store",
+      TOKEN_STORE_MAGIC,
+      TOKEN_STORE_VERSION,
+      sizeof(TokenStoreHeader))) {
+    return false;
+  }
+  header = (const TokenStoreHeader*) file.data();
+
+  if (!load_tokens()) {
+    fprintf(stderr, "%s: malformed token store\n", path);
+    close();
+    return false;
+  }
+  return true;
+}
+
+void TokenStore::close() {
+  file.close();
+  header = nullptr;
+  token_views.clear();
+}
+
+bool TokenStore::load_tokens() {
+  const uint8_t* data = file.data();
+  const size_t size = file.size();
+  const uint64_t num_tokens = header->num_tokens;
+  const uint64_t num_channels = header->num_channels;
+  const uint64_t entries_size = num_tokens * sizeof(TokenStoreEntry);
+  if (num_channels > UINT16_MAX
+      || entries_size > size - sizeof(TokenStoreHeader)
+      || header->strings_offset < sizeof(TokenStoreHeader) + entries_size
+      || header->strings_offset > size
+      || header->strings_size > size - header->strings_offset
+      || header->embeddings_offset % TOKEN_STORE_ALIGNMENT != 0
+      || header->embeddings_offset > size
+      || num_tokens * num_channels > size - header->embeddings_offset) {
+    return false;
+  }
+
+  const TokenStoreEntry* entries =
+      (const TokenStoreEntry*) (data + sizeof(TokenStoreHeader));
+  const char* strings = (const char*) (data + header->strings_offset);
+  const uint8_t* embeddings = this->embeddings();
+  token_views.reserve(num_tokens);
+  for (uint64_t id = 0; id < num_tokens; id++) {
+    const TokenStoreEntry& entry = entries[id];
+    const uint64_t text_end = (uint64_t) entry.text_offset + entry.text_length;
+    if (text_end >= header->strings_size || strings[text_end] != '\0') {
+      return false;
+    }
+    token_views.emplace_back(
+        id,
+        entry.is_suffix != 0,
+        strings + entry.text_offset,
+        embeddings + id * num_channels,
+        num_channels);
+  }
+
+  // Tokens are looked up by ID at random.
+  madvise(
+      (void*) (data + header->embeddings_offset),
+      num_tokens * num_channels,
+      MADV_WILLNEED);
+  return true;
+}
+
+// Reads a whole file into the buffer.
+// Returns false if the file can't be read.
+static bool read_file(const char* path, std::vector<uint8_t>* buffer) {
+  FILE* fp;
+  if ((fp = fopen(path, "r")) == nullptr) {
+    fprintf(stderr, "fopen %s: %m\n", path);
+    return false;
+  }
+  bool ok = fseek(fp, 0, SEEK_END) == 0;
+  const long file_size = ok ? ftell(fp) : -1;
+  ok = file_size >= 0 && fseek(fp, 0, SEEK_SET) == 0;
+  if (ok) {
+    buffer->resize(file_size);
+    ok = fread(buffer->data(), 1, file_size, fp) == (size_t) file_size;
+  }
+  if (!ok) {
+    fprintf(stderr, "fread %s: %m\n", path);
+  }
+  fclose(fp);
+  return ok;
+}
+
+// Parses the token strings file into entries and a string blob.
+// Returns false if the file is malformed.
+static bool parse_strings(
+    const std::vector<uint8_t>& file,
+    std::vector<TokenStoreEntry>* entries,
+    std::vector<char>* strings
+) {
+  // Parse the number of tokens. A count of zero is followed by the real
+  // count, as a uint32_t, for vocabularies of more than UINT16_MAX tokens.
+  uint16_t short_count;
+  if (file.size() < sizeof(uint16_t)) {
+    fprintf(stderr, "missing token count\n");
+    return false;
+  }
+  memcpy(&short_count, file.data(), sizeof(uint16_t));
+  size_t pos = sizeof(uint16_t);
+  uint32_t num_tokens = short_count;
+  if (short_count == 0) {
+    if (file.size() - pos < sizeof(uint32_t)) {
+      fprintf(stderr, "missing token count\n");
+      return false;
+    }
+    memcpy(&num_tokens, file.data() + pos, sizeof(uint32_t));
+    pos += sizeof(uint32_t);
+  }
+
+  // Parse each token's suffix flag and text.
+  for (uint32_t token_id = 0; token_id < num_tokens; token_id++) {
+    if (file.size() - pos < 2) {
+      fprintf(stderr, "token %u truncated\n", token_id);
+      return false;
+    }
+    const uint8_t is_suffix = file[pos];
+    const uint8_t len = file[pos + 1];
+    pos += 2;
+    if (is_suffix > 1) {
+      fprintf(stderr, "invalid suffix flag: %d\n", is_suffix);
+      return false;
+    }
+    if (file.size() - pos < len) {
+      fprintf(stderr, "token %u string truncated\n", token_id);
+      return false;
+    }
+
+    entries->push_back({(uint32_t) strings->size(), len, is_suffix, 0});
+    strings->insert(
+        strings->end(), file.begin() + pos, file.begin() + pos + len);
+    strings->push_back('\0');
+    pos += len;
+  }
+  return true;
+}
+
+bool TokenStore::convert(
+    const char* strings_path,
+    const char* embeddings_path,
+    const uint16_t num_channels,
+    const char* store_path
+) {
+  std::vector<uint8_t> strings_file;
+  std::vector<uint8_t> embeddings;
+  if (!read_file(strings_path, &strings_file)
+      || !read_file(embeddings_path, &embeddings)) {
+    return false;
+  }
+
+  std::vector<TokenStoreEntry> entries;
+  std::vector<char> strings;
+  if (!parse_strings(strings_file, &entries, &strings)) {
+    fprintf(stderr, "%s: malformed token strings\n", strings_path);
+    return false;
+  }
+  const size_t matrix_size = entries.size() * num_channels;
+  if (embeddings.size() < matrix_size) {
+    fprintf(stderr, "%s: %zu embeddings needed, %zu found\n",
+        embeddings_path,
+        entries.size(),
+        embeddings.size() / num_channels);
+    return false;
+  }
+
+  TokenStoreHeader header = TokenStoreHeader();
+  memcpy(header.magic, TOKEN_STORE_MAGIC, sizeof(header.magic));
+  header.version = TOKEN_STORE_VERSION;
+  header.num_tokens = entries.size();
+  header.num_channels = num_channels;
+  header.strings_offset =
+      sizeof(header) + entries.size() * sizeof(TokenStoreEntry);
+  header.strings_size = strings.size();
+  header.embeddings_offset =
+      (header.strings_offset + strings.size() + TOKEN_STORE_ALIGNMENT - 1)
+      & ~(TOKEN_STORE_ALIGNMENT - 1);
+  const std::vector<uint8_t> padding(
+      header.embeddings_offset - header.strings_offset - strings.size(), 0);
+
+  FILE* fp;
+  if ((fp = fopen(store_path, "w")) == nullptr) {
+    fprintf(stderr, "fopen %s: %m\n", store_path);
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+      && fwrite(entries.data(), sizeof(TokenStoreEntry), entries.size(), fp)
+          == entries.size()
+      && fwrite(strings.data(), 1, strings.size(), fp) == strings.size()
+      && fwrite(padding.data(), 1, padding.size(), fp) == padding.size()
+      && fwrite(embeddings.data(), 1, matrix_size, fp) == matrix_size;
+  if (!ok) {
+    fprintf(stderr, "fwrite %s: %m\n", store_path);
+  }
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "fclose %s: %m\n", store_path);
+    ok = false;
+  }
+  return ok;
+}
@@ -0,0 +1,72 @@
+#ifndef _token_store_h
+#define _token_store_h
+
+#include "mapped_file.h"
+#include "token.h"
+#include "token_store_format.h"
+
+#include <cstddef>
+#include <vector>
+
+// A memory-mapped file of tokens, their text and their embeddings.
+// The tokens are views into the mapping, so opening a store costs little more
+// than mapping it, and every embedding is a row of one contiguous matrix.
+class TokenStore {
+  public:
+    // Constructor.
+    TokenStore();
+
+    // Disable the copy constructor.
+    TokenStore(const TokenStore& store) = delete;
+
+    // Destructor. Unmaps the file.
+    ~TokenStore();
+
+    // Maps the file and creates its tokens.
+    // Returns false if the file can't be mapped or isn't a valid store.
+    bool open(const char* path);
+
+    // Returns the tokens, indexed by ID.
+    const std::vector<Token>& tokens() const { return token_views; }
+
+    // Returns the number of values in each embedding.
+    uint16_t num_channels() const { return header->num_channels; }
+
+    // Returns the embedding matrix, which has a row of num_channels() values
+    // per token.
+    const uint8_t* embeddings() const {
+      return file.data() + header->embeddings_offset;
+    }
+
+    // Converts a token strings file and a token embeddings file to a token
+    // store file.
+    // The strings file has the number of tokens, as a uint16_t, or as zero
+    // followed by a uint32_t, followed by each token's suffix flag, text
+    // length and text, as bytes. The embeddings file has num_channels bytes
+    // per token.
+    // Returns true if both files are successfully converted.
+    static bool convert(
+        const char* strings_path,
+        const char* embeddings_path,
+        uint16_t num_channels,
+        const char* store_path);
+
+  private:
+    // The mapped file.
+    MappedFile file;
+
+    // The header, which is at the start of the mapped file.
+    const TokenStoreHeader* header;
+
+    // The tokens, which point into the mapped file.
+    std::vector<Token> token_views;
+
+    // Unmaps the file.
+    void close();
+
+    // Checks the header and entries, and creates the tokens.
+    // Returns false if the file is malformed.
+    bool load_tokens();
+};
+
+#endif // _token_store_h
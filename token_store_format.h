@@ -0,0 +1,70 @@
+#ifndef _token_store_format_h
+#define _token_store_format_h
+
+#include <cstdint>
+
+// The layout of a token store file, which packs the tokens and their
+// embeddings so that they can be memory-mapped and used in place. All fields
+// are little-endian.
+//
+// The file starts with a TokenStoreHeader, followed by a TokenStoreEntry per
+// token, followed by the string blob, which holds the tokens' NUL-terminated
+// text, followed by the embedding matrix. The matrix has a row of
+// num_channels values per token, and starts on a TOKEN_STORE_ALIGNMENT
+// boundary.
+
+// The magic number at the start of the file.
+static constexpr char TOKEN_STORE_MAGIC[8] = {
+  'T', 'O', 'K', 'S', 'T', 'O', 'R', 'E'
+};
+
+// The current version of the format.
+static constexpr uint32_t TOKEN_STORE_VERSION = 1;
+
+// The alignment of the embedding matrix, in bytes.
+static constexpr uint64_t TOKEN_STORE_ALIGNMENT = 64;
+
+// The file header.
+struct TokenStoreHeader {
+  // TOKEN_STORE_MAGIC.
+  char magic[8];
+
+  // The format version.
+  uint32_t version;
+
+  // The number of tokens.
+  uint32_t num_tokens;
+
+  // The number of values in each embedding.
+  uint32_t num_channels;
+
+  // Unused. Zero.
+  uint32_t reserved;
+
+  // The file offset and size of the string blob.
+  uint64_t strings_offset;
+  uint64_t strings_size;
+
+  // The file offset of the embedding matrix.
+  uint64_t embeddings_offset;
+};
+
+// A token's entry in the table that follows the header.
+struct TokenStoreEntry {
+  // The offset of the token's text in the string blob.
+  uint32_t text_offset;
+
+  // The length of the text, excluding its NUL terminator.
+  uint16_t text_length;
+
+  // 1 if the token is a suffix, otherwise 0.
+  uint8_t is_suffix;
+
+  // Unused. Zero.
+  uint8_t reserved;
+};
+
+static_assert(sizeof(TokenStoreHeader) == 48, "unexpected header padding");
+static_assert(sizeof(TokenStoreEntry) == 8, "unexpected entry padding");
+
+#endif // _token_store_format_h
@@ -0,0 +1,18 @@
+#include "top_scores.h"
+
+TopScores::TopScores(const unsigned int k_) :
+  k(k_)
+{
+  heap.reserve(k);
+}
+
+void TopScores::reset(const unsigned int k_) {
+  k = k_;
+  heap.clear();
+  heap.reserve(k);
+}
+
+const std::vector<ScoredItem>& TopScores::sorted() {
+  std::sort_heap(heap.begin(), heap.end(), is_better);
+  return heap;
+}
@@ -0,0 +1,58 @@
+#ifndef _top_scores_h
+#define _top_scores_h
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// An item and its score.
+struct ScoredItem {
+  int64_t score;
+  unsigned int item;
+};
+
+// Selects the k highest-scoring of the items offered to it in one pass.
+// The selection is a heap with the worst item at the front, so an item that
+// doesn't make the selection costs one comparison, and one that does costs
+// O(log k). Ties go to the lowest item.
+class TopScores {
+  public:
+    // Constructor.
+    TopScores(unsigned int k = 1);
+
+    // Empties the selection, and sets the number of items it keeps.
+    void reset(unsigned int k_);
+
+    // Returns the number of items the selection keeps.
+    unsigned int capacity() const { return k; }
+
+    // Offers an item to the selection.
+    void offer(const int64_t score, const unsigned int item) {
+      if (heap.size() < k) {
+        heap.push_back({score, item});
+        std::push_heap(heap.begin(), heap.end(), is_better);
+      } else if (k > 0 && is_better({score, item}, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), is_better);
+        heap.back() = {score, item};
+        std::push_heap(heap.begin(), heap.end(), is_better);
+      }
+    }
+
+    // Sorts the selection, best first, and returns it. Nothing should be
+    // offered after this until the next reset.
+    const std::vector<ScoredItem>& sorted();
+
+  private:
+    // The number of items kept.
+    unsigned int k;
+
+    // The selected items.
+    std::vector<ScoredItem> heap;
+
+    // Returns whether an item ranks above another.
+    static bool is_better(const ScoredItem& a, const ScoredItem& b) {
+      return a.score > b.score || (a.score == b.score && a.item < b.item);
+    }
+};
+
+#endif // _top_scores_h